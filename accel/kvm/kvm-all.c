@@ -1939,6 +1939,12 @@ static void kvm_eat_signals(CPUState *cpu)
     } while (sigismember(&chkset, SIG_IPI));
 }
 
+/*
+ * Devices without ioeventfd keep exiting to the same few registers; each
+ * vCPU thread remembers where they are in the memory map.
+ */
+static __thread AddressSpaceMMIOCache kvm_mmio_cache;
+
 int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
@@ -2028,11 +2034,11 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_MMIO:
             DPRINTF("handle_mmio\n");
             /* Called outside BQL */
-            address_space_rw(&address_space_memory,
-                             run->mmio.phys_addr, attrs,
-                             run->mmio.data,
-                             run->mmio.len,
-                             run->mmio.is_write);
+            address_space_rw_mmio(&address_space_memory, &kvm_mmio_cache,
+                                  run->mmio.phys_addr, attrs,
+                                  run->mmio.data,
+                                  run->mmio.len,
+                                  run->mmio.is_write);
             ret = 0;
             break;
         case KVM_EXIT_IRQ_WINDOW_OPEN:
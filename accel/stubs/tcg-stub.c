@@ -16,6 +16,7 @@
 #include "tcg/tcg.h"
 #include "exec/cpu-common.h"
 #include "exec/exec-all.h"
+#include "exec/cputlb.h"
 
 void tb_flush(CPUState *cpu)
 {
@@ -24,3 +25,11 @@ void tb_flush(CPUState *cpu)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
 }
+
+void tlb_dirty_log_add(CPUState *cpu, ram_addr_t ram_addr)
+{
+}
+
+void tlb_dirty_log_sync(void)
+{
+}
@@ -240,6 +240,9 @@ void cpu_exec_step_atomic(CPUState *cpu)
     /* volatile because we modify it between setjmp and longjmp */
     volatile bool in_exclusive_region = false;
 
+    /* Keep the TB's region from being evicted under our feet */
+    rcu_read_lock();
+
     if (sigsetjmp(cpu->jmp_env, 0) == 0) {
         tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
         if (tb == NULL) {
@@ -269,6 +272,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
         assert_no_pages_locked();
     }
 
+    rcu_read_unlock();
+
     if (in_exclusive_region) {
         /* We might longjump out of either the codegen or the
          * execution, so must make sure we only end the exclusive
@@ -390,6 +395,79 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     return;
 }
 
+/*
+ * Link the predicted indirect jump @n of @tb, emitted by
+ * tcg_gen_lookup_and_goto_ptr_pred(), to @tb_next.  The jump is only taken
+ * when the guest PC equals tb->jmp_pred, so that must be set before the
+ * jump is patched, and must not change while another vCPU might be between
+ * the comparison and the jump.  With parallel vCPUs the first prediction is
+ * therefore final; otherwise a new target replaces the previous one.
+ */
+void tb_add_jump_pred(TranslationBlock *tb, int n, TranslationBlock *tb_next)
+{
+    bool parallel = tb_cflags(tb) & CF_PARALLEL;
+
+    /* The translator vouched that the jump does not change these */
+    if (tb_next->cs_base != tb->cs_base || tb_next->flags != tb->flags ||
+        tb_next->trace_vcpu_dstate != tb->trace_vcpu_dstate ||
+        (tb_cflags(tb_next) & CF_HASH_MASK) !=
+        (tb_cflags(tb) & CF_HASH_MASK)) {
+        return;
+    }
+#ifndef CONFIG_USER_ONLY
+    /* Same restriction as for goto_tb, see tcg_gen_goto_tb() */
+    if ((tb_next->pc & TARGET_PAGE_MASK) != (tb->pc & TARGET_PAGE_MASK)) {
+        return;
+    }
+#endif
+    /* Generated code could see a torn jmp_pred */
+    if (parallel && TCG_OVERSIZED_GUEST) {
+        return;
+    }
+    if (atomic_read(&tb->jmp_pred_set) && tb->jmp_pred != tb_next->pc) {
+        if (parallel) {
+            return;
+        }
+        tb_jmp_unlink_one(tb, n);
+    }
+
+    qemu_spin_lock(&tb_next->jmp_lock);
+    if (tb_next->cflags & CF_INVALID) {
+        goto out_unlock_next;
+    }
+    if (atomic_cmpxchg(&tb->jmp_dest[n], (uintptr_t)NULL,
+                       (uintptr_t)tb_next)) {
+        goto out_unlock_next;
+    }
+    /* Lost a race against another prediction; give the slot back */
+    if (parallel && atomic_read(&tb->jmp_pred_set) &&
+        tb->jmp_pred != tb_next->pc) {
+        atomic_set(&tb->jmp_dest[n], (uintptr_t)NULL);
+        goto out_unlock_next;
+    }
+
+    tb->jmp_pred = tb_next->pc;
+    atomic_set(&tb->jmp_pred_set, true);
+    /* the prediction must be visible before the jump is */
+    smp_wmb();
+    tb_set_jmp_target(tb, n, (uintptr_t)tb_next->tc.ptr);
+
+    tb->jmp_list_next[n] = tb_next->jmp_list_head;
+    tb_next->jmp_list_head = (uintptr_t)tb | n;
+
+    qemu_spin_unlock(&tb_next->jmp_lock);
+
+    qemu_log_mask_and_addr(CPU_LOG_EXEC, tb->pc,
+                           "Predicting TB %p [" TARGET_FMT_lx
+                           "] index %d -> %p [" TARGET_FMT_lx "]\n",
+                           tb->tc.ptr, tb->pc, n,
+                           tb_next->tc.ptr, tb_next->pc);
+    return;
+
+ out_unlock_next:
+    qemu_spin_unlock(&tb_next->jmp_lock);
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit, uint32_t cf_mask)
@@ -400,11 +478,12 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
     if (tb == NULL) {
-        mmap_lock();
+        /* A TB never spans more than two guest pages */
+        mmap_lock_range(pc & TARGET_PAGE_MASK, 2 * TARGET_PAGE_SIZE);
         tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
-        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        tb_jmp_cache_insert(cpu, tb);
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
@@ -615,6 +694,12 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     ret = cpu_tb_exec(cpu, tb);
     tb = (TranslationBlock *)(ret & ~TB_EXIT_MASK);
     *tb_exit = ret & TB_EXIT_MASK;
+    if (unlikely(*tb_exit == TB_EXIT_HOT)) {
+        /* Nothing ran; the next lookup finds the superblock instead */
+        *last_tb = NULL;
+        tb_gen_superblock(cpu, tb);
+        return;
+    }
     if (*tb_exit != TB_EXIT_REQUESTED) {
         *last_tb = tb;
         return;
@@ -482,6 +482,87 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env->tlb_c.lock);
 }
 
+/*
+ * Mark the pages in the dirty log of @cpu dirty for migration, and flush
+ * its TLB so that they are logged again when next mapped writable.
+ * Every RAM page the TLB maps writable without TLB_NOTDIRTY while
+ * migrating is therefore either in the log or about to be flushed.
+ */
+static void tlb_dirty_log_flush(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    unsigned i;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(ALL_MMUIDX_BITS));
+    if (!env->tlb_c.dirty_log_len) {
+        return;
+    }
+    for (i = 0; i < CPU_TLB_DIRTY_LOG_SLOTS; i++) {
+        ram_addr_t entry = env->tlb_c.dirty_log[i];
+
+        if (entry) {
+            cpu_physical_memory_set_dirty_range(entry & TARGET_PAGE_MASK,
+                                                TARGET_PAGE_SIZE,
+                                                1 << DIRTY_MEMORY_MIGRATION);
+            env->tlb_c.dirty_log[i] = 0;
+        }
+    }
+    env->tlb_c.dirty_log_len = 0;
+}
+
+void tlb_dirty_log_add(CPUState *cpu, ram_addr_t ram_addr)
+{
+    CPUArchState *env = cpu->env_ptr;
+    ram_addr_t entry = (ram_addr & TARGET_PAGE_MASK) | 1;
+    unsigned i;
+
+    /* Linear probing; the set is never more than half full */
+    i = ((uint32_t)(ram_addr >> TARGET_PAGE_BITS) * 0x9e3779b1u)
+        >> (32 - CPU_TLB_DIRTY_LOG_BITS);
+    while (env->tlb_c.dirty_log[i]) {
+        if (env->tlb_c.dirty_log[i] == entry) {
+            return;
+        }
+        i = (i + 1) & (CPU_TLB_DIRTY_LOG_SLOTS - 1);
+    }
+    if (env->tlb_c.dirty_log_len == CPU_TLB_DIRTY_LOG_SIZE) {
+        tlb_dirty_log_flush(cpu, RUN_ON_CPU_NULL);
+        tlb_dirty_log_add(cpu, ram_addr);
+        return;
+    }
+    env->tlb_c.dirty_log[i] = entry;
+    env->tlb_c.dirty_log_len++;
+}
+
+/*
+ * tlb_fill() for a store.  While migrating, only store fills map RAM
+ * writable without TLB_NOTDIRTY; a page filled by a load keeps taking
+ * the notdirty path on its first write, which logs it then.
+ */
+static void tlb_fill_store(CPUState *cpu, target_ulong addr, int size,
+                           int mmu_idx, uintptr_t retaddr)
+{
+    CPUArchState *env = cpu->env_ptr;
+
+    env->tlb_c.dirty_log_store_fill = true;
+    tlb_fill(cpu, addr, size, MMU_DATA_STORE, mmu_idx, retaddr);
+    env->tlb_c.dirty_log_store_fill = false;
+}
+
+/* Called with the iothread lock held, before the migration bitmap is
+ * synced: merges the dirty log of every vCPU into it.
+ */
+void tlb_dirty_log_sync(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, tlb_dirty_log_flush, RUN_ON_CPU_NULL);
+    }
+}
+
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
@@ -527,8 +608,12 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     hwaddr iotlb, xlat, sz, paddr_page;
     target_ulong vaddr_page;
     int asidx = cpu_asidx_from_attrs(cpu, attrs);
+    bool store_fill = env->tlb_c.dirty_log_store_fill;
+    bool dirty_log = false;
 
     assert_cpu_is_self(cpu);
+    /* Also reset here in case the previous store fill raised a fault */
+    env->tlb_c.dirty_log_store_fill = false;
 
     if (size <= TARGET_PAGE_SIZE) {
         sz = TARGET_PAGE_SIZE;
@@ -569,6 +654,27 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr_page,
                                             paddr_page, xlat, prot, &address);
 
+    /*
+     * While migrating, writable RAM that needs no other dirty tracking is
+     * mapped without TLB_NOTDIRTY by store fills and logged instead, so
+     * that the first write to each page after a bitmap sync does not take
+     * the slow path.  This must be done before taking the TLB lock, as it
+     * may flush.
+     */
+    if (store_fill && (prot & PAGE_WRITE) && memory_region_is_ram(section->mr)
+        && !section->readonly && !(address & TLB_MMIO)
+        && (memory_region_get_dirty_log_mask(section->mr)
+            & (1 << DIRTY_MEMORY_MIGRATION))) {
+        ram_addr_t ram_addr = memory_region_get_ram_addr(section->mr) + xlat;
+
+        dirty_log =
+            cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_VGA)
+            && cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE);
+        if (dirty_log) {
+            tlb_dirty_log_add(cpu, ram_addr);
+        }
+    }
+
     index = tlb_index(env, mmu_idx, vaddr_page);
     te = tlb_entry(env, mmu_idx, vaddr_page);
 
@@ -636,6 +742,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
             || memory_region_is_romd(section->mr)) {
             /* Write access calls the I/O callback.  */
             tn.addr_write = address | TLB_MMIO;
+        } else if (dirty_log) {
+            tn.addr_write = address;
         } else if (memory_region_is_ram(section->mr)
                    && cpu_physical_memory_is_clean(
                        memory_region_get_ram_addr(section->mr) + xlat)) {
@@ -765,7 +873,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         CPUTLBEntry *entry;
         target_ulong tlb_addr;
 
-        tlb_fill(cpu, addr, size, MMU_DATA_STORE, mmu_idx, retaddr);
+        tlb_fill_store(cpu, addr, size, mmu_idx, retaddr);
 
         entry = tlb_entry(env, mmu_idx, addr);
         tlb_addr = tlb_addr_write(entry);
@@ -900,8 +1008,8 @@ void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
     if (!tlb_hit(tlb_addr_write(entry), addr)) {
         /* TLB entry is for a different page */
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, size, MMU_DATA_STORE,
-                     mmu_idx, retaddr);
+            tlb_fill_store(ENV_GET_CPU(env), addr, size,
+                           mmu_idx, retaddr);
         }
     }
 }
@@ -943,8 +1051,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     /* Check TLB entry and enforce page permissions.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
-            tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_STORE,
-                     mmu_idx, retaddr);
+            tlb_fill_store(ENV_GET_CPU(env), addr, 1 << s_bits,
+                           mmu_idx, retaddr);
         }
         tlb_addr = tlb_addr_write(tlbe) & ~TLB_INVALID_MASK;
     }
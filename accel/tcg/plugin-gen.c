@@ -0,0 +1,306 @@
+/*
+ * QEMU TCG plugin support, code generation
+ *
+ * Instrumentation is generated at the tail of the op stream once the TB
+ * has been translated, then moved after the op recorded for the TB, insn
+ * or memory access it belongs to.  Plugins therefore see the whole TB
+ * before deciding what to instrument, and nothing is emitted when they do
+ * not ask for anything.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg/tcg.h"
+#include "tcg/tcg-op.h"
+#include "exec/exec-all.h"
+#include "exec/helper-proto.h"
+#include "exec/helper-gen.h"
+#include "exec/plugin-gen.h"
+
+void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *f, void *udata)
+{
+    qemu_plugin_vcpu_udata_cb_t cb = f;
+
+    cb(cpu_index, udata);
+}
+
+void HELPER(plugin_vcpu_mem_cb)(uint32_t cpu_index, void *f, uint32_t info,
+                                uint64_t vaddr, void *udata)
+{
+    qemu_plugin_vcpu_mem_cb_t cb = f;
+
+    cb(cpu_index, info, vaddr, udata);
+}
+
+/* Reused by every translation made by this thread */
+static __thread struct qemu_plugin_tb *plugin_tb_cache;
+
+static struct qemu_plugin_tb *plugin_tb_get(void)
+{
+    struct qemu_plugin_tb *ptb = plugin_tb_cache;
+
+    if (ptb == NULL) {
+        ptb = g_new0(struct qemu_plugin_tb, 1);
+        ptb->exec_cbs = g_array_new(false, false,
+                                    sizeof(struct qemu_plugin_dyn_cb));
+        ptb->insns = g_ptr_array_new();
+        plugin_tb_cache = ptb;
+    }
+    ptb->n = 0;
+    g_array_set_size(ptb->exec_cbs, 0);
+    return ptb;
+}
+
+static struct qemu_plugin_insn *plugin_insn_get(struct qemu_plugin_tb *ptb)
+{
+    struct qemu_plugin_insn *insn;
+
+    if (ptb->n == ptb->insns->len) {
+        insn = g_new0(struct qemu_plugin_insn, 1);
+        insn->exec_cbs = g_array_new(false, false,
+                                     sizeof(struct qemu_plugin_dyn_cb));
+        insn->mem_cbs = g_array_new(false, false,
+                                    sizeof(struct qemu_plugin_dyn_cb));
+        insn->mem_recs = g_array_new(false, false,
+                                     sizeof(struct qemu_plugin_mem_rec));
+        g_ptr_array_add(ptb->insns, insn);
+    } else {
+        insn = g_ptr_array_index(ptb->insns, ptb->n);
+    }
+    ptb->n++;
+    g_array_set_size(insn->exec_cbs, 0);
+    g_array_set_size(insn->mem_cbs, 0);
+    g_array_set_size(insn->mem_recs, 0);
+    return insn;
+}
+
+void plugin_gen_tb_start(const TranslationBlock *tb)
+{
+    struct qemu_plugin_tb *ptb;
+
+    tcg_ctx->plugin_tb = NULL;
+    tcg_ctx->plugin_insn = NULL;
+    if (!qemu_plugin_tb_trans_enabled()) {
+        return;
+    }
+    ptb = plugin_tb_get();
+    ptb->vaddr = tb->pc;
+    ptb->anchor = tcg_last_op();
+    tcg_ctx->plugin_tb = ptb;
+}
+
+void plugin_gen_insn_start(target_ulong pc)
+{
+    struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
+    struct qemu_plugin_insn *insn;
+
+    if (ptb == NULL) {
+        return;
+    }
+    insn = plugin_insn_get(ptb);
+    insn->vaddr = pc;
+    insn->size = 0;
+    insn->anchor = tcg_last_op();
+    tcg_ctx->plugin_insn = insn;
+}
+
+void plugin_gen_insn_end(target_ulong pc_next)
+{
+    struct qemu_plugin_insn *insn = tcg_ctx->plugin_insn;
+
+    if (insn == NULL) {
+        return;
+    }
+    insn->size = pc_next - insn->vaddr;
+    tcg_ctx->plugin_insn = NULL;
+}
+
+TCGv plugin_prep_mem(TCGv addr)
+{
+    TCGv copy;
+
+    if (tcg_ctx->plugin_insn == NULL) {
+        return NULL;
+    }
+    /* The access itself may overwrite @addr.  Unused copies are dead.  */
+    copy = tcg_temp_new();
+    tcg_gen_mov_tl(copy, addr);
+    return copy;
+}
+
+void plugin_gen_mem(TCGv addr, TCGMemOp memop, bool is_store)
+{
+    struct qemu_plugin_mem_rec rec;
+
+    if (addr == NULL) {
+        return;
+    }
+    rec.op = tcg_last_op();
+    rec.addr = addr;
+    rec.info = memop & MO_SIZE;
+    if (memop & MO_SIGN) {
+        rec.info |= PLUGIN_MEMINFO_SIGN_EXTEND;
+    }
+    if ((memop & MO_BSWAP) == MO_BE) {
+        rec.info |= PLUGIN_MEMINFO_BIG_ENDIAN;
+    }
+    if (is_store) {
+        rec.info |= PLUGIN_MEMINFO_STORE;
+    }
+    g_array_append_val(tcg_ctx->plugin_insn->mem_recs, rec);
+    tcg_temp_free(addr);
+}
+
+/*
+ * Temporaries shared by all the instrumentation of a TB.  Each inserted
+ * sequence sets them before use and leaves them dead, so they can be
+ * reused from one sequence to the next; they must however not alias any
+ * temp of the guest code around the insertion points.
+ */
+struct plugin_gen_temps {
+    TCGv_i32 cpu_index;
+    TCGv_i32 info;
+    TCGv_ptr f;
+    TCGv_ptr udata;
+    TCGv_i64 vaddr;
+    TCGv_i64 val;
+};
+
+/* Move the ops emitted after @last to follow @anchor */
+static TCGOp *plugin_move_ops(TCGOp *last, TCGOp *anchor)
+{
+    TCGOp *op;
+
+    if (last == anchor) {
+        return tcg_last_op();
+    }
+    while ((op = QTAILQ_NEXT(last, link)) != NULL) {
+        QTAILQ_REMOVE(&tcg_ctx->ops, op, link);
+        QTAILQ_INSERT_AFTER(&tcg_ctx->ops, anchor, op, link);
+        anchor = op;
+    }
+    return anchor;
+}
+
+static TCGOp *plugin_gen_cb(TCGOp *anchor, const struct qemu_plugin_dyn_cb *cb,
+                            const struct qemu_plugin_mem_rec *rec,
+                            const struct plugin_gen_temps *t)
+{
+    TCGOp *last = tcg_last_op();
+
+    switch (cb->type) {
+    case PLUGIN_CB_INLINE:
+        tcg_gen_movi_ptr(t->f, (intptr_t)cb->userp);
+        tcg_gen_ld_i64(t->val, t->f, 0);
+        tcg_gen_addi_i64(t->val, t->val, cb->imm);
+        tcg_gen_st_i64(t->val, t->f, 0);
+        break;
+    case PLUGIN_CB_REGULAR:
+        tcg_gen_ld_i32(t->cpu_index, cpu_env,
+                       -ENV_OFFSET + offsetof(CPUState, cpu_index));
+        tcg_gen_movi_ptr(t->f, (intptr_t)cb->f);
+        tcg_gen_movi_ptr(t->udata, (intptr_t)cb->userp);
+        if (rec) {
+            tcg_gen_movi_i32(t->info, rec->info);
+            tcg_gen_extu_tl_i64(t->vaddr, (TCGv)rec->addr);
+            gen_helper_plugin_vcpu_mem_cb(t->cpu_index, t->f, t->info,
+                                          t->vaddr, t->udata);
+        } else {
+            gen_helper_plugin_vcpu_udata_cb(t->cpu_index, t->f, t->udata);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    return plugin_move_ops(last, anchor);
+}
+
+static void plugin_gen_cbs(TCGOp *anchor, GArray *cbs,
+                           const struct plugin_gen_temps *t)
+{
+    guint i;
+
+    for (i = 0; i < cbs->len; i++) {
+        anchor = plugin_gen_cb(anchor, &g_array_index(cbs,
+                               struct qemu_plugin_dyn_cb, i), NULL, t);
+    }
+}
+
+static void plugin_gen_mem_cbs(const struct qemu_plugin_mem_rec *rec,
+                               GArray *cbs, const struct plugin_gen_temps *t)
+{
+    enum qemu_plugin_mem_rw rw = rec->info & PLUGIN_MEMINFO_STORE ?
+                                 QEMU_PLUGIN_MEM_W : QEMU_PLUGIN_MEM_R;
+    TCGOp *anchor = rec->op;
+    guint i;
+
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (cb->rw & rw) {
+            anchor = plugin_gen_cb(anchor, cb, rec, t);
+        }
+    }
+}
+
+static void plugin_gen_inject(struct qemu_plugin_tb *ptb)
+{
+    TCGTempSet free_temps[ARRAY_SIZE(tcg_ctx->free_temps)];
+    struct plugin_gen_temps t;
+    size_t i, j;
+
+    /* Hide the free temps so that ours cannot alias the guest's */
+    memcpy(free_temps, tcg_ctx->free_temps, sizeof(free_temps));
+    memset(tcg_ctx->free_temps, 0, sizeof(free_temps));
+
+    t.cpu_index = tcg_temp_new_i32();
+    t.info = tcg_temp_new_i32();
+    t.f = tcg_temp_new_ptr();
+    t.udata = tcg_temp_new_ptr();
+    t.vaddr = tcg_temp_new_i64();
+    t.val = tcg_temp_new_i64();
+
+    plugin_gen_cbs(ptb->anchor, ptb->exec_cbs, &t);
+    for (i = 0; i < ptb->n; i++) {
+        struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, i);
+
+        plugin_gen_cbs(insn->anchor, insn->exec_cbs, &t);
+        if (insn->mem_cbs->len == 0) {
+            continue;
+        }
+        for (j = 0; j < insn->mem_recs->len; j++) {
+            plugin_gen_mem_cbs(&g_array_index(insn->mem_recs,
+                                              struct qemu_plugin_mem_rec, j),
+                               insn->mem_cbs, &t);
+        }
+    }
+
+    tcg_temp_free_i32(t.cpu_index);
+    tcg_temp_free_i32(t.info);
+    tcg_temp_free_ptr(t.f);
+    tcg_temp_free_ptr(t.udata);
+    tcg_temp_free_i64(t.vaddr);
+    tcg_temp_free_i64(t.val);
+    memcpy(tcg_ctx->free_temps, free_temps, sizeof(free_temps));
+}
+
+void plugin_gen_tb_end(CPUState *cpu)
+{
+    struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
+
+    if (ptb == NULL) {
+        return;
+    }
+    /* An insn stopped at a breakpoint was never translated */
+    if (tcg_ctx->plugin_insn) {
+        ptb->n--;
+        tcg_ctx->plugin_insn = NULL;
+    }
+    qemu_plugin_tb_trans_cb(cpu, ptb);
+    plugin_gen_inject(ptb);
+    tcg_ctx->plugin_tb = NULL;
+}
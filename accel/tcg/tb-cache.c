@@ -0,0 +1,457 @@
+/*
+ * Persistent translation cache for user-mode emulation
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ *
+ * Short-lived processes spend most of their time translating the same
+ * guest code over and over.  This cache saves the contents of the code
+ * buffer on exit and maps it back in place on the next start of the same
+ * executable, so that TBs can be reused instead of retranslated.
+ *
+ * Host code embeds absolute addresses of helpers, of the prologue and of
+ * the TBs themselves, so rather than relocating it we only reuse a cache
+ * file when all of those are guaranteed to be the same: the same qemu
+ * binary, with the code buffer and the prologue at the same address and
+ * the same guest_base.  This is the case for the usual static, non-PIE
+ * qemu-user builds registered with binfmt_misc.  Any mismatch just makes
+ * the file look empty; it is overwritten on exit.
+ *
+ * TBs that embed other host pointers, such as heap data passed to
+ * helpers, are not saved.
+ *
+ * Each saved TB carries a hash of the guest code it was translated from,
+ * which is checked against guest memory before the TB is reused, so
+ * shared libraries that changed or were mapped elsewhere are translated
+ * afresh.
+ *
+ * The file is trusted with host code, so it is only read if it belongs
+ * to us and nobody else can write to it, and only used if its SHA-256
+ * checksum matches.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "qemu/cutils.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "exec/tb-cache.h"
+#include "tcg.h"
+
+#define TB_CACHE_MAGIC   0x43425451 /* "QTBC" */
+#define TB_CACHE_VERSION 2
+#define TB_CACHE_CSUM_LEN 32
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    /* anchors; the file is only used if all of these match */
+    uint64_t host_exe[4];
+    uint64_t host_text;
+    uint64_t prologue;
+    uint64_t buffer;
+    uint64_t buffer_size;
+    uint64_t guest_base;
+    char cpu_model[64];
+    /* payload */
+    uint64_t image_size;
+    uint64_t n_entries;
+} TBCacheHeader;
+
+typedef struct TBCacheFileEntry {
+    uint64_t offset;
+    uint64_t hash;
+} TBCacheFileEntry;
+
+typedef struct TBCacheKey {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+} TBCacheKey;
+
+typedef struct TBCacheEntry {
+    TBCacheKey key;
+    TranslationBlock *tb;
+    uint64_t hash;
+    bool adopted;
+} TBCacheEntry;
+
+bool tb_cache_enabled;
+
+static struct {
+    char *path;
+    TBCacheHeader anchor;
+    /* TBs loaded from the file, keyed by TBCacheKey */
+    GHashTable *index;
+    /* TBCacheFileEntry for each TB linked since the last flush */
+    GArray *noted;
+    bool dirty;
+} tb_cache;
+
+static uint64_t tb_cache_hash(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+#define TB_CACHE_HASH_INIT 0xcbf29ce484222325ull
+
+static void tb_cache_key_init(TBCacheKey *key, target_ulong pc,
+                              target_ulong cs_base, uint32_t flags,
+                              uint32_t cflags, uint32_t trace_vcpu_dstate)
+{
+    memset(key, 0, sizeof(*key));
+    key->pc = pc;
+    key->cs_base = cs_base;
+    key->flags = flags;
+    key->cflags = cflags & CF_HASH_MASK;
+    key->trace_vcpu_dstate = trace_vcpu_dstate;
+}
+
+static guint tb_cache_key_hash(gconstpointer p)
+{
+    return tb_cache_hash(TB_CACHE_HASH_INIT, p, sizeof(TBCacheKey));
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(TBCacheKey));
+}
+
+/* Returns false if any page of the guest range is not readable */
+static bool tb_cache_guest_hash(target_ulong pc, target_ulong size,
+                                uint64_t *phash)
+{
+    target_ulong last = pc + MAX(size, 1) - 1;
+    target_ulong page;
+
+    for (page = pc & TARGET_PAGE_MASK; ; page += TARGET_PAGE_SIZE) {
+        int flags = page_get_flags(page);
+
+        if (!(flags & PAGE_VALID) || !(flags & PAGE_READ)) {
+            return false;
+        }
+        if (page == (last & TARGET_PAGE_MASK)) {
+            break;
+        }
+    }
+    *phash = tb_cache_hash(TB_CACHE_HASH_INIT, g2h(pc), size);
+    return true;
+}
+
+static void tb_cache_anchor_init(const char *cpu_model)
+{
+    TBCacheHeader *h = &tb_cache.anchor;
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    h->magic = TB_CACHE_MAGIC;
+    h->version = TB_CACHE_VERSION;
+    if (stat("/proc/self/exe", &st) == 0) {
+        h->host_exe[0] = st.st_dev;
+        h->host_exe[1] = st.st_ino;
+        h->host_exe[2] = st.st_size;
+        h->host_exe[3] = st.st_mtime;
+    }
+    h->host_text = (uintptr_t)tb_cache_init;
+    h->prologue = tb_cache_hash(TB_CACHE_HASH_INIT, tcg_ctx->code_gen_prologue,
+                                tcg_ctx->code_gen_buffer -
+                                tcg_ctx->code_gen_prologue);
+    h->buffer = (uintptr_t)tcg_ctx->code_gen_buffer;
+    h->buffer_size = tcg_ctx->code_gen_buffer_size;
+    h->guest_base = guest_base;
+    pstrcpy(h->cpu_model, sizeof(h->cpu_model), cpu_model);
+}
+
+static char *tb_cache_path(const char *dir, const char *exec_path)
+{
+    char *real = realpath(exec_path, NULL);
+    struct stat st;
+    uint64_t h;
+    char *path;
+
+    if (!real || stat(real, &st) < 0) {
+        free(real);
+        return NULL;
+    }
+    h = tb_cache_hash(TB_CACHE_HASH_INIT, real, strlen(real));
+    h = tb_cache_hash(h, &st.st_dev, sizeof(st.st_dev));
+    h = tb_cache_hash(h, &st.st_ino, sizeof(st.st_ino));
+    h = tb_cache_hash(h, &st.st_size, sizeof(st.st_size));
+    h = tb_cache_hash(h, &st.st_mtime, sizeof(st.st_mtime));
+    free(real);
+
+    path = g_strdup_printf("%s/" TARGET_NAME "-%016" PRIx64 ".tbc", dir, h);
+    return path;
+}
+
+/* Open the cache file for reading, unless someone else could have written it */
+static FILE *tb_cache_open(void)
+{
+    struct stat st;
+    FILE *f;
+    int fd;
+
+    fd = open(tb_cache.path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        close(fd);
+        return NULL;
+    }
+    f = fdopen(fd, "rb");
+    if (!f) {
+        close(fd);
+    }
+    return f;
+}
+
+static void tb_cache_load(void)
+{
+    void *buf = tcg_ctx->code_gen_buffer;
+    GChecksum *csum = g_checksum_new(G_CHECKSUM_SHA256);
+    uint8_t file_digest[TB_CACHE_CSUM_LEN], digest[TB_CACHE_CSUM_LEN];
+    gsize digest_len = sizeof(digest);
+    TBCacheFileEntry *entries = NULL;
+    TBCacheHeader hdr;
+    uint64_t i;
+    FILE *f;
+
+    f = tb_cache_open();
+    if (!f) {
+        goto out_csum;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(&hdr, &tb_cache.anchor, offsetof(TBCacheHeader, image_size)) ||
+        hdr.image_size > (uintptr_t)(tcg_ctx->code_gen_highwater - buf) ||
+        hdr.n_entries > hdr.image_size / sizeof(TranslationBlock)) {
+        goto out;
+    }
+    entries = g_new(TBCacheFileEntry, hdr.n_entries);
+    if (fread(buf, 1, hdr.image_size, f) != hdr.image_size ||
+        fread(entries, sizeof(*entries), hdr.n_entries, f) != hdr.n_entries ||
+        fread(file_digest, sizeof(file_digest), 1, f) != 1) {
+        goto out;
+    }
+
+    /* Nothing in the image can be reached before this check */
+    g_checksum_update(csum, (const guchar *)&hdr, sizeof(hdr));
+    g_checksum_update(csum, buf, hdr.image_size);
+    g_checksum_update(csum, (const guchar *)entries,
+                      hdr.n_entries * sizeof(*entries));
+    g_checksum_get_digest(csum, digest, &digest_len);
+    if (digest_len != sizeof(digest) ||
+        memcmp(digest, file_digest, sizeof(digest))) {
+        goto out;
+    }
+
+    for (i = 0; i < hdr.n_entries; i++) {
+        TBCacheFileEntry *fe = &entries[i];
+        TranslationBlock *tb;
+        TBCacheEntry *e;
+
+        if (hdr.image_size < sizeof(*tb) ||
+            fe->offset > hdr.image_size - sizeof(*tb)) {
+            continue;
+        }
+        tb = buf + fe->offset;
+        if ((void *)tb->tc.ptr < buf ||
+            (void *)tb->tc.ptr + tb->tc.size > buf + hdr.image_size) {
+            continue;
+        }
+        e = g_new(TBCacheEntry, 1);
+        tb_cache_key_init(&e->key, tb->pc, tb->cs_base, tb->flags,
+                          tb->cflags, tb->trace_vcpu_dstate);
+        e->tb = tb;
+        e->hash = fe->hash;
+        e->adopted = false;
+        g_hash_table_replace(tb_cache.index, e, e);
+    }
+
+    flush_icache_range((uintptr_t)buf, (uintptr_t)buf + hdr.image_size);
+    tcg_ctx->code_gen_ptr = buf + hdr.image_size;
+ out:
+    g_free(entries);
+    fclose(f);
+ out_csum:
+    g_checksum_free(csum);
+}
+
+void tb_cache_init(const char *dir, const char *exec_path,
+                   const char *cpu_model)
+{
+    tb_cache.path = tb_cache_path(dir, exec_path);
+    if (!tb_cache.path) {
+        return;
+    }
+    tb_cache_anchor_init(cpu_model);
+    tb_cache.index = g_hash_table_new_full(tb_cache_key_hash,
+                                           tb_cache_key_equal, NULL, g_free);
+    tb_cache.noted = g_array_new(false, false, sizeof(TBCacheFileEntry));
+    tb_cache_enabled = true;
+
+    tb_cache_load();
+}
+
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags,
+                                  uint32_t cflags)
+{
+    TBCacheKey key;
+    TBCacheEntry *e;
+    TranslationBlock *tb;
+    uint64_t hash;
+
+    assert_memory_lock();
+
+    if (g_hash_table_size(tb_cache.index) == 0) {
+        return NULL;
+    }
+    tb_cache_key_init(&key, pc, cs_base, flags, cflags, *cpu->trace_dstate);
+    e = g_hash_table_lookup(tb_cache.index, &key);
+    if (e == NULL || e->adopted) {
+        return NULL;
+    }
+    tb = e->tb;
+    /* a superblock was asked for; don't hand back the TB it replaces */
+    if ((cflags & CF_SUPERBLOCK) && !(tb->cflags & CF_SUPERBLOCK)) {
+        return NULL;
+    }
+    if (!tb_cache_guest_hash(pc, tb->size, &hash)) {
+        return NULL;
+    }
+    if (hash != e->hash) {
+        /* the guest code changed, this entry is of no further use */
+        g_hash_table_remove(tb_cache.index, &key);
+        tb_cache.dirty = true;
+        return NULL;
+    }
+    e->adopted = true;
+    return tb;
+}
+
+void tb_cache_note(TranslationBlock *tb)
+{
+    TBCacheFileEntry fe;
+
+    if (!tb_cache_guest_hash(tb->pc, tb->size, &fe.hash)) {
+        return;
+    }
+    fe.offset = (void *)tb - tcg_ctx->code_gen_buffer;
+    g_array_append_val(tb_cache.noted, fe);
+    tb_cache.dirty = true;
+}
+
+void tb_cache_flush(void)
+{
+    g_hash_table_remove_all(tb_cache.index);
+    g_array_set_size(tb_cache.noted, 0);
+    tb_cache.dirty = true;
+}
+
+static bool tb_cache_valid(TranslationBlock *tb)
+{
+    return !(tb->cflags & (CF_INVALID | CF_NOCACHE));
+}
+
+static bool tb_cache_write(FILE *f)
+{
+    void *buf = tcg_ctx->code_gen_buffer;
+    TBCacheHeader hdr = tb_cache.anchor;
+    GArray *entries = g_array_new(false, false, sizeof(TBCacheFileEntry));
+    GChecksum *csum = g_checksum_new(G_CHECKSUM_SHA256);
+    uint8_t digest[TB_CACHE_CSUM_LEN];
+    gsize digest_len = sizeof(digest);
+    GHashTableIter iter;
+    TBCacheEntry *e;
+    bool ok;
+    guint i;
+
+    /*
+     * Loaded TBs go first, whether they were needed this time or not, so
+     * that a fresh translation of the same state wins when reloading.
+     */
+    g_hash_table_iter_init(&iter, tb_cache.index);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        if (tb_cache_valid(e->tb)) {
+            TBCacheFileEntry fe = {
+                .offset = (void *)e->tb - buf,
+                .hash = e->hash,
+            };
+            g_array_append_val(entries, fe);
+        }
+    }
+    for (i = 0; i < tb_cache.noted->len; i++) {
+        TBCacheFileEntry *fe = &g_array_index(tb_cache.noted,
+                                              TBCacheFileEntry, i);
+
+        if (tb_cache_valid(buf + fe->offset)) {
+            g_array_append_val(entries, *fe);
+        }
+    }
+
+    hdr.image_size = tcg_ctx->code_gen_ptr - buf;
+    hdr.n_entries = entries->len;
+    g_checksum_update(csum, (const guchar *)&hdr, sizeof(hdr));
+    g_checksum_update(csum, buf, hdr.image_size);
+    g_checksum_update(csum, (const guchar *)entries->data,
+                      entries->len * sizeof(TBCacheFileEntry));
+    g_checksum_get_digest(csum, digest, &digest_len);
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(buf, 1, hdr.image_size, f) == hdr.image_size &&
+         fwrite(entries->data, sizeof(TBCacheFileEntry), entries->len,
+                f) == entries->len &&
+         fwrite(digest, sizeof(digest), 1, f) == 1;
+    g_array_free(entries, true);
+    g_checksum_free(csum);
+    return ok;
+}
+
+void tb_cache_save(void)
+{
+    char *tmp;
+    FILE *f;
+    bool ok;
+    int fd;
+
+    if (!tb_cache_enabled) {
+        return;
+    }
+    mmap_lock();
+    /* nothing new was translated, the file on disk is still good */
+    if (!tb_cache.dirty) {
+        goto out;
+    }
+    /* write to a private file first, concurrent processes may exit too */
+    tmp = g_strdup_printf("%s.%d", tb_cache.path, getpid());
+    unlink(tmp);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (fd >= 0 && !f) {
+        close(fd);
+        unlink(tmp);
+    }
+    if (f) {
+        ok = tb_cache_write(f);
+        ok &= fclose(f) == 0;
+        if (!ok || rename(tmp, tb_cache.path) < 0) {
+            unlink(tmp);
+        }
+    }
+    g_free(tmp);
+    tb_cache.dirty = false;
+ out:
+    mmap_unlock();
+}
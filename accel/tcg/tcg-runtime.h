@@ -25,9 +25,16 @@ DEF_HELPER_FLAGS_1(ctpop_i32, TCG_CALL_NO_RWG_SE, i32, i32)
 DEF_HELPER_FLAGS_1(ctpop_i64, TCG_CALL_NO_RWG_SE, i64, i64)
 
 DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, ptr, env)
+DEF_HELPER_FLAGS_3(lookup_tb_ptr_pred, TCG_CALL_NO_WG_SE, ptr, env, ptr, i32)
 
 DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
 
+#ifdef CONFIG_PLUGIN
+DEF_HELPER_FLAGS_3(plugin_vcpu_udata_cb, TCG_CALL_NO_RWG, void, i32, ptr, ptr)
+DEF_HELPER_FLAGS_5(plugin_vcpu_mem_cb, TCG_CALL_NO_RWG, void,
+                   i32, ptr, i32, i64, ptr)
+#endif
+
 #ifdef CONFIG_SOFTMMU
 
 DEF_HELPER_FLAGS_5(atomic_cmpxchgb, TCG_CALL_NO_WG,
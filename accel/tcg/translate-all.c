@@ -51,6 +51,8 @@
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
+#include "exec/tb-lookup.h"
+#include "exec/tb-cache.h"
 #include "translate-all.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
@@ -89,8 +91,9 @@
 
 /* Access to the various translations structures need to be serialised via locks
  * for consistency.
- * In user-mode emulation access to the memory related structures are protected
- * with mmap_lock.
+ * In user-mode emulation the page flags are protected by the mmap_lock of the
+ * range they belong to; since different ranges can be locked at the same time,
+ * the TB lists are additionally protected by per-page locks, as in !user-mode.
  * In !user-mode we use per-page locks.
  */
 #ifdef CONFIG_SOFTMMU
@@ -112,9 +115,7 @@ typedef struct PageDesc {
 #else
     unsigned long flags;
 #endif
-#ifndef CONFIG_USER_ONLY
     QemuSpin lock;
-#endif
 } PageDesc;
 
 /**
@@ -216,6 +217,14 @@ __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * mmap_lock_range() lets vCPUs translate code from different ranges at
+ * the same time, but they all share tcg_ctx.
+ */
+static QemuMutex tb_gen_lock;
+#endif
+
 static void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -525,7 +534,6 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
             return NULL;
         }
         pd = g_new0(PageDesc, V_L2_SIZE);
-#ifndef CONFIG_USER_ONLY
         {
             int i;
 
@@ -533,7 +541,6 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
                 qemu_spin_init(&pd[i].lock);
             }
         }
-#endif
         existing = atomic_cmpxchg(lp, NULL, pd);
         if (unlikely(existing)) {
             g_free(pd);
@@ -552,33 +559,6 @@ static inline PageDesc *page_find(tb_page_addr_t index)
 static void page_lock_pair(PageDesc **ret_p1, tb_page_addr_t phys1,
                            PageDesc **ret_p2, tb_page_addr_t phys2, int alloc);
 
-/* In user-mode page locks aren't used; mmap_lock is enough */
-#ifdef CONFIG_USER_ONLY
-
-#define assert_page_locked(pd) tcg_debug_assert(have_mmap_lock())
-
-static inline void page_lock(PageDesc *pd)
-{ }
-
-static inline void page_unlock(PageDesc *pd)
-{ }
-
-static inline void page_lock_tb(const TranslationBlock *tb)
-{ }
-
-static inline void page_unlock_tb(const TranslationBlock *tb)
-{ }
-
-struct page_collection *
-page_collection_lock(tb_page_addr_t start, tb_page_addr_t end)
-{
-    return NULL;
-}
-
-void page_collection_unlock(struct page_collection *set)
-{ }
-#else /* !CONFIG_USER_ONLY */
-
 #ifdef CONFIG_DEBUG_TCG
 
 static __thread GHashTable *ht_pages_locked_debug;
@@ -850,8 +830,6 @@ void page_collection_unlock(struct page_collection *set)
     g_free(set);
 }
 
-#endif /* !CONFIG_USER_ONLY */
-
 static void page_lock_pair(PageDesc **ret_p1, tb_page_addr_t phys1,
                            PageDesc **ret_p2, tb_page_addr_t phys2, int alloc)
 {
@@ -1150,6 +1128,9 @@ void tcg_exec_init(unsigned long tb_size)
     page_init();
     tb_htable_init();
     code_gen_alloc(tb_size);
+#ifdef CONFIG_USER_ONLY
+    qemu_mutex_init(&tb_gen_lock);
+#endif
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
@@ -1257,6 +1238,11 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     page_flush_tb();
 
     tcg_region_reset_all();
+#ifdef CONFIG_USER_ONLY
+    if (tb_cache_enabled) {
+        tb_cache_flush();
+    }
+#endif
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     atomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
@@ -1421,6 +1407,40 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_unlock(&dest->jmp_lock);
 }
 
+/*
+ * Undo the outgoing jump @n of @tb so that it can be linked again, e.g. to
+ * a different destination.  Unlike tb_remove_from_jmp_list(), this leaves
+ * @tb usable.
+ */
+void tb_jmp_unlink_one(TranslationBlock *tb, int n)
+{
+    uintptr_t ptr = atomic_read(&tb->jmp_dest[n]);
+    TranslationBlock *dest = (TranslationBlock *)ptr;
+    TranslationBlock *it;
+    uintptr_t *pprev;
+    int m;
+
+    /* nothing to do if unlinked, or if @tb itself is being invalidated */
+    if (ptr == (uintptr_t)NULL || (ptr & 1)) {
+        return;
+    }
+
+    qemu_spin_lock(&dest->jmp_lock);
+    /* claim the slot back; this fails if the jump was unlinked meanwhile */
+    if (atomic_cmpxchg(&tb->jmp_dest[n], ptr, (uintptr_t)NULL) == ptr) {
+        pprev = &dest->jmp_list_head;
+        TB_FOR_EACH_JMP(dest, it, m) {
+            if (it == tb && m == n) {
+                *pprev = it->jmp_list_next[m];
+                break;
+            }
+            pprev = &it->jmp_list_next[m];
+        }
+        tb_reset_jump(tb, n);
+    }
+    qemu_spin_unlock(&dest->jmp_lock);
+}
+
 /*
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
@@ -1462,11 +1482,8 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            atomic_set(&cpu->tb_jmp_cache[h], NULL);
-        }
+        tb_jmp_cache_remove(cpu, tb);
     }
 
     /* suppress this TB from the two jump lists */
@@ -1532,7 +1549,7 @@ static void build_page_bitmap(PageDesc *p)
 /* add the tb in the target page and protect it if necessary
  *
  * Called with mmap_lock held for user-mode emulation.
- * Called with @p->lock held in !user-mode.
+ * Called with @p->lock held.
  */
 static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
                                unsigned int n, tb_page_addr_t page_addr)
@@ -1667,10 +1684,145 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+static gboolean tb_evict_collect(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    GPtrArray *tbs = data;
+
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        g_ptr_array_add(tbs, tb);
+    }
+    return false;
+}
+
+/*
+ * Eviction of a region in progress: the region is released once every
+ * vCPU has dropped its stale jump cache entries.  @pending is biased by
+ * one while the work items are being queued.
+ */
+struct tb_evict {
+    size_t idx;
+    int pending;
+};
+
+static void tb_evict_put(struct tb_evict *ev)
+{
+    if (atomic_fetch_dec(&ev->pending) == 1) {
+        tcg_region_evict_end(ev->idx);
+        g_free(ev);
+    }
+}
+
+/*
+ * Drop this vCPU's jump cache entries that still point to TBs of an
+ * evicted region.  A vCPU that looked a TB up in the hash table just
+ * before it was invalidated may have put it back in its jump cache after
+ * do_tb_phys_invalidate() removed it; once the vCPU is out of cpu_exec()
+ * to run this, that can no longer happen.  The other vCPUs keep running.
+ */
+static void tb_evict_jmp_cache(CPUState *cpu, run_on_cpu_data data)
+{
+    struct tb_evict *ev = data.host_ptr;
+    size_t i;
+
+    for (i = 0; i < tb_jmp_cache_size(); i++) {
+        if (tcg_region_contains(ev->idx, atomic_read(&cpu->tb_jmp_cache[i]))) {
+            atomic_set(&cpu->tb_jmp_cache[i], NULL);
+        }
+    }
+    tb_evict_put(ev);
+}
+
+/*
+ * Reclaim the coldest full TCG region without a full tb_flush().
+ * Invalidating its TBs unlinks every jump into them and drops them from
+ * the lookup tables; each vCPU then clears its own stale jump cache
+ * entries, and the region itself is reused after an RCU grace period,
+ * since cpu_exec() runs generated code in a read-side section.
+ */
+static void tb_evict_cold_region(CPUState *cpu)
+{
+    struct tb_evict *ev;
+    GPtrArray *tbs;
+    CPUState *c;
+    size_t idx;
+    guint i;
+
+    if (!tcg_region_evict_begin(&idx)) {
+        return;
+    }
+
+    tbs = g_ptr_array_new();
+    tcg_region_tb_foreach(idx, tb_evict_collect, tbs);
+    for (i = 0; i < tbs->len; i++) {
+        tb_phys_invalidate(g_ptr_array_index(tbs, i), -1);
+    }
+    g_ptr_array_free(tbs, true);
+
+    ev = g_new(struct tb_evict, 1);
+    ev->idx = idx;
+    ev->pending = 1;
+    CPU_FOREACH(c) {
+        atomic_inc(&ev->pending);
+        async_run_on_cpu(c, tb_evict_jmp_cache, RUN_ON_CPU_HOST_PTR(ev));
+    }
+    tb_evict_put(ev);
+}
+
+static void tb_init_jumps(TranslationBlock *tb)
+{
+    /* init jump list */
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+    tb->jmp_pred_set = false;
+
+    /* init original jump addresses which have been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+}
+
+#ifdef CONFIG_USER_ONLY
+/*
+ * Link a TB handed back by the persistent translation cache.  Its host
+ * code is already in place; only the state that tb_gen_code() would have
+ * set up after generating it needs to be redone.
+ */
+static TranslationBlock *tb_adopt(CPUArchState *env, TranslationBlock *tb,
+                                  tb_page_addr_t phys_pc)
+{
+    TranslationBlock *existing_tb;
+    tb_page_addr_t phys_page2;
+    target_ulong virt_page2;
+
+    tb->exec_count = TB_HOT_THRESHOLD;
+    tb_init_jumps(tb);
+
+    virt_page2 = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+    phys_page2 = -1;
+    if ((tb->pc & TARGET_PAGE_MASK) != virt_page2) {
+        phys_page2 = get_page_addr_code(env, virt_page2);
+    }
+    existing_tb = tb_link_page(tb, phys_pc, phys_page2);
+    if (unlikely(existing_tb != tb)) {
+        return existing_tb;
+    }
+    tcg_tb_insert(tb);
+    return tb;
+}
+#endif
+
 /* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *do_tb_gen_code(CPUState *cpu,
+                                        target_ulong pc, target_ulong cs_base,
+                                        uint32_t flags, int cflags)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -1684,6 +1836,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 #endif
     assert_memory_lock();
 
+    if (unlikely(tcg_region_evict_wanted())) {
+        tb_evict_cold_region(cpu);
+    }
+
     phys_pc = get_page_addr_code(env, pc);
 
     if (phys_pc == -1) {
@@ -1692,11 +1848,23 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cflags |= CF_NOCACHE | 1;
     }
 
+#ifdef CONFIG_USER_ONLY
+    if (tb_cache_enabled && !(cflags & CF_NOCACHE)) {
+        tb = tb_cache_lookup(cpu, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb_adopt(env, tb, phys_pc);
+        }
+    }
+#endif
+
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
         /* flush must be done */
         tb_flush(cpu);
+#ifdef CONFIG_USER_ONLY
+        qemu_mutex_unlock(&tb_gen_lock);
+#endif
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1710,6 +1878,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = TB_HOT_THRESHOLD;
     tcg_ctx->tb_cflags = cflags;
 
 #ifdef CONFIG_PROFILER
@@ -1802,21 +1971,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
 
-    /* init jump list */
-    qemu_spin_init(&tb->jmp_lock);
-    tb->jmp_list_head = (uintptr_t)NULL;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-    tb->jmp_dest[0] = (uintptr_t)NULL;
-    tb->jmp_dest[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses which have been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
-    }
+    tb_init_jumps(tb);
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1838,7 +1993,52 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         return existing_tb;
     }
     tcg_tb_insert(tb);
+#ifdef CONFIG_USER_ONLY
+    /* Code referring to the heap is only valid in this process */
+    if (tb_cache_enabled && !(cflags & CF_NOCACHE) &&
+        !tcg_ctx->tb_unanchored_ptrs) {
+        tb_cache_note(tb);
+    }
+#endif
+    return tb;
+}
+
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+#ifdef CONFIG_USER_ONLY
+    TranslationBlock *tb;
+
+    qemu_mutex_lock(&tb_gen_lock);
+    tb = do_tb_gen_code(cpu, pc, cs_base, flags, cflags);
+    qemu_mutex_unlock(&tb_gen_lock);
     return tb;
+#else
+    return do_tb_gen_code(cpu, pc, cs_base, flags, cflags);
+#endif
+}
+
+/*
+ * Replace @tb, whose execution counter just expired, with a superblock
+ * translated from the same state.  The old TB is invalidated first so
+ * that the lookup tables cannot hand it out again.
+ */
+void tb_gen_superblock(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = (tb_cflags(tb) & CF_HASH_MASK) | CF_SUPERBLOCK;
+
+    mmap_lock();
+    /* Another vCPU may have got here first, or the code was modified */
+    if (tb_cflags(tb) & CF_INVALID) {
+        mmap_unlock();
+        return;
+    }
+    tb_phys_invalidate(tb, -1);
+    tb = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+    mmap_unlock();
+
+    tb_jmp_cache_insert(cpu, tb);
 }
 
 /*
@@ -2045,8 +2245,8 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
 static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
 {
     TranslationBlock *tb;
+    uintptr_t first;
     PageDesc *p;
-    int n;
 #ifdef TARGET_HAS_PRECISE_SMC
     TranslationBlock *current_tb = NULL;
     CPUState *cpu = current_cpu;
@@ -2073,8 +2273,28 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
         env = cpu->env_ptr;
     }
 #endif
-    assert_page_locked(p);
-    PAGE_FOR_EACH_TB(p, tb, n) {
+    /*
+     * We are called from the SEGV handler, so page_collection_lock(),
+     * which allocates, cannot be used.  Instead take the TBs off the
+     * page one at a time, each with the lock of both of its pages: a TB
+     * spanning two pages is also linked from a page we may not own.  TBs
+     * are only freed by tb_flush(), which cannot run while this vCPU
+     * does, so @tb stays valid after @p is unlocked.
+     */
+    for (;;) {
+        page_lock(p);
+        first = p->first_tb;
+        page_unlock(p);
+        tb = (TranslationBlock *)(first & ~1);
+        if (!tb) {
+            break;
+        }
+        page_lock_tb(tb);
+        if (p->first_tb != first) {
+            /* Someone else changed the list, look again */
+            page_unlock_tb(tb);
+            continue;
+        }
 #ifdef TARGET_HAS_PRECISE_SMC
         if (current_tb == tb &&
             (tb_cflags(current_tb) & CF_COUNT_MASK) != 1) {
@@ -2090,9 +2310,9 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
                                  &current_flags);
         }
 #endif /* TARGET_HAS_PRECISE_SMC */
-        tb_phys_invalidate(tb, addr);
+        tb_phys_invalidate__locked(tb);
+        page_unlock_tb(tb);
     }
-    p->first_tb = (uintptr_t)NULL;
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
         /* Force execution of one insn next time.  */
@@ -2200,9 +2420,10 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
-    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    size_t i0 = (size_t)tb_jmp_cache_hash_page(page_addr) * TB_JMP_CACHE_WAYS;
+    size_t i, n = (size_t)TB_JMP_CACHE_WAYS << tb_jmp_cache_page_bits();
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    for (i = 0; i < n; i++) {
         atomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
     }
 }
@@ -2291,6 +2512,8 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t jc_hits = 0, jc_misses = 0;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2327,6 +2550,17 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 atomic_read(&tb_ctx.tb_flush_count));
     cpu_fprintf(f, "TB invalidate count %zu\n", tcg_tb_phys_invalidate_count());
 
+    CPU_FOREACH(cpu) {
+        jc_hits += atomic_read(&cpu->tb_jmp_cache_hits);
+        jc_misses += atomic_read(&cpu->tb_jmp_cache_misses);
+    }
+    cpu_fprintf(f, "TB jump cache       %zu entries (%u-way)\n",
+                tb_jmp_cache_size(), TB_JMP_CACHE_WAYS);
+    cpu_fprintf(f, "TB jump cache hits  %zu (%zu%%)\n", jc_hits,
+                jc_hits + jc_misses ? jc_hits * 100 / (jc_hits + jc_misses)
+                                    : 0);
+    cpu_fprintf(f, "TB jump cache miss  %zu\n", jc_misses);
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     cpu_fprintf(f, "TLB full flushes    %zu\n", flush_full);
     cpu_fprintf(f, "TLB partial flushes %zu\n", flush_part);
@@ -2581,7 +2815,7 @@ int page_unprotect(target_ulong address, uintptr_t pc)
     /* Technically this isn't safe inside a signal handler.  However we
        know this only ever happens in a synchronous SEGV handler, so in
        practice it seems to be ok.  */
-    mmap_lock();
+    mmap_lock_range(address & TARGET_PAGE_MASK, TARGET_PAGE_SIZE);
 
     p = page_find(address >> TARGET_PAGE_BITS);
     if (!p) {
@@ -17,6 +17,7 @@
 #include "exec/gen-icount.h"
 #include "exec/log.h"
 #include "exec/translator.h"
+#include "exec/plugin-gen.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -31,9 +32,77 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+/*
+ * Count executions of a TB that may be worth retranslating as a
+ * superblock, leaving through TB_EXIT_HOT when the counter expires.
+ * Nothing of the TB has executed at that point, as with exitreq.
+ *
+ * The counter is updated without atomics, so with MTTCG concurrent
+ * executions may lose decrements and the TB becomes hot a bit later,
+ * or two vCPUs may both see it expire; tb_gen_superblock() copes.
+ */
+static TCGLabel *gen_tb_exec_count(TranslationBlock *tb)
+{
+    TCGLabel *hot_label = gen_new_label();
+    TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+    TCGv_i32 count = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_EQ, count, 0, hot_label);
+
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+    return hot_label;
+}
+
+/*
+ * Most jumps followed in one superblock.  Loop back-edges unroll the
+ * loop, so this bounds the unrolling as well as the number of side exits.
+ */
+#define SUPERBLOCK_MAX_GOTOS 8
+
+/*
+ * Ask whether translation of a superblock may continue at @dest in place
+ * of a direct jump from the insn ending at @insn_end.  If so, the target
+ * emits no exit and carries on decoding at @dest.
+ *
+ * Only jumps within the first page and not below pc_first are followed,
+ * so that [pc_first, pc_max) still covers every insn in the TB and code
+ * invalidation keeps working on the TB's address range.
+ */
+bool translator_superblock_goto(DisasContextBase *db,
+                                target_ulong insn_end, target_ulong dest)
+{
+    if (db->singlestep_enabled || singlestep) {
+        return false;
+    }
+    if (dest < db->pc_first ||
+        (dest & TARGET_PAGE_MASK) != (db->pc_first & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    if (!(tb_cflags(db->tb) & CF_SUPERBLOCK)) {
+        /* The jump ends the TB; a superblock could go on from here */
+        db->superblock_exit = true;
+        return false;
+    }
+    if (db->num_insns >= db->max_insns || tcg_op_buf_full() ||
+        db->superblock_gotos >= SUPERBLOCK_MAX_GOTOS) {
+        return false;
+    }
+    db->superblock_gotos++;
+    db->pc_max = MAX(db->pc_max, insn_end);
+    /* pc_next is about to jump; the insn ends here.  */
+    plugin_gen_insn_end(insn_end);
+    return true;
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb)
 {
+    TCGLabel *hot_label = NULL;
+    TCGOp *count_prev = NULL, *count_last = NULL;
     int bp_insn = 0;
 
     /* Initialize DisasContext */
@@ -43,6 +112,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->is_jmp = DISAS_NEXT;
     db->num_insns = 0;
     db->singlestep_enabled = cpu->singlestep_enabled;
+    db->superblock_exit = false;
+    db->superblock_gotos = 0;
+    db->pc_max = db->pc_first;
 
     /* Instruction counting */
     db->max_insns = tb_cflags(db->tb) & CF_COUNT_MASK;
@@ -64,13 +136,22 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     /* Start translating.  */
     gen_tb_start(db->tb);
+    if (ops->superblocks && !db->singlestep_enabled && !singlestep &&
+        !(tb_cflags(db->tb) & (CF_SUPERBLOCK | CF_NOCACHE |
+                               CF_USE_ICOUNT | CF_LAST_IO))) {
+        count_prev = tcg_last_op();
+        hot_label = gen_tb_exec_count(db->tb);
+        count_last = tcg_last_op();
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+    plugin_gen_tb_start(db->tb);
 
     while (true) {
         db->num_insns++;
         ops->insn_start(db, cpu);
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+        plugin_gen_insn_start(db->pc_next);
 
         /* Pass breakpoint hits to target for further processing */
         if (!db->singlestep_enabled
@@ -106,6 +187,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
         } else {
             ops->translate_insn(db, cpu);
         }
+        plugin_gen_insn_end(db->pc_next);
 
         /* Stop translation if translate_insn so indicated.  */
         if (db->is_jmp != DISAS_NEXT) {
@@ -123,11 +205,31 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
     gen_tb_end(db->tb, db->num_insns - bp_insn);
+    if (hot_label && db->superblock_exit) {
+        gen_set_label(hot_label);
+        tcg_gen_exit_tb(db->tb, TB_EXIT_HOT);
+    } else if (hot_label) {
+        /* Nothing to follow; drop the counter emitted at the start */
+        TCGOp *op, *next;
+
+        op = count_prev ? QTAILQ_NEXT(count_prev, link)
+                        : QTAILQ_FIRST(&tcg_ctx->ops);
+        for (; ; op = next) {
+            next = QTAILQ_NEXT(op, link);
+            tcg_op_remove(tcg_ctx, op);
+            if (op == count_last) {
+                break;
+            }
+        }
+    }
 
     /* The disas_log hook may use these values rather than recompute.  */
-    db->tb->size = db->pc_next - db->pc_first;
+    db->tb->size = MAX(db->pc_max, db->pc_next) - db->pc_first;
     db->tb->icount = db->num_insns;
 
+    /* Let plugins instrument the TB now that all of it is known.  */
+    plugin_gen_tb_end(cpu);
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
         && qemu_log_in_addr_range(db->pc_first)) {
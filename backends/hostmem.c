@@ -204,6 +204,20 @@ static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
     return backend->prealloc || backend->force_prealloc;
 }
 
+static void host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         void *ptr, uint64_t sz, Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+
+    /* Touch the pages from the host nodes the policy places them on */
+    if (backend->policy != HOST_MEM_POLICY_DEFAULT) {
+        os_mem_prealloc(fd, ptr, sz, backend->host_nodes, MAX_NODES,
+                        backend->policy == HOST_MEM_POLICY_INTERLEAVE, errp);
+    } else {
+        os_mem_prealloc(fd, ptr, sz, NULL, 0, false, errp);
+    }
+}
+
 static void host_memory_backend_set_prealloc(Object *obj, bool value,
                                              Error **errp)
 {
@@ -224,11 +238,10 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz, smp_cpus, &local_err);
+        host_memory_backend_prealloc(backend, ptr, sz, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -356,8 +369,7 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            smp_cpus, &local_err);
+            host_memory_backend_prealloc(backend, ptr, sz, &local_err);
             if (local_err) {
                 goto out;
             }
@@ -35,6 +35,12 @@ void mmap_lock(void)
     }
 }
 
+/* Ranges are not tracked, the whole address space is locked */
+void mmap_lock_range(target_ulong start, target_ulong len)
+{
+    mmap_lock();
+}
+
 void mmap_unlock(void)
 {
     if (--mmap_lock_count == 0) {
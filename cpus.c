@@ -203,6 +203,17 @@ static bool default_mttcg_enabled(void)
 void qemu_tcg_configure(QemuOpts *opts, Error **errp)
 {
     const char *t = qemu_opt_get(opts, "thread");
+    uint64_t bits;
+
+    bits = qemu_opt_get_number(opts, "jmp-cache-bits", TB_JMP_CACHE_BITS);
+    if (bits < TB_JMP_CACHE_BITS_MIN || bits > TB_JMP_CACHE_BITS_MAX) {
+        error_setg(errp, "Invalid 'jmp-cache-bits' setting %" PRIu64
+                   ", must be between %d and %d", bits,
+                   TB_JMP_CACHE_BITS_MIN, TB_JMP_CACHE_BITS_MAX);
+        return;
+    }
+    tb_jmp_cache_bits = bits;
+
     if (t) {
         if (strcmp(t, "multi") == 0) {
             if (TCG_OVERSIZED_GUEST) {
@@ -60,6 +60,7 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "exec/cputlb.h"
 #include "exec/log.h"
 
 #include "migration/vmstate.h"
@@ -1868,7 +1869,7 @@ static void *file_ram_alloc(RAMBlock *block,
     }
 
     if (mem_prealloc) {
-        os_mem_prealloc(fd, area, memory, smp_cpus, errp);
+        os_mem_prealloc(fd, area, memory, NULL, 0, false, errp);
         if (errp && *errp) {
             qemu_ram_munmap(area, memory);
             return NULL;
@@ -2678,6 +2679,10 @@ void memory_notdirty_write_complete(NotDirtyInfo *ndi)
     /* we remove the notdirty callback only if the code has been
        flushed */
     if (!cpu_physical_memory_is_clean(ndi->ram_addr)) {
+        /* While migrating, pages mapped writable must stay in the log */
+        if (global_dirty_log) {
+            tlb_dirty_log_add(ndi->cpu, ndi->ram_addr);
+        }
         tlb_set_dirty(ndi->cpu, ndi->mem_vaddr);
     }
 }
@@ -3376,6 +3381,79 @@ MemTxResult address_space_rw(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
     }
 }
 
+/* Called from RCU critical section.  */
+static MemoryRegionSection *address_space_mmio_cache_lookup(
+    FlatView *fv, AddressSpaceMMIOCache *cache, hwaddr addr)
+{
+    MemoryRegionSection *section;
+    int i;
+
+    for (i = 0; i < ADDRESS_SPACE_MMIO_CACHE_SIZE; i++) {
+        section = cache->entry[i].section;
+        if (cache->entry[i].gen == fv->gen &&
+            section_covers_addr(section, addr)) {
+            return section;
+        }
+    }
+
+    section = address_space_lookup_region(flatview_to_dispatch(fv), addr,
+                                          true);
+    if (memory_region_get_iommu(section->mr)) {
+        return NULL;
+    }
+    i = cache->next++ % ADDRESS_SPACE_MMIO_CACHE_SIZE;
+    cache->entry[i].gen = fv->gen;
+    cache->entry[i].section = section;
+    return section;
+}
+
+MemTxResult address_space_rw_mmio(AddressSpace *as,
+                                  AddressSpaceMMIOCache *cache, hwaddr addr,
+                                  MemTxAttrs attrs, uint8_t *buf,
+                                  int len, bool is_write)
+{
+    MemoryRegionSection *section;
+    MemTxResult result = MEMTX_OK;
+    hwaddr addr1, l;
+    FlatView *fv;
+
+    if (len <= 0) {
+        return result;
+    }
+
+    rcu_read_lock();
+    fv = address_space_to_flatview(as);
+    section = address_space_mmio_cache_lookup(fv, cache, addr);
+    if (!section || memory_access_is_direct(section->mr, is_write)) {
+        /* Let the usual path clamp RAM accesses */
+        if (is_write) {
+            result = flatview_write(fv, addr, attrs, buf, len);
+        } else {
+            result = flatview_read(fv, addr, attrs, buf, len);
+        }
+    } else {
+        /*
+         * Same as address_space_translate_internal for MMIO; the continue
+         * functions translate whatever lies past the end of the section.
+         */
+        addr1 = addr - section->offset_within_address_space;
+        l = int128_get64(int128_min(int128_sub(section->size,
+                                               int128_make64(addr1)),
+                                    int128_make64(len)));
+        addr1 += section->offset_within_region;
+        if (is_write) {
+            result = flatview_write_continue(fv, addr, attrs, buf, len,
+                                             addr1, l, section->mr);
+        } else {
+            result = flatview_read_continue(fv, addr, attrs, buf, len,
+                                            addr1, l, section->mr);
+        }
+    }
+    rcu_read_unlock();
+
+    return result;
+}
+
 void cpu_physical_memory_rw(hwaddr addr, uint8_t *buf,
                             int len, int is_write)
 {
@@ -1304,6 +1304,213 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, NULL, f64_mul_fast_test, f64_mul_fast_op);
 }
 
+/*
+ * Vector entry points for element-wise add, sub and mul.
+ *
+ * The hardfloat preconditions on the float_status are checked once for
+ * the whole vector, and 16 bytes of elements are then computed at a time
+ * with host SIMD.  Lanes whose inputs are not zero or normal, or whose
+ * result may have overflowed or underflowed, are recomputed with the
+ * scalar function, which also takes care of raising the flags.
+ */
+
+enum {
+    VEC_OP_ADD,
+    VEC_OP_SUB,
+    VEC_OP_MUL,
+};
+
+#ifdef CONFIG_VECTOR16
+typedef float hvec_f32 __attribute__((vector_size(16)));
+typedef double hvec_f64 __attribute__((vector_size(16)));
+typedef uint32_t hvec_u32 __attribute__((vector_size(16)));
+typedef uint64_t hvec_u64 __attribute__((vector_size(16)));
+typedef int32_t hvec_s32 __attribute__((vector_size(16)));
+typedef int64_t hvec_s64 __attribute__((vector_size(16)));
+
+#define F32_VEC_LANES (16 / sizeof(float32))
+#define F64_VEC_LANES (16 / sizeof(float64))
+
+static inline void
+float32_vec_gen2(float32 *d, const float32 *a, const float32 *b, size_t n,
+                 float_status *s, int op, soft_f32_op2_fn scalar)
+{
+    const hvec_u32 abs_mask = { 0x7fffffff, 0x7fffffff,
+                                0x7fffffff, 0x7fffffff };
+    const hvec_u32 exp_mask = { 0x7f800000, 0x7f800000,
+                                0x7f800000, 0x7f800000 };
+    const hvec_u32 zero = { 0, 0, 0, 0 };
+    const hvec_u32 tiny = { 0x00800000, 0x00800000,
+                            0x00800000, 0x00800000 };
+    size_t i = 0, j;
+
+    if (likely(can_use_fpu(s))) {
+        for (; i + F32_VEC_LANES <= n; i += F32_VEC_LANES) {
+            hvec_u32 ua, ub, ur, ea, eb, ar;
+            hvec_s32 bad, za, zb;
+            hvec_f32 fr;
+
+            memcpy(&ua, a + i, sizeof(ua));
+            memcpy(&ub, b + i, sizeof(ub));
+            switch (op) {
+            case VEC_OP_ADD:
+                fr = (hvec_f32)ua + (hvec_f32)ub;
+                break;
+            case VEC_OP_SUB:
+                fr = (hvec_f32)ua - (hvec_f32)ub;
+                break;
+            default:
+                fr = (hvec_f32)ua * (hvec_f32)ub;
+                break;
+            }
+            ur = (hvec_u32)fr;
+
+            /* Inputs must be zero or normal */
+            ea = ua & exp_mask;
+            eb = ub & exp_mask;
+            za = (ua & abs_mask) == zero;
+            zb = (ub & abs_mask) == zero;
+            bad = (ea == exp_mask) | ((ea == zero) & ~za)
+                | (eb == exp_mask) | ((eb == zero) & ~zb);
+
+            /* Overflow, or possible underflow unless exact */
+            ar = ur & abs_mask;
+            bad |= ar >= exp_mask;
+            if (op == VEC_OP_MUL) {
+                bad |= (ar <= tiny) & ~(za | zb);
+            } else {
+                bad |= (ar <= tiny) & ~(za & zb);
+            }
+
+            for (j = 0; j < F32_VEC_LANES; j++) {
+                d[i + j] = unlikely(bad[j]) ? scalar(a[i + j], b[i + j], s)
+                                            : make_float32(ur[j]);
+            }
+        }
+    }
+    for (; i < n; i++) {
+        d[i] = scalar(a[i], b[i], s);
+    }
+}
+
+static inline void
+float64_vec_gen2(float64 *d, const float64 *a, const float64 *b, size_t n,
+                 float_status *s, int op, soft_f64_op2_fn scalar)
+{
+    const hvec_u64 abs_mask = { INT64_MAX, INT64_MAX };
+    const hvec_u64 exp_mask = { 0x7ff0000000000000ULL,
+                                0x7ff0000000000000ULL };
+    const hvec_u64 zero = { 0, 0 };
+    const hvec_u64 tiny = { 0x0010000000000000ULL, 0x0010000000000000ULL };
+    size_t i = 0, j;
+
+    if (likely(can_use_fpu(s))) {
+        for (; i + F64_VEC_LANES <= n; i += F64_VEC_LANES) {
+            hvec_u64 ua, ub, ur, ea, eb, ar;
+            hvec_s64 bad, za, zb;
+            hvec_f64 fr;
+
+            memcpy(&ua, a + i, sizeof(ua));
+            memcpy(&ub, b + i, sizeof(ub));
+            switch (op) {
+            case VEC_OP_ADD:
+                fr = (hvec_f64)ua + (hvec_f64)ub;
+                break;
+            case VEC_OP_SUB:
+                fr = (hvec_f64)ua - (hvec_f64)ub;
+                break;
+            default:
+                fr = (hvec_f64)ua * (hvec_f64)ub;
+                break;
+            }
+            ur = (hvec_u64)fr;
+
+            ea = ua & exp_mask;
+            eb = ub & exp_mask;
+            za = (ua & abs_mask) == zero;
+            zb = (ub & abs_mask) == zero;
+            bad = (ea == exp_mask) | ((ea == zero) & ~za)
+                | (eb == exp_mask) | ((eb == zero) & ~zb);
+
+            ar = ur & abs_mask;
+            bad |= ar >= exp_mask;
+            if (op == VEC_OP_MUL) {
+                bad |= (ar <= tiny) & ~(za | zb);
+            } else {
+                bad |= (ar <= tiny) & ~(za & zb);
+            }
+
+            for (j = 0; j < F64_VEC_LANES; j++) {
+                d[i + j] = unlikely(bad[j]) ? scalar(a[i + j], b[i + j], s)
+                                            : make_float64(ur[j]);
+            }
+        }
+    }
+    for (; i < n; i++) {
+        d[i] = scalar(a[i], b[i], s);
+    }
+}
+#else
+/* Without vector support, only the status checks are hoisted.  */
+static inline void
+float32_vec_gen2(float32 *d, const float32 *a, const float32 *b, size_t n,
+                 float_status *s, int op, soft_f32_op2_fn scalar)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        d[i] = scalar(a[i], b[i], s);
+    }
+}
+
+static inline void
+float64_vec_gen2(float64 *d, const float64 *a, const float64 *b, size_t n,
+                 float_status *s, int op, soft_f64_op2_fn scalar)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        d[i] = scalar(a[i], b[i], s);
+    }
+}
+#endif
+
+void float32_vec_add(float32 *d, const float32 *a, const float32 *b,
+                     size_t n, float_status *s)
+{
+    float32_vec_gen2(d, a, b, n, s, VEC_OP_ADD, float32_add);
+}
+
+void float32_vec_sub(float32 *d, const float32 *a, const float32 *b,
+                     size_t n, float_status *s)
+{
+    float32_vec_gen2(d, a, b, n, s, VEC_OP_SUB, float32_sub);
+}
+
+void float32_vec_mul(float32 *d, const float32 *a, const float32 *b,
+                     size_t n, float_status *s)
+{
+    float32_vec_gen2(d, a, b, n, s, VEC_OP_MUL, float32_mul);
+}
+
+void float64_vec_add(float64 *d, const float64 *a, const float64 *b,
+                     size_t n, float_status *s)
+{
+    float64_vec_gen2(d, a, b, n, s, VEC_OP_ADD, float64_add);
+}
+
+void float64_vec_sub(float64 *d, const float64 *a, const float64 *b,
+                     size_t n, float_status *s)
+{
+    float64_vec_gen2(d, a, b, n, s, VEC_OP_SUB, float64_sub);
+}
+
+void float64_vec_mul(float64 *d, const float64 *a, const float64 *b,
+                     size_t n, float_status *s)
+{
+    float64_vec_gen2(d, a, b, n, s, VEC_OP_MUL, float64_mul);
+}
+
 /*
  * Returns the result of multiplying the floating-point values `a' and
  * `b' then adding 'c', with no intermediate rounding step after the
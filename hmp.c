@@ -396,6 +396,9 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MAX_POSTCOPY_BANDWIDTH),
             params->max_postcopy_bandwidth);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_LOAD_THREADS),
+            params->x_load_threads);
     }
 
     qapi_free_MigrationParameters(params);
@@ -1755,6 +1758,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_max_postcopy_bandwidth = true;
         visit_type_size(v, param, &p->max_postcopy_bandwidth, &err);
         break;
+    case MIGRATION_PARAMETER_X_LOAD_THREADS:
+        p->has_x_load_threads = true;
+        visit_type_int(v, param, &p->x_load_threads, &err);
+        break;
     default:
         assert(0);
     }
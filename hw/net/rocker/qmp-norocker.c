@@ -50,3 +50,12 @@ RockerOfDpaGroupList *qmp_query_rocker_of_dpa_groups(const char *name,
     error_setg(errp, QERR_FEATURE_DISABLED, "rocker");
     return NULL;
 };
+
+RockerOfDpaFlowCacheList *qmp_query_rocker_of_dpa_flow_cache(const char *name,
+                                                             bool has_tbl_id,
+                                                             uint32_t tbl_id,
+                                                             Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "rocker");
+    return NULL;
+};
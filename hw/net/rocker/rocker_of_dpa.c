@@ -32,12 +32,23 @@
 static const MACAddr zero_mac = { .a = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } };
 static const MACAddr ff_mac =   { .a = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
 
+/* Exact-match cache of flow lookup results, one per flow table */
+typedef struct of_dpa_flow_cache {
+    GHashTable *entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t flushes;
+} OfDpaFlowCache;
+
+#define OF_DPA_FLOW_CACHE_MAX_SIZE 4096
+
 typedef struct of_dpa {
     World *world;
     GHashTable *flow_tbl;
     GHashTable *group_tbl;
     unsigned int flow_tbl_max_size;
     unsigned int group_tbl_max_size;
+    OfDpaFlowCache flow_cache[ROCKER_OF_DPA_TABLE_ID_ACL_POLICY + 1];
 } OfDpa;
 
 /* flow_key stolen mostly from OVS
@@ -169,6 +180,11 @@ typedef struct of_dpa_flow_match {
     OfDpaFlow *best;
 } OfDpaFlowMatch;
 
+typedef struct of_dpa_flow_cache_entry {
+    OfDpaFlowKey value;
+    OfDpaFlow *flow;                 /* NULL if the lookup missed */
+} OfDpaFlowCacheEntry;
+
 typedef struct of_dpa_group {
     uint32_t id;
     union {
@@ -336,13 +352,91 @@ static void _of_dpa_flow_match(void *key, void *value, void *user_data)
     }
 }
 
+/* Cache keys cover the match value up to its width, table ID included */
+static guint of_dpa_flow_cache_hash(gconstpointer v)
+{
+    const OfDpaFlowKey *value = v;
+    const uint64_t *k = (const uint64_t *)value;
+    uint64_t hash = value->width;
+    int i;
+
+    for (i = 0; i < value->width; i++) {
+        hash = (hash ^ k[i]) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+
+    return (guint)hash;
+}
+
+static gboolean of_dpa_flow_cache_equal(gconstpointer v1, gconstpointer v2)
+{
+    const OfDpaFlowKey *value1 = v1;
+    const OfDpaFlowKey *value2 = v2;
+
+    return value1->width == value2->width &&
+           !memcmp(value1, value2, value1->width * sizeof(uint64_t));
+}
+
+static void of_dpa_flow_cache_flush(OfDpa *of_dpa, uint32_t tbl_id)
+{
+    OfDpaFlowCache *cache;
+
+    if (tbl_id >= ARRAY_SIZE(of_dpa->flow_cache)) {
+        return;
+    }
+
+    cache = &of_dpa->flow_cache[tbl_id];
+    if (cache->entries && g_hash_table_size(cache->entries)) {
+        g_hash_table_remove_all(cache->entries);
+        cache->flushes++;
+    }
+}
+
 static OfDpaFlow *of_dpa_flow_match(OfDpa *of_dpa, OfDpaFlowMatch *match)
 {
+    uint32_t tbl_id = match->value.tbl_id;
+    OfDpaFlowCache *cache;
+    OfDpaFlowCacheEntry *entry;
+
+    /*
+     * Flow table contents only change through flow add/mod/del, which
+     * flush the affected table's cache, so a cached result for the same
+     * packet key stays valid until then.
+     */
+    if (tbl_id >= ARRAY_SIZE(of_dpa->flow_cache) ||
+        match->value.width > sizeof(OfDpaFlowKey) / sizeof(uint64_t)) {
+        cache = NULL;
+    } else {
+        cache = &of_dpa->flow_cache[tbl_id];
+        if (!cache->entries) {
+            cache->entries = g_hash_table_new_full(of_dpa_flow_cache_hash,
+                                                   of_dpa_flow_cache_equal,
+                                                   NULL, g_free);
+        }
+        entry = g_hash_table_lookup(cache->entries, &match->value);
+        if (entry) {
+            cache->hits++;
+            match->best = entry->flow;
+            return match->best;
+        }
+        cache->misses++;
+    }
+
     DPRINTF("\nnew search\n");
     of_dpa_flow_key_dump(&match->value, NULL);
 
     g_hash_table_foreach(of_dpa->flow_tbl, _of_dpa_flow_match, match);
 
+    if (cache) {
+        if (g_hash_table_size(cache->entries) >= OF_DPA_FLOW_CACHE_MAX_SIZE) {
+            of_dpa_flow_cache_flush(of_dpa, tbl_id);
+        }
+        entry = g_new0(OfDpaFlowCacheEntry, 1);
+        entry->value = match->value;
+        entry->flow = match->best;
+        g_hash_table_insert(cache->entries, &entry->value, entry);
+    }
+
     return match->best;
 }
 
@@ -354,12 +448,14 @@ static OfDpaFlow *of_dpa_flow_find(OfDpa *of_dpa, uint64_t cookie)
 static int of_dpa_flow_add(OfDpa *of_dpa, OfDpaFlow *flow)
 {
     g_hash_table_insert(of_dpa->flow_tbl, &flow->cookie, flow);
+    of_dpa_flow_cache_flush(of_dpa, flow->key.tbl_id);
 
     return ROCKER_OK;
 }
 
 static void of_dpa_flow_del(OfDpa *of_dpa, OfDpaFlow *flow)
 {
+    of_dpa_flow_cache_flush(of_dpa, flow->key.tbl_id);
     g_hash_table_remove(of_dpa->flow_tbl, &flow->cookie);
 }
 
@@ -1875,12 +1971,18 @@ static int of_dpa_cmd_flow_mod(OfDpa *of_dpa, uint64_t cookie,
                                RockerTlv **flow_tlvs)
 {
     OfDpaFlow *flow = of_dpa_flow_find(of_dpa, cookie);
+    int err;
 
     if (!flow) {
         return -ROCKER_ENOENT;
     }
 
-    return of_dpa_cmd_flow_add_mod(of_dpa, flow, flow_tlvs);
+    /* the flow may move between tables, flush both */
+    of_dpa_flow_cache_flush(of_dpa, flow->key.tbl_id);
+    err = of_dpa_cmd_flow_add_mod(of_dpa, flow, flow_tlvs);
+    of_dpa_flow_cache_flush(of_dpa, flow->key.tbl_id);
+
+    return err;
 }
 
 static int of_dpa_cmd_flow_del(OfDpa *of_dpa, uint64_t cookie)
@@ -2280,7 +2382,13 @@ err_group_tbl:
 static void of_dpa_uninit(World *world)
 {
     OfDpa *of_dpa = world_private(world);
+    int i;
 
+    for (i = 0; i < ARRAY_SIZE(of_dpa->flow_cache); i++) {
+        if (of_dpa->flow_cache[i].entries) {
+            g_hash_table_destroy(of_dpa->flow_cache[i].entries);
+        }
+    }
     g_hash_table_destroy(of_dpa->group_tbl);
     g_hash_table_destroy(of_dpa->flow_tbl);
 }
@@ -2593,6 +2701,57 @@ RockerOfDpaGroupList *qmp_query_rocker_of_dpa_groups(const char *name,
     return fill_context.list;
 }
 
+RockerOfDpaFlowCacheList *qmp_query_rocker_of_dpa_flow_cache(const char *name,
+                                                             bool has_tbl_id,
+                                                             uint32_t tbl_id,
+                                                             Error **errp)
+{
+    struct rocker *r;
+    struct world *w;
+    struct of_dpa *of_dpa;
+    RockerOfDpaFlowCacheList *list = NULL, *new;
+    RockerOfDpaFlowCache *ncache;
+    OfDpaFlowCache *cache;
+    int i;
+
+    r = rocker_find(name);
+    if (!r) {
+        error_setg(errp, "rocker %s not found", name);
+        return NULL;
+    }
+
+    w = rocker_get_world(r, ROCKER_WORLD_TYPE_OF_DPA);
+    if (!w) {
+        error_setg(errp, "rocker %s doesn't have OF-DPA world", name);
+        return NULL;
+    }
+
+    of_dpa = world_private(w);
+
+    for (i = ARRAY_SIZE(of_dpa->flow_cache) - 1; i >= 0; i--) {
+        if (!of_dpa_tbl_ops[i].build_match ||
+            (has_tbl_id && tbl_id != i)) {
+            continue;
+        }
+
+        cache = &of_dpa->flow_cache[i];
+        new = g_malloc0(sizeof(*new));
+        ncache = new->value = g_malloc0(sizeof(*ncache));
+
+        ncache->tbl_id = i;
+        ncache->entries = cache->entries ?
+                          g_hash_table_size(cache->entries) : 0;
+        ncache->hits = cache->hits;
+        ncache->misses = cache->misses;
+        ncache->flushes = cache->flushes;
+
+        new->next = list;
+        list = new;
+    }
+
+    return list;
+}
+
 static WorldOps of_dpa_ops = {
     .name = "ofdpa",
     .init = of_dpa_init,
@@ -16,6 +16,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/eth.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -424,6 +425,19 @@ static RxFilterInfo *virtio_net_query_rxfilter(NetClientState *nc)
     return info;
 }
 
+/* Discard partially coalesced receive frames */
+static void virtio_net_rsc_drop(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        if (n->vqs[i].rsc.timer) {
+            timer_del(n->vqs[i].rsc.timer);
+            n->vqs[i].rsc.size = 0;
+        }
+    }
+}
+
 static void virtio_net_reset(VirtIODevice *vdev)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -452,6 +466,8 @@ static void virtio_net_reset(VirtIODevice *vdev)
     qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     memset(n->vlans, 0, MAX_VLAN >> 3);
 
+    virtio_net_rsc_drop(n);
+
     /* Flush any async TX */
     for (i = 0;  i < n->max_queues; i++) {
         NetClientState *nc = qemu_get_subqueue(n->nic, i);
@@ -614,8 +630,11 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
 
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
+        /* Coalesced receive frames are built by QEMU itself */
+        if (!n->net_conf.rx_coalesce) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
+        }
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_ECN);
     }
@@ -701,10 +720,15 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
                                virtio_has_feature(features,
                                                   VIRTIO_F_VERSION_1));
 
-    if (n->has_vnet_hdr) {
+    if (n->has_vnet_hdr || n->net_conf.rx_coalesce) {
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
+    }
+    if (n->has_vnet_hdr) {
         virtio_net_apply_guest_offloads(n);
+    } else {
+        /* Frames coalesced so far may use offloads the guest just lost */
+        virtio_net_rsc_drop(n);
     }
 
     for (i = 0;  i < n->max_queues; i++) {
@@ -777,7 +801,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
 
         offloads = virtio_ldq_p(vdev, &offloads);
 
-        if (!n->has_vnet_hdr) {
+        if (!n->has_vnet_hdr && !n->net_conf.rx_coalesce) {
             return VIRTIO_NET_ERR;
         }
 
@@ -787,7 +811,11 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
         }
 
         n->curr_guest_offloads = offloads;
-        virtio_net_apply_guest_offloads(n);
+        if (n->has_vnet_hdr) {
+            virtio_net_apply_guest_offloads(n);
+        } else {
+            virtio_net_rsc_drop(n);
+        }
 
         return VIRTIO_NET_OK;
     } else {
@@ -1027,11 +1055,22 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 
 /* RX */
 
+/* Largest frame a coalesced IPv4 packet can grow to */
+#define VIRTIO_NET_RSC_MAX_FRAME (ETH_HLEN + 0xffff)
+
+static ssize_t virtio_net_rsc_flush(VirtIONetQueue *q);
+
 static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
 
+    if (n->vqs[queue_index].rsc.size) {
+        /* a coalesced frame may have been waiting for buffers */
+        rcu_read_lock();
+        virtio_net_rsc_flush(&n->vqs[queue_index]);
+        rcu_read_unlock();
+    }
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
 
@@ -1116,7 +1155,8 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
-                           const void *buf, size_t size)
+                           const void *buf, size_t size,
+                           const struct virtio_net_hdr *rsc_hdr)
 {
     if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
@@ -1128,6 +1168,8 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
             virtio_net_hdr_swap(VIRTIO_DEVICE(n), wbuf);
         }
         iov_from_buf(iov, iov_cnt, 0, buf, sizeof(struct virtio_net_hdr));
+    } else if (rsc_hdr) {
+        iov_from_buf(iov, iov_cnt, 0, rsc_hdr, sizeof(*rsc_hdr));
     } else {
         struct virtio_net_hdr hdr = {
             .flags = 0,
@@ -1189,7 +1231,8 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
 }
 
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size)
+                                      size_t size,
+                                      const struct virtio_net_hdr *rsc_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1252,7 +1295,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                     sizeof(mhdr.num_buffers));
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            receive_header(n, sg, elem->in_num, buf, size, rsc_hdr);
             offset = n->host_hdr_len;
             total += n->guest_hdr_len;
             guest_offset = n->guest_hdr_len;
@@ -1292,13 +1335,210 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     return size;
 }
 
+/*
+ * Receive segment coalescing
+ *
+ * Backends without a vnet header (socket, l2tpv3, user) hand us one TCP
+ * segment per packet.  When the guest accepts TSO4 frames, in-order data
+ * segments of the same flow are merged into a single GSO frame before
+ * they are placed in the receive ring.  Only one flow per queue is
+ * coalesced at a time; anything else flushes the pending frame first.
+ */
+
+static bool virtio_net_rsc_enabled(VirtIONet *n)
+{
+    const uint64_t offloads = (1ULL << VIRTIO_NET_F_GUEST_CSUM) |
+                              (1ULL << VIRTIO_NET_F_GUEST_TSO4);
+
+    return n->net_conf.rx_coalesce && !n->has_vnet_hdr &&
+        (n->curr_guest_offloads & offloads) == offloads;
+}
+
+/*
+ * Return the header length if @buf is an IPv4 TCP segment carrying data
+ * with valid checksums and no flags other than ACK and PSH, 0 otherwise.
+ */
+static size_t virtio_net_rsc_parse(const uint8_t *buf, size_t size)
+{
+    struct ip_header *ip = (struct ip_header *)(buf + ETH_HLEN);
+    tcp_header *tcp;
+    size_t tcp_hlen, ip_len;
+
+    if (size < ETH_HLEN + sizeof(struct ip_header) + sizeof(tcp_header) ||
+        lduw_be_p(&PKT_GET_ETH_HDR(buf)->h_proto) != ETH_P_IP ||
+        ip->ip_ver_len != 0x45 || ip->ip_p != IP_PROTO_TCP ||
+        IP4_IS_FRAGMENT(ip)) {
+        return 0;
+    }
+
+    ip_len = lduw_be_p(&ip->ip_len);
+    if (ip_len != size - ETH_HLEN) {
+        return 0;
+    }
+
+    tcp = (tcp_header *)(ip + 1);
+    tcp_hlen = TCP_HEADER_DATA_OFFSET(tcp);
+    if (tcp_hlen < sizeof(tcp_header) ||
+        ETH_HLEN + sizeof(struct ip_header) + tcp_hlen >= size ||
+        (TCP_HEADER_FLAGS(tcp) & ~TCP_FLAG_PSH) != TCP_FLAG_ACK ||
+        lduw_be_p(&tcp->th_urp)) {
+        return 0;
+    }
+
+    if (net_raw_checksum((uint8_t *)ip, sizeof(struct ip_header)) ||
+        net_checksum_tcpudp(ip_len - sizeof(struct ip_header), IP_PROTO_TCP,
+                            (uint8_t *)&ip->ip_src, (uint8_t *)tcp)) {
+        return 0;
+    }
+
+    return ETH_HLEN + sizeof(struct ip_header) + tcp_hlen;
+}
+
+/* Can the segment in @buf be appended to the frame pending on @q? */
+static bool virtio_net_rsc_match(VirtIONetQueue *q, const uint8_t *buf,
+                                 size_t size, size_t hdr_len)
+{
+    const size_t tcp_off = ETH_HLEN + sizeof(struct ip_header);
+    struct ip_header *ip = (struct ip_header *)(buf + ETH_HLEN);
+    struct ip_header *pip = (struct ip_header *)(q->rsc.buf + ETH_HLEN);
+    tcp_header *tcp = (tcp_header *)(buf + tcp_off);
+    tcp_header *ptcp = (tcp_header *)(q->rsc.buf + tcp_off);
+
+    return hdr_len == q->rsc.hdr_len &&
+        size - hdr_len <= q->rsc.mss &&
+        q->rsc.size + size - hdr_len <= VIRTIO_NET_RSC_MAX_FRAME &&
+        !memcmp(&ip->ip_src, &pip->ip_src, 2 * sizeof(ip->ip_src)) &&
+        !memcmp(&tcp->th_sport, &ptcp->th_sport, 2 * sizeof(tcp->th_sport)) &&
+        ldl_be_p(&tcp->th_seq) == q->rsc.next_seq &&
+        ldl_be_p(&tcp->th_ack) == ldl_be_p(&ptcp->th_ack) &&
+        !memcmp(tcp + 1, ptcp + 1, hdr_len - tcp_off - sizeof(tcp_header)) &&
+        !memcmp(buf, q->rsc.buf, ETH_HLEN);
+}
+
+/*
+ * Hand the pending frame to the guest.  Returns 0 if the guest has no
+ * room for it yet, in which case the frame stays pending.
+ */
+static ssize_t virtio_net_rsc_flush(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    struct ip_header *ip = (struct ip_header *)(q->rsc.buf + ETH_HLEN);
+    tcp_header *tcp = (tcp_header *)(ip + 1);
+    struct virtio_net_hdr hdr = { 0 };
+    uint16_t tcp_len;
+    uint32_t csum;
+    ssize_t ret;
+
+    if (!q->rsc.size) {
+        return 1;
+    }
+    timer_del(q->rsc.timer);
+
+    if (q->rsc.segs == 1) {
+        /* nothing was merged, the original frame is still intact */
+        ret = virtio_net_receive_rcu(nc, q->rsc.buf, q->rsc.size, NULL);
+    } else {
+        stw_be_p(&ip->ip_len, q->rsc.size - ETH_HLEN);
+        stw_be_p(&ip->ip_sum, 0);
+        stw_be_p(&ip->ip_sum,
+                 net_raw_checksum((uint8_t *)ip, sizeof(struct ip_header)));
+
+        /* leave the pseudo header sum for the guest, like a GRO frame */
+        tcp_len = q->rsc.size - ETH_HLEN - sizeof(struct ip_header);
+        csum = net_checksum_add(8, (uint8_t *)&ip->ip_src) +
+               IP_PROTO_TCP + tcp_len;
+        stw_be_p(&tcp->th_sum, ~net_checksum_finish(csum));
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        virtio_stw_p(vdev, &hdr.hdr_len, q->rsc.hdr_len);
+        virtio_stw_p(vdev, &hdr.gso_size, q->rsc.mss);
+        virtio_stw_p(vdev, &hdr.csum_start,
+                     ETH_HLEN + sizeof(struct ip_header));
+        virtio_stw_p(vdev, &hdr.csum_offset, offsetof(tcp_header, th_sum));
+        ret = virtio_net_receive_rcu(nc, q->rsc.buf, q->rsc.size, &hdr);
+    }
+
+    if (ret != 0) {
+        q->rsc.size = 0;
+    }
+    return ret;
+}
+
+static void virtio_net_rsc_timer(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    rcu_read_lock();
+    virtio_net_rsc_flush(q);
+    rcu_read_unlock();
+}
+
+static ssize_t virtio_net_rsc_receive(NetClientState *nc, const uint8_t *buf,
+                                      size_t size)
+{
+    const size_t tcp_off = ETH_HLEN + sizeof(struct ip_header);
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    tcp_header *tcp = (tcp_header *)(buf + tcp_off);
+    tcp_header *ptcp = (tcp_header *)(q->rsc.buf + tcp_off);
+    size_t hdr_len = virtio_net_rsc_parse(buf, size);
+    size_t payload = size - hdr_len;
+    bool push = hdr_len && (TCP_HEADER_FLAGS(tcp) & TCP_FLAG_PSH);
+
+    if (q->rsc.size) {
+        if (hdr_len && virtio_net_rsc_match(q, buf, size, hdr_len)) {
+            memcpy(q->rsc.buf + q->rsc.size, buf + hdr_len, payload);
+            q->rsc.size += payload;
+            q->rsc.next_seq += payload;
+            q->rsc.segs++;
+
+            /* the merged frame carries the latest window and PSH */
+            memcpy(&ptcp->th_win, &tcp->th_win, sizeof(ptcp->th_win));
+            if (push) {
+                stw_be_p(&ptcp->th_offset_flags,
+                         lduw_be_p(&ptcp->th_offset_flags) | TCP_FLAG_PSH);
+            }
+            if (push || payload < q->rsc.mss) {
+                virtio_net_rsc_flush(q);
+            }
+            return size;
+        }
+        if (virtio_net_rsc_flush(q) == 0) {
+            /* keep ordering: this packet waits behind the pending frame */
+            return 0;
+        }
+    }
+
+    if (!hdr_len || push || !virtio_net_can_receive(nc)) {
+        return virtio_net_receive_rcu(nc, buf, size, NULL);
+    }
+
+    memcpy(q->rsc.buf, buf, size);
+    q->rsc.size = size;
+    q->rsc.hdr_len = hdr_len;
+    q->rsc.mss = payload;
+    q->rsc.next_seq = ldl_be_p(&tcp->th_seq) + payload;
+    q->rsc.segs = 1;
+    timer_mod(q->rsc.timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+              n->net_conf.rx_coalesce_timeout);
+    return size;
+}
+
 static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
+    VirtIONet *n = qemu_get_nic_opaque(nc);
     ssize_t r;
 
     rcu_read_lock();
-    r = virtio_net_receive_rcu(nc, buf, size);
+    if (virtio_net_rsc_enabled(n)) {
+        r = virtio_net_rsc_receive(nc, buf, size);
+    } else {
+        r = virtio_net_receive_rcu(nc, buf, size, NULL);
+    }
     rcu_read_unlock();
     return r;
 }
@@ -1342,7 +1582,12 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ssize_t ret;
         unsigned int out_num;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+        /*
+         * Packets that cannot be delivered right away stay queued by
+         * reference to the guest buffers, so the header must outlive
+         * this loop iteration.
+         */
+        struct virtio_net_hdr_mrg_rxbuf *mhdr = &q->async_tx.mhdr;
 
         elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -1359,7 +1604,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         }
 
         if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            if (iov_to_buf(out_sg, out_num, 0, mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
@@ -1367,8 +1612,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
+                virtio_net_hdr_swap(vdev, (void *) mhdr);
+                sg2[0].iov_base = mhdr;
                 sg2[0].iov_len = n->guest_hdr_len;
                 out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
                                    out_sg, out_num,
@@ -1397,8 +1642,13 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        /*
+         * The element stays mapped until virtio_net_tx_complete, so a
+         * packet the peer cannot take right now need not be copied.
+         */
+        ret = qemu_sendv_packet_async_zerocopy(
+                qemu_get_subqueue(n->nic, queue_index),
+                out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
@@ -1563,6 +1813,13 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    if (n->net_conf.rx_coalesce) {
+        n->vqs[index].rsc.buf = g_malloc(VIRTIO_NET_RSC_MAX_FRAME);
+        n->vqs[index].rsc.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                               virtio_net_rsc_timer,
+                                               &n->vqs[index]);
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -1585,6 +1842,14 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         q->tx_bh = NULL;
     }
     q->tx_waiting = 0;
+    if (q->rsc.timer) {
+        timer_del(q->rsc.timer);
+        timer_free(q->rsc.timer);
+        q->rsc.timer = NULL;
+        g_free(q->rsc.buf);
+        q->rsc.buf = NULL;
+        q->rsc.size = 0;
+    }
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
@@ -1633,6 +1898,18 @@ static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
     virtio_net_set_queues(n);
 }
 
+static int virtio_net_pre_save_device(void *opaque)
+{
+    VirtIONet *n = opaque;
+
+    /*
+     * Guest RAM has already been sent, so frames still being coalesced
+     * cannot be delivered any more; drop them as a lossy link would.
+     */
+    virtio_net_rsc_drop(n);
+    return 0;
+}
+
 static int virtio_net_post_load_device(void *opaque, int version_id)
 {
     VirtIONet *n = opaque;
@@ -1844,6 +2121,7 @@ static const VMStateDescription vmstate_virtio_net_device = {
     .name = "virtio-net-device",
     .version_id = VIRTIO_NET_VM_VERSION,
     .minimum_version_id = VIRTIO_NET_VM_VERSION,
+    .pre_save = virtio_net_pre_save_device,
     .post_load = virtio_net_post_load_device,
     .fields = (VMStateField[]) {
         VMSTATE_UINT8_ARRAY(mac, VirtIONet, ETH_ALEN),
@@ -2198,6 +2476,9 @@ static Property virtio_net_properties[] = {
                      true),
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
+    DEFINE_PROP_BOOL("rx_coalesce", VirtIONet, net_conf.rx_coalesce, false),
+    DEFINE_PROP_UINT32("rx_coalesce_timeout", VirtIONet,
+                       net_conf.rx_coalesce_timeout, RX_COALESCE_TIMEOUT),
     DEFINE_PROP_END_OF_LIST(),
 };
 
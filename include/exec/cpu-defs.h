@@ -31,6 +31,7 @@
 #endif
 #ifndef CONFIG_USER_ONLY
 #include "exec/hwaddr.h"
+#include "exec/cpu-common.h"
 #endif
 #include "exec/memattrs.h"
 
@@ -154,6 +155,14 @@ typedef struct CPUTLBDesc {
     size_t vindex;
 } CPUTLBDesc;
 
+/*
+ * The dirty log is a hash set of CPU_TLB_DIRTY_LOG_SLOTS entries, flushed
+ * once it holds CPU_TLB_DIRTY_LOG_SIZE distinct pages.
+ */
+#define CPU_TLB_DIRTY_LOG_BITS 9
+#define CPU_TLB_DIRTY_LOG_SLOTS (1 << CPU_TLB_DIRTY_LOG_BITS)
+#define CPU_TLB_DIRTY_LOG_SIZE (CPU_TLB_DIRTY_LOG_SLOTS / 2)
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -174,6 +183,16 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /*
+     * While migrating, RAM pages that are mapped writable without
+     * TLB_NOTDIRTY by a store are logged here, and are only marked
+     * dirty for migration when the log is flushed.  Each used slot
+     * holds the page's ram_addr_t with bit 0 set.  Only accessed by
+     * the thread running the vCPU.
+     */
+    bool dirty_log_store_fill;
+    unsigned dirty_log_len;
+    ram_addr_t dirty_log[CPU_TLB_DIRTY_LOG_SLOTS];
 } CPUTLBCommon;
 
 /*
@@ -24,5 +24,7 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+void tlb_dirty_log_add(CPUState *cpu, ram_addr_t ram_addr);
+void tlb_dirty_log_sync(void);
 #endif
 #endif
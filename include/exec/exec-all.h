@@ -67,6 +67,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+void tb_gen_superblock(CPUState *cpu, TranslationBlock *tb);
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -351,6 +352,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_SUPERBLOCK  0x00100000 /* Hot TB retranslation, may follow jumps */
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
     (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL)
@@ -358,6 +360,12 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Executions left before this TB is retranslated as a superblock.
+     * Only counted down by TBs that end in a direct jump a superblock
+     * could follow.  Approximate: MTTCG vCPUs update it without atomics.  */
+    uint32_t exec_count;
+#define TB_HOT_THRESHOLD 1024
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -402,6 +410,15 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Guest address the indirect jump emitted by
+     * tcg_gen_lookup_and_goto_ptr_pred() is predicted to go to, and whose
+     * TB is linked to the jump slot it was given.  Only meaningful once
+     * jmp_pred_set is true.
+     */
+    target_ulong jmp_pred;
+    bool jmp_pred_set;
 };
 
 extern bool parallel_cpus;
@@ -432,6 +449,8 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
+void tb_jmp_unlink_one(TranslationBlock *tb, int n);
+void tb_add_jump_pred(TranslationBlock *tb, int n, TranslationBlock *tb_next);
 
 /* GETPC is the true target of the return instruction that we'll execute.  */
 #if defined(CONFIG_TCG_INTERPRETER)
@@ -451,7 +470,7 @@ extern uintptr_t tci_tb_ptr;
    smaller than 4 bytes, so we don't worry about special-casing this.  */
 #define GETPC_ADJ   2
 
-#if !defined(CONFIG_USER_ONLY) && defined(CONFIG_DEBUG_TCG)
+#ifdef CONFIG_DEBUG_TCG
 void assert_no_pages_locked(void);
 #else
 static inline void assert_no_pages_locked(void)
@@ -480,6 +499,8 @@ void tlb_fill(CPUState *cpu, target_ulong addr, int size,
 
 #if defined(CONFIG_USER_ONLY)
 void mmap_lock(void);
+/* Lock only the host pages covering [@start, @start + @len[ */
+void mmap_lock_range(target_ulong start, target_ulong len);
 void mmap_unlock(void);
 bool have_mmap_lock(void);
 
@@ -489,6 +510,7 @@ static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong
 }
 #else
 static inline void mmap_lock(void) {}
+static inline void mmap_lock_range(target_ulong start, target_ulong len) {}
 static inline void mmap_unlock(void) {}
 
 /* cputlb.c */
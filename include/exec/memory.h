@@ -458,6 +458,8 @@ typedef struct FlatRange FlatRange;
 struct FlatView {
     struct rcu_head rcu;
     unsigned ref;
+    /* never 0 and never reused, unlike the address of the view */
+    uint64_t gen;
     FlatRange *ranges;
     unsigned nr;
     unsigned nr_allocated;
@@ -1692,6 +1694,9 @@ void memory_listener_register(MemoryListener *listener, AddressSpace *filter);
  */
 void memory_listener_unregister(MemoryListener *listener);
 
+/* True between memory_global_dirty_log_start() and _stop() */
+extern bool global_dirty_log;
+
 /**
  * memory_global_dirty_log_start: begin dirty logging for all regions
  */
@@ -1775,6 +1780,44 @@ MemTxResult address_space_rw(AddressSpace *as, hwaddr addr,
                              MemTxAttrs attrs, uint8_t *buf,
                              int len, bool is_write);
 
+#define ADDRESS_SPACE_MMIO_CACHE_SIZE 4
+
+/**
+ * AddressSpaceMMIOCache: the sections recently hit by address_space_rw_mmio
+ *
+ * Each entry is only valid for the #FlatView it was looked up in, so the
+ * cache needs no invalidation when the memory map changes.  A cache must
+ * only be used by one thread at a time, typically that of a vCPU.
+ */
+typedef struct AddressSpaceMMIOCache {
+    struct {
+        uint64_t gen;
+        MemoryRegionSection *section;
+    } entry[ADDRESS_SPACE_MMIO_CACHE_SIZE];
+    unsigned next;
+} AddressSpaceMMIOCache;
+
+/**
+ * address_space_rw_mmio: like address_space_rw, for accesses likely to hit
+ * the same few MMIO registers over and over.
+ *
+ * The section that @addr lies in is first looked up in @cache, which
+ * skips the walk of the dispatch tree.  Sections behind an IOMMU are never
+ * cached.
+ *
+ * @as: #AddressSpace to be accessed
+ * @cache: the #AddressSpaceMMIOCache of the caller, zeroed before first use
+ * @addr: address within that address space
+ * @attrs: memory transaction attributes
+ * @buf: buffer with the data transferred
+ * @len: the number of bytes to read or write
+ * @is_write: indicates the transfer direction
+ */
+MemTxResult address_space_rw_mmio(AddressSpace *as,
+                                  AddressSpaceMMIOCache *cache, hwaddr addr,
+                                  MemTxAttrs attrs, uint8_t *buf,
+                                  int len, bool is_write);
+
 /**
  * address_space_write: write to address space.
  *
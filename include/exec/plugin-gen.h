@@ -0,0 +1,57 @@
+/*
+ * QEMU TCG plugin support, code generation hooks
+ *
+ * The translator records where each TB and insn starts in the op stream
+ * and which qemu_ld/st ops each insn emits.  Once the TB is fully
+ * translated the plugins are shown it, and the instrumentation they ask
+ * for is inserted at the recorded points.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_GEN_H
+#define QEMU_PLUGIN_GEN_H
+
+#include "qemu/plugin.h"
+#include "tcg/tcg.h"
+
+#ifdef CONFIG_PLUGIN
+
+void plugin_gen_tb_start(const TranslationBlock *tb);
+void plugin_gen_tb_end(CPUState *cpu);
+void plugin_gen_insn_start(target_ulong pc);
+void plugin_gen_insn_end(target_ulong pc_next);
+
+/*
+ * Called around a qemu_ld/st op: plugin_prep_mem() returns a copy of
+ * @addr that survives the access (or NULL when not instrumenting), which
+ * plugin_gen_mem() consumes right after the op has been emitted.
+ */
+TCGv plugin_prep_mem(TCGv addr);
+void plugin_gen_mem(TCGv addr, TCGMemOp memop, bool is_store);
+
+#else /* !CONFIG_PLUGIN */
+
+static inline void plugin_gen_tb_start(const TranslationBlock *tb)
+{ }
+
+static inline void plugin_gen_tb_end(CPUState *cpu)
+{ }
+
+static inline void plugin_gen_insn_start(target_ulong pc)
+{ }
+
+static inline void plugin_gen_insn_end(target_ulong pc_next)
+{ }
+
+static inline TCGv plugin_prep_mem(TCGv addr)
+{
+    return NULL;
+}
+
+static inline void plugin_gen_mem(TCGv addr, TCGMemOp memop, bool is_store)
+{ }
+
+#endif /* !CONFIG_PLUGIN */
+
+#endif /* QEMU_PLUGIN_GEN_H */
@@ -50,6 +50,20 @@ struct RAMBlock {
     unsigned long *unsentmap;
     /* bitmap of already received pages in postcopy */
     unsigned long *receivedmap;
+    /*
+     * While loading RAM lazily, where each target page comes from: its
+     * offset in the incoming file, LAZY_RAM_ZERO, or 0 if it is already
+     * in memory.
+     */
+    uint64_t *lazy_offsets;
+    /*
+     * With x-mapped-ram, pages that have data in the migration file, and
+     * where the bitmap and the pages of this block are stored there,
+     * relative to the start of the stream.
+     */
+    unsigned long *file_bmap;
+    uint64_t file_bmap_offset;
+    uint64_t file_pages_offset;
 };
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
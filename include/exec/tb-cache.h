@@ -0,0 +1,48 @@
+/*
+ * Persistent translation cache for user-mode emulation
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef EXEC_TB_CACHE_H
+#define EXEC_TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_USER_ONLY
+
+extern bool tb_cache_enabled;
+
+/*
+ * tb_cache_init: open the translation cache for @exec_path in @dir
+ *
+ * Must be called once, after tcg_region_init().  If a cache file written
+ * by an identical setup exists, its host code is mapped back in place and
+ * its TBs become candidates for tb_cache_lookup().
+ */
+void tb_cache_init(const char *dir, const char *exec_path,
+                   const char *cpu_model);
+
+/*
+ * tb_cache_lookup: find a cached TB for the given CPU state
+ *
+ * Returns a TB whose guest code is unchanged since it was saved, or NULL.
+ * The caller must link the returned TB as if it had just been generated.
+ * Called with mmap_lock held.
+ */
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags,
+                                  uint32_t cflags);
+
+/* Record a freshly linked TB so that tb_cache_save() writes it out */
+void tb_cache_note(TranslationBlock *tb);
+
+/* Forget every cached and recorded TB; called when the code buffer is reset */
+void tb_cache_flush(void);
+
+/* Write the current translations back to the cache file */
+void tb_cache_save(void);
+
+#endif /* CONFIG_USER_ONLY */
+
+#endif /* EXEC_TB_CACHE_H */
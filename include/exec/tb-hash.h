@@ -22,29 +22,41 @@
 
 #include "qemu/xxhash.h"
 
+/*
+ * The functions below return a set index into the TB jump cache; each set
+ * holds TB_JMP_CACHE_WAYS entries.
+ */
+
 #ifdef CONFIG_SOFTMMU
 
-/* Only the bottom TB_JMP_PAGE_BITS of the jump cache hash bits vary for
+/* Only the bottom tb_jmp_cache_page_bits() of the set index vary for
    addresses on the same page.  The top bits are the same.  This allows
    TLB invalidation to quickly clear a subset of the hash table.  */
-#define TB_JMP_PAGE_BITS (TB_JMP_CACHE_BITS / 2)
-#define TB_JMP_PAGE_SIZE (1 << TB_JMP_PAGE_BITS)
-#define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
-#define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
+static inline unsigned int tb_jmp_cache_page_bits(void)
+{
+    return tb_jmp_cache_bits / 2;
+}
+
+static inline unsigned int tb_jmp_cache_page_mask(void)
+{
+    return (1u << tb_jmp_cache_bits) - (1u << tb_jmp_cache_page_bits());
+}
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
+    unsigned int page_bits = tb_jmp_cache_page_bits();
     target_ulong tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK;
+    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - page_bits));
+    return (tmp >> (TARGET_PAGE_BITS - page_bits)) & tb_jmp_cache_page_mask();
 }
 
 static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 {
+    unsigned int page_bits = tb_jmp_cache_page_bits();
     target_ulong tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (((tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK)
-           | (tmp & TB_JMP_ADDR_MASK));
+    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - page_bits));
+    return (((tmp >> (TARGET_PAGE_BITS - page_bits)) & tb_jmp_cache_page_mask())
+           | (tmp & ((1u << page_bits) - 1)));
 }
 
 #else
@@ -52,7 +64,7 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 /* In user-mode we can get better hashing because we do not have a TLB */
 static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 {
-    return (pc ^ (pc >> TB_JMP_CACHE_BITS)) & (TB_JMP_CACHE_SIZE - 1);
+    return (pc ^ (pc >> tb_jmp_cache_bits)) & ((1u << tb_jmp_cache_bits) - 1);
 }
 
 #endif /* CONFIG_SOFTMMU */
@@ -16,31 +16,82 @@
 #include "exec/exec-all.h"
 #include "exec/tb-hash.h"
 
+static inline TranslationBlock **tb_jmp_cache_set(CPUState *cpu,
+                                                  target_ulong pc)
+{
+    return &cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc) * TB_JMP_CACHE_WAYS];
+}
+
+/*
+ * Make @tb the most recently used entry of @set, shifting down the entries
+ * in front of @way.  Whatever was at @way is dropped.
+ */
+static inline void tb_jmp_cache_promote(TranslationBlock **set,
+                                        unsigned int way, TranslationBlock *tb)
+{
+    for (; way > 0; way--) {
+        atomic_set(&set[way], atomic_read(&set[way - 1]));
+    }
+    atomic_set(&set[0], tb);
+}
+
+static inline void tb_jmp_cache_insert(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock **set = tb_jmp_cache_set(cpu, tb->pc);
+    unsigned int way;
+
+    for (way = 0; way < TB_JMP_CACHE_WAYS - 1; way++) {
+        if (atomic_read(&set[way]) == tb) {
+            break;
+        }
+    }
+    tb_jmp_cache_promote(set, way, tb);
+}
+
+static inline void tb_jmp_cache_remove(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock **set = tb_jmp_cache_set(cpu, tb->pc);
+    unsigned int way;
+
+    for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+        if (atomic_read(&set[way]) == tb) {
+            atomic_set(&set[way], NULL);
+        }
+    }
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *
 tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
                      uint32_t *flags, uint32_t cf_mask)
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
-    TranslationBlock *tb;
-    uint32_t hash;
+    TranslationBlock *tb, **set;
+    unsigned int way;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
-    hash = tb_jmp_cache_hash_func(*pc);
-    tb = atomic_rcu_read(&cpu->tb_jmp_cache[hash]);
-    if (likely(tb &&
-               tb->pc == *pc &&
-               tb->cs_base == *cs_base &&
-               tb->flags == *flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
-        return tb;
+    set = tb_jmp_cache_set(cpu, *pc);
+    for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+        tb = atomic_rcu_read(&set[way]);
+        if (likely(tb &&
+                   tb->pc == *pc &&
+                   tb->cs_base == *cs_base &&
+                   tb->flags == *flags &&
+                   tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+                   (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
+            atomic_set(&cpu->tb_jmp_cache_hits, cpu->tb_jmp_cache_hits + 1);
+            if (way) {
+                tb_jmp_cache_promote(set, way, tb);
+            }
+            return tb;
+        }
     }
+    atomic_set(&cpu->tb_jmp_cache_misses, cpu->tb_jmp_cache_misses + 1);
     tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
     if (tb == NULL) {
         return NULL;
     }
-    atomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_promote(set, TB_JMP_CACHE_WAYS - 1, tb);
     return tb;
 }
 
@@ -60,6 +60,11 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @superblock_exit: The TB ends in a direct jump that a superblock would
+ *                   follow.
+ * @superblock_gotos: Number of jumps followed so far in a superblock.
+ * @pc_max: End of the highest instruction translated so far; a superblock
+ *          may have jumped back, leaving @pc_next below it.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -71,6 +76,9 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    bool superblock_exit;
+    int superblock_gotos;
+    target_ulong pc_max;
 } DisasContextBase;
 
 /**
@@ -105,6 +113,9 @@ typedef struct DisasContextBase {
  *
  * @disas_log:
  *      Print instruction disassembly to log.
+ * @superblocks:
+ *      The target calls translator_superblock_goto() for its direct jumps,
+ *      so TBs that become hot are retranslated as superblocks.
  */
 typedef struct TranslatorOps {
     void (*init_disas_context)(DisasContextBase *db, CPUState *cpu);
@@ -115,6 +126,7 @@ typedef struct TranslatorOps {
     void (*translate_insn)(DisasContextBase *db, CPUState *cpu);
     void (*tb_stop)(DisasContextBase *db, CPUState *cpu);
     void (*disas_log)(const DisasContextBase *db, CPUState *cpu);
+    bool superblocks;
 } TranslatorOps;
 
 /**
@@ -141,4 +153,24 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_superblock_goto:
+ * @db: Disassembly context.
+ * @insn_end: Address following the jump instruction.
+ * @dest: Jump destination.
+ *
+ * Return true if the TB being translated is a superblock and the direct
+ * jump to @dest can be replaced by continuing translation at @dest.  The
+ * target must then not emit the jump, and must set up its own state so
+ * that the next instruction is decoded from @dest.  In other TBs, note
+ * whether the jump could be followed, so that only such TBs count their
+ * executions.
+ *
+ * For a conditional branch, @dest is the side the target expects to be
+ * taken, and the other side must leave the TB.  Jumping back to a loop
+ * header in the TB is allowed, which unrolls the loop.
+ */
+bool translator_superblock_goto(DisasContextBase *db,
+                                target_ulong insn_end, target_ulong dest);
+
 #endif  /* EXEC__TRANSLATOR_H */
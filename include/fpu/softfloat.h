@@ -399,6 +399,12 @@ float32 float32_mul(float32, float32, float_status *status);
 float32 float32_div(float32, float32, float_status *status);
 float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
+void float32_vec_add(float32 *, const float32 *, const float32 *, size_t,
+                     float_status *status);
+void float32_vec_sub(float32 *, const float32 *, const float32 *, size_t,
+                     float_status *status);
+void float32_vec_mul(float32 *, const float32 *, const float32 *, size_t,
+                     float_status *status);
 float32 float32_sqrt(float32, float_status *status);
 float32 float32_exp2(float32, float_status *status);
 float32 float32_log2(float32, float_status *status);
@@ -556,6 +562,12 @@ float64 float64_mul(float64, float64, float_status *status);
 float64 float64_div(float64, float64, float_status *status);
 float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
+void float64_vec_add(float64 *, const float64 *, const float64 *, size_t,
+                     float_status *status);
+void float64_vec_sub(float64 *, const float64 *, const float64 *, size_t,
+                     float_status *status);
+void float64_vec_mul(float64 *, const float64 *, const float64 *, size_t,
+                     float_status *status);
 float64 float64_sqrt(float64, float_status *status);
 float64 float64_log2(float64, float_status *status);
 int float64_eq(float64, float64, float_status *status);
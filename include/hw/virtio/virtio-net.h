@@ -31,6 +31,9 @@
  * and latency. */
 #define TX_BURST 256
 
+/* How long a partially coalesced receive segment may be held back */
+#define RX_COALESCE_TIMEOUT 50000 /* 50 us */
+
 typedef struct virtio_net_conf
 {
     uint32_t txtimer;
@@ -42,6 +45,8 @@ typedef struct virtio_net_conf
     int32_t speed;
     char *duplex_str;
     uint8_t duplex;
+    bool rx_coalesce;
+    uint32_t rx_coalesce_timeout;
 } virtio_net_conf;
 
 /* Maximum packet size we can receive from tap device: header + 64k */
@@ -55,7 +60,19 @@ typedef struct VirtIONetQueue {
     uint32_t tx_waiting;
     struct {
         VirtQueueElement *elem;
+        /* byte-swapped header, referenced by a queued zero-copy packet */
+        struct virtio_net_hdr_mrg_rxbuf mhdr;
     } async_tx;
+    /* receive segment coalescing for peers without a vnet header */
+    struct {
+        QEMUTimer *timer;
+        uint8_t *buf;           /* frame being built, first segment's headers */
+        size_t size;            /* 0 when no frame is pending */
+        size_t hdr_len;         /* Ethernet + IPv4 + TCP header length */
+        uint32_t next_seq;
+        uint16_t mss;
+        uint16_t segs;
+    } rsc;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -549,8 +549,32 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
-void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
-                     Error **errp);
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the area to preallocate
+ * @sz: size of the area
+ * @host_nodes: bitmap of the host NUMA nodes @area is bound to, or NULL
+ * @maxnode: number of bits in @host_nodes
+ * @interleave: whether pages of @area are interleaved across @host_nodes
+ * @errp: returns an error if the host runs out of memory
+ *
+ * Touches every page of @area from as many threads as there are host
+ * CPUs.  With @host_nodes, the threads run on those nodes and each
+ * touches the pages that the NUMA policy will place on its own node.
+ */
+void os_mem_prealloc(int fd, char *area, size_t sz,
+                     const unsigned long *host_nodes, unsigned long maxnode,
+                     bool interleave, Error **errp);
+
+/**
+ * os_mem_prealloc_progress:
+ *
+ * Returns in @done the number of bytes preallocated so far, and in
+ * @total the number of bytes requested so far.  Can be called from any
+ * thread while os_mem_prealloc() runs.
+ */
+void os_mem_prealloc_progress(size_t *done, size_t *total);
 
 /**
  * qemu_get_pid_name:
@@ -0,0 +1,107 @@
+/*
+ * QEMU TCG plugin support, internal interface
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_H
+#define QEMU_PLUGIN_H
+
+#include "qemu/qemu-plugin.h"
+#include "qemu/error-report.h"
+#include "qemu/option.h"
+
+/* Layout of qemu_plugin_meminfo_t */
+#define PLUGIN_MEMINFO_SHIFT_MASK   0xf
+#define PLUGIN_MEMINFO_SIGN_EXTEND  (1 << 4)
+#define PLUGIN_MEMINFO_BIG_ENDIAN   (1 << 5)
+#define PLUGIN_MEMINFO_STORE        (1 << 6)
+
+enum plugin_dyn_cb_type {
+    PLUGIN_CB_REGULAR,
+    PLUGIN_CB_INLINE,
+};
+
+/* A callback or inline operation attached to a TB, insn or memory access */
+struct qemu_plugin_dyn_cb {
+    enum plugin_dyn_cb_type type;
+    enum qemu_plugin_mem_rw rw;     /* memory callbacks only */
+    void *f;                        /* PLUGIN_CB_REGULAR */
+    void *userp;                    /* counter for PLUGIN_CB_INLINE */
+    enum qemu_plugin_op op;         /* PLUGIN_CB_INLINE */
+    uint64_t imm;                   /* PLUGIN_CB_INLINE */
+};
+
+/* A guest memory access emitted while translating an insn */
+struct qemu_plugin_mem_rec {
+    void *op;                       /* the qemu_ld/st TCGOp */
+    void *addr;                     /* TCGv holding a copy of the address */
+    qemu_plugin_meminfo_t info;
+};
+
+struct qemu_plugin_insn {
+    uint64_t vaddr;
+    size_t size;
+    void *anchor;                   /* TCGOp after which to instrument */
+    GArray *exec_cbs;
+    GArray *mem_cbs;
+    GArray *mem_recs;
+};
+
+/*
+ * The instrumentation state of a TB being translated.  It is owned by
+ * the translating thread and reused from one translation to the next.
+ */
+struct qemu_plugin_tb {
+    uint64_t vaddr;
+    void *anchor;
+    GArray *exec_cbs;
+    GPtrArray *insns;               /* allocated qemu_plugin_insn */
+    size_t n;                       /* of which in use */
+};
+
+#ifdef CONFIG_PLUGIN
+
+extern QemuOptsList qemu_plugin_opts;
+
+/* Queue a plugin given as "file=path[,arg=...]" for qemu_plugin_load_list() */
+void qemu_plugin_opt_parse(const char *optarg);
+
+/*
+ * Load and install the queued plugins.  Returns 0 on success, or -1 after
+ * reporting an error.  Must be called before any vCPU starts.
+ */
+int qemu_plugin_load_list(void);
+
+/* True if some plugin wants to see translated TBs */
+bool qemu_plugin_tb_trans_enabled(void);
+
+void qemu_plugin_tb_trans_cb(CPUState *cpu, struct qemu_plugin_tb *tb);
+
+/* Run the exit callbacks; only the first call has any effect */
+void qemu_plugin_atexit_cb(void);
+
+#else /* !CONFIG_PLUGIN */
+
+static inline void qemu_plugin_opt_parse(const char *optarg)
+{
+    error_report("plugin interface not enabled in this build");
+    exit(1);
+}
+
+static inline int qemu_plugin_load_list(void)
+{
+    return 0;
+}
+
+static inline bool qemu_plugin_tb_trans_enabled(void)
+{
+    return false;
+}
+
+static inline void qemu_plugin_atexit_cb(void)
+{ }
+
+#endif /* !CONFIG_PLUGIN */
+
+#endif /* QEMU_PLUGIN_H */
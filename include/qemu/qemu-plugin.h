@@ -0,0 +1,154 @@
+/*
+ * QEMU TCG plugin API
+ *
+ * This is the only header a plugin includes.  It must stay free of any
+ * QEMU-internal types so that plugins can be built out of tree.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_API_H
+#define QEMU_PLUGIN_API_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined _WIN32 || defined __CYGWIN__
+# define QEMU_PLUGIN_EXPORT __declspec(dllexport)
+#else
+# define QEMU_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+/*
+ * Bumped whenever the API changes incompatibly.  A plugin exports the
+ * version it was built against and is refused if it does not match.
+ */
+#define QEMU_PLUGIN_VERSION 1
+
+typedef uint64_t qemu_plugin_id_t;
+
+/*
+ * A plugin must export these two symbols:
+ *
+ *   QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+ *
+ *   QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+ *                                              int argc, char **argv);
+ *
+ * qemu_plugin_install() is called once, before any vCPU runs, with the
+ * "arg=" values given on the command line; @argv is only valid during
+ * the call.  It returns 0 on success; any other value makes QEMU refuse
+ * to start.  Translation and exit callbacks can only be registered from
+ * within qemu_plugin_install().
+ */
+typedef int (*qemu_plugin_install_func_t)(qemu_plugin_id_t id,
+                                          int argc, char **argv);
+
+struct qemu_plugin_tb;
+struct qemu_plugin_insn;
+
+enum qemu_plugin_mem_rw {
+    QEMU_PLUGIN_MEM_R = 1,
+    QEMU_PLUGIN_MEM_W,
+    QEMU_PLUGIN_MEM_RW,
+};
+
+enum qemu_plugin_op {
+    QEMU_PLUGIN_INLINE_ADD_U64,
+};
+
+/* Opaque description of a memory access, see the accessors below */
+typedef uint32_t qemu_plugin_meminfo_t;
+
+typedef void (*qemu_plugin_simple_cb_t)(qemu_plugin_id_t id, void *userdata);
+
+typedef void (*qemu_plugin_vcpu_tb_trans_cb_t)(qemu_plugin_id_t id,
+                                               unsigned int vcpu_index,
+                                               struct qemu_plugin_tb *tb);
+
+typedef void (*qemu_plugin_vcpu_udata_cb_t)(unsigned int vcpu_index,
+                                            void *userdata);
+
+typedef void (*qemu_plugin_vcpu_mem_cb_t)(unsigned int vcpu_index,
+                                          qemu_plugin_meminfo_t info,
+                                          uint64_t vaddr, void *userdata);
+
+/*
+ * Registration.
+ *
+ * @cb is called every time a TB is translated, from the translating
+ * thread.  The TB passed to it is only valid during the call; it can be
+ * inspected and instrumented with the functions below.
+ */
+void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
+                                           qemu_plugin_vcpu_tb_trans_cb_t cb);
+
+/* @cb is called once, when the emulated machine or process exits */
+void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
+                                    qemu_plugin_simple_cb_t cb,
+                                    void *userdata);
+
+/*
+ * Inspection of a TB being translated.
+ */
+size_t qemu_plugin_tb_n_insns(const struct qemu_plugin_tb *tb);
+uint64_t qemu_plugin_tb_vaddr(const struct qemu_plugin_tb *tb);
+struct qemu_plugin_insn *
+qemu_plugin_tb_get_insn(const struct qemu_plugin_tb *tb, size_t idx);
+
+uint64_t qemu_plugin_insn_vaddr(const struct qemu_plugin_insn *insn);
+size_t qemu_plugin_insn_size(const struct qemu_plugin_insn *insn);
+
+/*
+ * Instrumentation, only valid from a translation callback.
+ *
+ * Callbacks are called from the executing vCPU thread, before the TB or
+ * insn executes, or after the memory access completes.  They must not
+ * call back into QEMU other than through qemu_plugin_outs().
+ *
+ * Inline operations are emitted directly into the translated code and
+ * are much cheaper than a callback.  They are not atomic: with several
+ * vCPUs running in parallel, use a separate counter per vCPU or accept
+ * lost updates.
+ */
+void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
+                                          qemu_plugin_vcpu_udata_cb_t cb,
+                                          void *userdata);
+void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
+                                              enum qemu_plugin_op op,
+                                              void *ptr, uint64_t imm);
+
+void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
+                                            qemu_plugin_vcpu_udata_cb_t cb,
+                                            void *userdata);
+void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
+                                                enum qemu_plugin_op op,
+                                                void *ptr, uint64_t imm);
+
+/*
+ * Memory accesses made by @insn through the softmmu/user-mode load and
+ * store paths.  Accesses performed inside helpers (atomics, some string
+ * and vector instructions) are not reported.
+ */
+void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
+                                      qemu_plugin_vcpu_mem_cb_t cb,
+                                      enum qemu_plugin_mem_rw rw,
+                                      void *userdata);
+void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          enum qemu_plugin_op op,
+                                          void *ptr, uint64_t imm);
+
+/*
+ * Memory access information.
+ */
+unsigned int qemu_plugin_mem_size_shift(qemu_plugin_meminfo_t info);
+bool qemu_plugin_mem_is_sign_extended(qemu_plugin_meminfo_t info);
+bool qemu_plugin_mem_is_big_endian(qemu_plugin_meminfo_t info);
+bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info);
+
+/* Write @string to the QEMU log, under "-d plugin" */
+void qemu_plugin_outs(const char *string);
+
+#endif /* QEMU_PLUGIN_API_H */
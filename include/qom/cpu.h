@@ -248,8 +248,22 @@ struct kvm_run;
 
 struct hax_vcpu_state;
 
-#define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+/*
+ * The TB jump cache is set-associative, with TB_JMP_CACHE_WAYS entries per
+ * set; tb_jmp_cache_bits is the log2 of the number of sets.  It can be
+ * changed before any CPU is created, within the MIN/MAX bounds.
+ */
+#define TB_JMP_CACHE_BITS 10
+#define TB_JMP_CACHE_BITS_MIN 4
+#define TB_JMP_CACHE_BITS_MAX 16
+#define TB_JMP_CACHE_WAYS 4
+
+extern unsigned int tb_jmp_cache_bits;
+
+static inline size_t tb_jmp_cache_size(void)
+{
+    return (size_t)TB_JMP_CACHE_WAYS << tb_jmp_cache_bits;
+}
 
 /* work queue */
 
@@ -367,7 +381,10 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
 
     /* Accessed in parallel; all accesses must be atomic */
-    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    struct TranslationBlock **tb_jmp_cache;
+    /* Written only by the vCPU thread */
+    size_t tb_jmp_cache_hits;
+    size_t tb_jmp_cache_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -449,7 +466,7 @@ static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 {
     unsigned int i;
 
-    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    for (i = 0; i < tb_jmp_cache_size(); i++) {
         atomic_set(&cpu->tb_jmp_cache[i], NULL);
     }
 }
@@ -18,6 +18,8 @@
  */
 #include "qemu/osdep.h"
 #include "qemu.h"
+#include "exec/tb-cache.h"
+#include "qemu/plugin.h"
 
 #ifdef CONFIG_GCOV
 extern void __gcov_dump(void);
@@ -31,5 +33,7 @@ void preexit_cleanup(CPUArchState *env, int code)
 #ifdef CONFIG_GCOV
         __gcov_dump();
 #endif
+        tb_cache_save();
+        qemu_plugin_atexit_cb();
         gdb_exit(env, code);
 }
@@ -28,8 +28,10 @@
 #include "qemu/config-file.h"
 #include "qemu/cutils.h"
 #include "qemu/help_option.h"
+#include "qemu/plugin.h"
 #include "cpu.h"
 #include "exec/exec-all.h"
+#include "exec/tb-cache.h"
 #include "tcg.h"
 #include "qemu/timer.h"
 #include "qemu/envlist.h"
@@ -300,6 +302,19 @@ static void handle_arg_randseed(const char *arg)
     srand(seed);
 }
 
+static void handle_arg_jmp_cache_bits(const char *arg)
+{
+    unsigned long long bits;
+
+    if (parse_uint_full(arg, &bits, 0) != 0 ||
+        bits < TB_JMP_CACHE_BITS_MIN || bits > TB_JMP_CACHE_BITS_MAX) {
+        fprintf(stderr, "Invalid jump cache size: %s (must be %d-%d)\n",
+                arg, TB_JMP_CACHE_BITS_MIN, TB_JMP_CACHE_BITS_MAX);
+        exit(EXIT_FAILURE);
+    }
+    tb_jmp_cache_bits = bits;
+}
+
 static void handle_arg_gdb(const char *arg)
 {
     gdbstub_port = atoi(arg);
@@ -378,6 +393,17 @@ static void handle_arg_version(const char *arg)
     exit(EXIT_SUCCESS);
 }
 
+static const char *tb_cache_dir;
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static void handle_arg_plugin(const char *arg)
+{
+    qemu_plugin_opt_parse(arg);
+}
+
 static char *trace_file;
 static void handle_arg_trace(const char *arg)
 {
@@ -432,6 +458,12 @@ static const struct qemu_argument arg_table[] = {
      "",           "run in singlestep mode"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translated code across runs in 'dir'"},
+    {"jmp-cache-bits", "QEMU_JMP_CACHE_BITS", true, handle_arg_jmp_cache_bits,
+     "n",          "use 2^n sets in the TB jump cache"},
+    {"plugin",     "QEMU_PLUGIN",      true,  handle_arg_plugin,
+     "",           "[file=]<file>[,arg=<string>]"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_randseed,
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
@@ -634,6 +666,9 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file(trace_file);
+    if (qemu_plugin_load_list()) {
+        exit(1);
+    }
 
     /* Zero out regs */
     memset(regs, 0, sizeof(struct target_pt_regs));
@@ -806,6 +841,14 @@ int main(int argc, char **argv, char **envp)
     tcg_prologue_init(tcg_ctx);
     tcg_region_init();
 
+    /*
+     * Single-stepped translations are not worth keeping, and cached
+     * ones would bypass plugin instrumentation.
+     */
+    if (tb_cache_dir && !singlestep && !qemu_plugin_tb_trans_enabled()) {
+        tb_cache_init(tb_cache_dir, exec_path, cpu_model);
+    }
+
     target_cpu_copy_regs(env, regs);
 
     if (gdbstub_port) {
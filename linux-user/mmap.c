@@ -23,19 +23,112 @@
 
 //#define DEBUG_MMAP
 
+/*
+ * The guest address space is locked either as a whole, with mmap_lock(),
+ * or one range at a time, with mmap_lock_range().  Threads that work on
+ * disjoint ranges do not wait for each other, while a whole-space locker
+ * waits for all ranges to be released and keeps new ones from being
+ * taken until it is done.  A thread holds at most one range, which it may
+ * lock again recursively as long as the nested request lies within it.
+ *
+ * Ranges are rounded to host pages, since the flags of all the target
+ * pages of a host page are looked at when changing its protection.
+ */
+typedef struct MmapLockRange {
+    target_ulong start;
+    target_ulong last;
+    QLIST_ENTRY(MmapLockRange) next;
+} MmapLockRange;
+
 static pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mmap_cond = PTHREAD_COND_INITIALIZER;
+static QLIST_HEAD(, MmapLockRange) mmap_ranges =
+    QLIST_HEAD_INITIALIZER(mmap_ranges);
+static int mmap_whole_waiting;
+static __thread MmapLockRange mmap_held;
 static __thread int mmap_lock_count;
 
+static bool mmap_range_busy(target_ulong start, target_ulong last)
+{
+    MmapLockRange *r;
+
+    QLIST_FOREACH(r, &mmap_ranges, next) {
+        if (r->start <= last && start <= r->last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mmap_lock_1(target_ulong start, target_ulong last)
+{
+    bool whole = start == 0 && last == (target_ulong)-1;
+
+    if (mmap_lock_count++) {
+        assert(mmap_held.start <= start && last <= mmap_held.last);
+        return;
+    }
+
+    pthread_mutex_lock(&mmap_mutex);
+    if (whole) {
+        mmap_whole_waiting++;
+        while (!QLIST_EMPTY(&mmap_ranges)) {
+            pthread_cond_wait(&mmap_cond, &mmap_mutex);
+        }
+        mmap_whole_waiting--;
+    } else {
+        while (mmap_whole_waiting || mmap_range_busy(start, last)) {
+            pthread_cond_wait(&mmap_cond, &mmap_mutex);
+        }
+    }
+    mmap_held.start = start;
+    mmap_held.last = last;
+    QLIST_INSERT_HEAD(&mmap_ranges, &mmap_held, next);
+    pthread_mutex_unlock(&mmap_mutex);
+}
+
 void mmap_lock(void)
 {
-    if (mmap_lock_count++ == 0) {
-        pthread_mutex_lock(&mmap_mutex);
+    mmap_lock_1(0, -1);
+}
+
+void mmap_lock_range(target_ulong start, target_ulong len)
+{
+    target_ulong last = start + len - 1;
+
+    if (len == 0 || last < start) {
+        mmap_lock();
+        return;
     }
+    start &= qemu_host_page_mask;
+    last |= ~(target_ulong)qemu_host_page_mask;
+    mmap_lock_1(start, last);
+}
+
+/*
+ * Shrink the range held by this thread to [@start, @start + @len[, which
+ * is a no-op if it was locked more than once, since an outer caller may
+ * still rely on the larger range.
+ */
+static void mmap_lock_narrow(target_ulong start, target_ulong len)
+{
+    assert(mmap_lock_count > 0);
+    if (mmap_lock_count > 1) {
+        return;
+    }
+    pthread_mutex_lock(&mmap_mutex);
+    mmap_held.start = start & qemu_host_page_mask;
+    mmap_held.last = (start + len - 1) | ~(target_ulong)qemu_host_page_mask;
+    pthread_cond_broadcast(&mmap_cond);
+    pthread_mutex_unlock(&mmap_mutex);
 }
 
 void mmap_unlock(void)
 {
     if (--mmap_lock_count == 0) {
+        pthread_mutex_lock(&mmap_mutex);
+        QLIST_REMOVE(&mmap_held, next);
+        pthread_cond_broadcast(&mmap_cond);
         pthread_mutex_unlock(&mmap_mutex);
     }
 }
@@ -50,15 +143,21 @@ void mmap_fork_start(void)
 {
     if (mmap_lock_count)
         abort();
-    pthread_mutex_lock(&mmap_mutex);
+    mmap_lock();
 }
 
 void mmap_fork_end(int child)
 {
-    if (child)
+    if (child) {
+        /* Only this thread survives, and it holds the whole space */
         pthread_mutex_init(&mmap_mutex, NULL);
-    else
-        pthread_mutex_unlock(&mmap_mutex);
+        pthread_cond_init(&mmap_cond, NULL);
+        QLIST_INIT(&mmap_ranges);
+        mmap_whole_waiting = 0;
+        mmap_lock_count = 0;
+    } else {
+        mmap_unlock();
+    }
 }
 
 /* NOTE: all the constants are the HOST ones, but addresses are target. */
@@ -86,7 +185,7 @@ int target_mprotect(abi_ulong start, abi_ulong len, int prot)
     if (len == 0)
         return 0;
 
-    mmap_lock();
+    mmap_lock_range(start, len);
     host_start = start & qemu_host_page_mask;
     host_end = HOST_PAGE_ALIGN(end);
     if (start > host_start) {
@@ -363,7 +462,12 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
 {
     abi_ulong ret, end, real_start, real_end, retaddr, host_offset, host_len;
 
-    mmap_lock();
+    /* Only the placement of a non-fixed mapping looks outside the range */
+    if (flags & MAP_FIXED) {
+        mmap_lock_range(start, len);
+    } else {
+        mmap_lock();
+    }
 #ifdef DEBUG_MMAP
     {
         printf("mmap: start=0x" TARGET_ABI_FMT_lx
@@ -421,6 +525,10 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             errno = ENOMEM;
             goto fail;
         }
+        /* The host now keeps the area for us, unless we track it ourselves */
+        if (!reserved_va) {
+            mmap_lock_narrow(start, host_len);
+        }
     }
 
     /* When mapping files into a memory area larger than the file, accesses
@@ -635,7 +743,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
         return -TARGET_EINVAL;
     }
 
-    mmap_lock();
+    mmap_lock_range(start, len);
     end = start + len;
     real_start = start & qemu_host_page_mask;
     real_end = HOST_PAGE_ALIGN(end);
@@ -27,6 +27,7 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "exec/cputlb.h"
 #include "sysemu/kvm.h"
 #include "sysemu/sysemu.h"
 #include "hw/qdev-properties.h"
@@ -37,7 +38,7 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
-static bool global_dirty_log = false;
+bool global_dirty_log = false;
 
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
@@ -248,10 +249,12 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
 
 static FlatView *flatview_new(MemoryRegion *mr_root)
 {
+    static uint64_t flatview_gen;
     FlatView *view;
 
     view = g_new0(FlatView, 1);
     view->ref = 1;
+    view->gen = ++flatview_gen;
     view->root = mr_root;
     memory_region_ref(mr_root);
     trace_flatview_new(view, mr_root);
@@ -2539,6 +2542,9 @@ bool memory_region_present(MemoryRegion *container, hwaddr addr)
 void memory_global_dirty_log_sync(void)
 {
     memory_region_sync_dirty_bitmap(NULL);
+    if (tcg_enabled()) {
+        tlb_dirty_log_sync();
+    }
 }
 
 static VMChangeStateEntry *vmstate_change;
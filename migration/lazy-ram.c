@@ -0,0 +1,617 @@
+/*
+ * Lazy loading of RAM from a migration file
+ *
+ * When the incoming stream is a seekable file, RAM pages do not need to
+ * be copied into guest memory before the VM starts: only their position
+ * in the file is recorded while the stream is parsed.  Once the RAM
+ * sections are loaded, and before the device state is, guest RAM is
+ * registered with userfaultfd; pages are read from the file when first
+ * touched, while a background thread reads the remaining ones in file
+ * order.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu_queue.h"
+#include "qapi/error.h"
+#include "exec/ram_addr.h"
+#include "sysemu/balloon.h"
+#include "migration/blocker.h"
+#include "migration.h"
+#include "lazy-ram.h"
+#include "trace.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
+#include <sys/eventfd.h>
+#include <linux/userfaultfd.h>
+#define LAZY_RAM_SUPPORTED
+#endif
+
+/*
+ * Values of RAMBlock::lazy_offsets.  Page data always comes after the
+ * stream header, so file offsets cannot be confused with these.
+ */
+#define LAZY_RAM_NONE 0
+#define LAZY_RAM_ZERO 1
+
+/* Largest read done at once when pages are not faulted in one by one */
+#define LAZY_RAM_FILL_PAGES ((1 << 20) / TARGET_PAGE_SIZE)
+
+static struct {
+    /* Pages can be deferred by the current load */
+    bool active;
+    /* Our own copy of the incoming file descriptor */
+    int fd;
+    /* Position in fd of the start of the QEMUFile */
+    int64_t base;
+    int userfault_fd;
+    int quit_fd;
+    QemuThread fault_thread;
+    QemuThread fill_thread;
+    /* Registered blocks, referenced until they are completely loaded */
+    RAMBlock **blocks;
+    int nb_blocks;
+    QEMUBH *done_bh;
+    Error *blocker;
+} lazy_ram = {
+    .fd = -1,
+    .userfault_fd = -1,
+    .quit_fd = -1,
+};
+
+#define RAMBLOCK_FOREACH_LAZY(block)                   \
+    INTERNAL_RAMBLOCK_FOREACH(block)                   \
+        if (!(block)->lazy_offsets) {} else
+
+static inline uint64_t *lazy_ram_record(RAMBlock *rb, ram_addr_t offset)
+{
+    return &rb->lazy_offsets[offset >> TARGET_PAGE_BITS];
+}
+
+bool lazy_ram_defer_zero(RAMBlock *rb, ram_addr_t offset)
+{
+    if (!rb->lazy_offsets) {
+        return false;
+    }
+    *lazy_ram_record(rb, offset) = LAZY_RAM_ZERO;
+    return true;
+}
+
+bool lazy_ram_defer_at(RAMBlock *rb, ram_addr_t offset, int64_t pos)
+{
+    if (!rb->lazy_offsets) {
+        return false;
+    }
+    *lazy_ram_record(rb, offset) = lazy_ram.base + pos;
+    return true;
+}
+
+bool lazy_ram_defer_page(RAMBlock *rb, ram_addr_t offset, QEMUFile *f)
+{
+    int64_t pos;
+
+    if (!rb->lazy_offsets) {
+        return false;
+    }
+    pos = qemu_file_read_pos(f);
+    /* A short skip leaves an error on f, which the caller checks */
+    if (qemu_skip_buffer(f, TARGET_PAGE_SIZE) == TARGET_PAGE_SIZE) {
+        lazy_ram_defer_at(rb, offset, pos);
+    }
+    return true;
+}
+
+void lazy_ram_forget_page(RAMBlock *rb, ram_addr_t offset)
+{
+    if (rb->lazy_offsets) {
+        *lazy_ram_record(rb, offset) = LAZY_RAM_NONE;
+    }
+}
+
+int lazy_ram_load_page(RAMBlock *rb, ram_addr_t offset, void *host)
+{
+    uint64_t rec;
+
+    if (!rb->lazy_offsets) {
+        return 0;
+    }
+    rec = *lazy_ram_record(rb, offset);
+    *lazy_ram_record(rb, offset) = LAZY_RAM_NONE;
+    if (rec == LAZY_RAM_ZERO) {
+        memset(host, 0, TARGET_PAGE_SIZE);
+    } else if (rec != LAZY_RAM_NONE &&
+               pread(lazy_ram.fd, host, TARGET_PAGE_SIZE, rec) !=
+               TARGET_PAGE_SIZE) {
+        error_report("%s: cannot read page at %" PRIu64 ": %s",
+                     __func__, rec, strerror(errno));
+        return -EIO;
+    }
+    return 0;
+}
+
+#ifdef LAZY_RAM_SUPPORTED
+
+/*
+ * Length of the run of data pages starting at page @i of @rb that are
+ * contiguous in the file, at most @max pages.
+ */
+static size_t lazy_ram_run(RAMBlock *rb, size_t i, size_t pages, size_t max)
+{
+    uint64_t start = rb->lazy_offsets[i];
+    size_t n = 1;
+
+    while (n < max && i + n < pages &&
+           rb->lazy_offsets[i + n] == start + n * TARGET_PAGE_SIZE) {
+        n++;
+    }
+    return n;
+}
+
+/* Load every deferred page of @rb without userfaultfd */
+static int lazy_ram_fill_block(RAMBlock *rb)
+{
+    size_t pages = rb->used_length >> TARGET_PAGE_BITS;
+    size_t i, n;
+
+    for (i = 0; i < pages; i += n) {
+        uint64_t rec = rb->lazy_offsets[i];
+        void *host = rb->host + (i << TARGET_PAGE_BITS);
+        ssize_t len;
+
+        n = 1;
+        if (rec == LAZY_RAM_ZERO) {
+            memset(host, 0, TARGET_PAGE_SIZE);
+        } else if (rec != LAZY_RAM_NONE) {
+            n = lazy_ram_run(rb, i, pages, LAZY_RAM_FILL_PAGES);
+            len = n * TARGET_PAGE_SIZE;
+            if (pread(lazy_ram.fd, host, len, rec) != len) {
+                error_report("%s: cannot read %s: %s", __func__,
+                             rb->idstr, strerror(errno));
+                return -EIO;
+            }
+        }
+    }
+    g_free(rb->lazy_offsets);
+    rb->lazy_offsets = NULL;
+    return 0;
+}
+
+static void lazy_ram_cleanup(void)
+{
+    RAMBlock *rb;
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_LAZY(rb) {
+        g_free(rb->lazy_offsets);
+        rb->lazy_offsets = NULL;
+    }
+    rcu_read_unlock();
+    if (lazy_ram.fd >= 0) {
+        close(lazy_ram.fd);
+        lazy_ram.fd = -1;
+    }
+    lazy_ram.active = false;
+}
+
+void lazy_ram_incoming_init(QEMUFile *f)
+{
+    RAMBlock *rb;
+    off_t pos;
+    int fd;
+
+    lazy_ram_cleanup();
+    if (!migrate_lazy_ram()) {
+        return;
+    }
+
+    fd = qemu_get_fd(f);
+    pos = fd < 0 ? -1 : lseek(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        warn_report("x-lazy-ram needs a file: migration, loading RAM now");
+        return;
+    }
+    lazy_ram.fd = dup(fd);
+    if (lazy_ram.fd < 0) {
+        return;
+    }
+    lazy_ram.base = pos - qemu_ftell(f);
+
+    rcu_read_lock();
+    INTERNAL_RAMBLOCK_FOREACH(rb) {
+        /* Pages must be mapped by userfaultfd one target page at a time */
+        if (!qemu_ram_is_migratable(rb) || ramblock_is_pmem(rb) ||
+            rb->page_size != TARGET_PAGE_SIZE) {
+            continue;
+        }
+        rb->lazy_offsets = g_new0(uint64_t, rb->max_length >> TARGET_PAGE_BITS);
+    }
+    rcu_read_unlock();
+    lazy_ram.active = true;
+}
+
+/* Map @src at @host, or a zero page if @src is NULL */
+static int lazy_ram_place(void *host, void *src)
+{
+    int ret;
+
+    if (src) {
+        struct uffdio_copy copy_struct;
+
+        copy_struct.dst = (uint64_t)(uintptr_t)host;
+        copy_struct.src = (uint64_t)(uintptr_t)src;
+        copy_struct.len = TARGET_PAGE_SIZE;
+        copy_struct.mode = 0;
+        ret = ioctl(lazy_ram.userfault_fd, UFFDIO_COPY, &copy_struct);
+    } else {
+        struct uffdio_zeropage zero_struct;
+
+        zero_struct.range.start = (uint64_t)(uintptr_t)host;
+        zero_struct.range.len = TARGET_PAGE_SIZE;
+        zero_struct.mode = 0;
+        ret = ioctl(lazy_ram.userfault_fd, UFFDIO_ZEROPAGE, &zero_struct);
+    }
+    /* The other thread may have won the race for this page */
+    if (ret && errno != EEXIST) {
+        error_report("%s: cannot map page at %p: %s",
+                     __func__, host, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+/*
+ * A page could not be loaded.  The vCPU or device that touches it would
+ * wait forever, so give up on the VM instead.
+ */
+static void QEMU_NORETURN lazy_ram_fail(void)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+
+    migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_FAILED);
+    error_report("lazy-ram: guest RAM cannot be loaded from the migration "
+                 "file, exiting");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Records are left alone while the threads run, so both may try to map
+ * a page but they always agree on its content.
+ */
+static void *lazy_ram_fault_thread(void *opaque)
+{
+    struct pollfd pfd[2];
+    void *buf = qemu_memalign(TARGET_PAGE_SIZE, TARGET_PAGE_SIZE);
+
+    rcu_register_thread();
+    pfd[0].fd = lazy_ram.userfault_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = lazy_ram.quit_fd;
+    pfd[1].events = POLLIN;
+
+    while (true) {
+        struct uffd_msg msg;
+        ram_addr_t offset;
+        RAMBlock *rb;
+        uint64_t rec;
+        void *host;
+        int ret;
+
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: userfault poll: %s", __func__, strerror(errno));
+            lazy_ram_fail();
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+        if (!pfd[0].revents) {
+            continue;
+        }
+
+        ret = read(lazy_ram.userfault_fd, &msg, sizeof(msg));
+        if (ret != sizeof(msg)) {
+            if (ret < 0 && errno == EAGAIN) {
+                continue;
+            }
+            error_report("%s: cannot read userfault message: %s",
+                         __func__, ret < 0 ? strerror(errno) : "short read");
+            lazy_ram_fail();
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        host = (void *)(uintptr_t)(msg.arg.pagefault.address &
+                                   TARGET_PAGE_MASK);
+        rcu_read_lock();
+        rb = qemu_ram_block_from_host(host, true, &offset);
+        if (!rb || !rb->lazy_offsets) {
+            rcu_read_unlock();
+            error_report("%s: fault outside lazy RAM: %p", __func__, host);
+            lazy_ram_fail();
+        }
+        trace_lazy_ram_fault(rb->idstr, offset);
+        rec = *lazy_ram_record(rb, offset);
+        if (rec == LAZY_RAM_NONE || rec == LAZY_RAM_ZERO) {
+            ret = lazy_ram_place(host, NULL);
+        } else if (pread(lazy_ram.fd, buf, TARGET_PAGE_SIZE, rec) !=
+                   TARGET_PAGE_SIZE) {
+            error_report("%s: cannot read page at %" PRIu64 ": %s",
+                         __func__, rec, strerror(errno));
+            ret = -EIO;
+        } else {
+            ret = lazy_ram_place(host, buf);
+        }
+        rcu_read_unlock();
+        if (ret) {
+            lazy_ram_fail();
+        }
+    }
+
+    rcu_unregister_thread();
+    qemu_vfree(buf);
+    return NULL;
+}
+
+static void lazy_ram_release_blocks(void)
+{
+    int i;
+
+    for (i = 0; i < lazy_ram.nb_blocks; i++) {
+        memory_region_unref(lazy_ram.blocks[i]->mr);
+    }
+    g_free(lazy_ram.blocks);
+    lazy_ram.blocks = NULL;
+    lazy_ram.nb_blocks = 0;
+}
+
+static void lazy_ram_done_bh(void *opaque)
+{
+    qemu_bh_delete(lazy_ram.done_bh);
+    lazy_ram.done_bh = NULL;
+    qemu_thread_join(&lazy_ram.fill_thread);
+
+    close(lazy_ram.userfault_fd);
+    close(lazy_ram.quit_fd);
+    lazy_ram.userfault_fd = -1;
+    lazy_ram.quit_fd = -1;
+    lazy_ram_cleanup();
+    lazy_ram_release_blocks();
+
+    migrate_del_blocker(lazy_ram.blocker);
+    error_free(lazy_ram.blocker);
+    lazy_ram.blocker = NULL;
+    qemu_balloon_inhibit(false);
+    trace_lazy_ram_done();
+}
+
+/*
+ * Read the data pages in file order, then give memory back to the
+ * kernel.  Zero pages are left to the fault thread.  The blocks are
+ * referenced, so no RCU read lock is held across the whole fill.
+ */
+static void *lazy_ram_fill_thread(void *opaque)
+{
+    uint8_t *buf = qemu_memalign(TARGET_PAGE_SIZE,
+                                 LAZY_RAM_FILL_PAGES * TARGET_PAGE_SIZE);
+    uint64_t one = 1;
+    int b;
+
+    for (b = 0; b < lazy_ram.nb_blocks; b++) {
+        RAMBlock *rb = lazy_ram.blocks[b];
+        size_t pages = rb->used_length >> TARGET_PAGE_BITS;
+        size_t i, j, n;
+
+        for (i = 0; i < pages; i += n) {
+            uint64_t rec = rb->lazy_offsets[i];
+            ssize_t len;
+
+            n = 1;
+            if (rec == LAZY_RAM_NONE || rec == LAZY_RAM_ZERO) {
+                continue;
+            }
+            n = lazy_ram_run(rb, i, pages, LAZY_RAM_FILL_PAGES);
+            len = n * TARGET_PAGE_SIZE;
+            if (pread(lazy_ram.fd, buf, len, rec) != len) {
+                error_report("%s: cannot read %s: %s", __func__,
+                             rb->idstr, strerror(errno));
+                lazy_ram_fail();
+            }
+            for (j = 0; j < n; j++) {
+                if (lazy_ram_place(rb->host + ((i + j) << TARGET_PAGE_BITS),
+                                   buf + j * TARGET_PAGE_SIZE)) {
+                    lazy_ram_fail();
+                }
+            }
+        }
+    }
+
+    /*
+     * Every data page is in memory.  Stop the fault thread first so
+     * that a fault racing with the unregistration is retried by the
+     * kernel, which then maps a zero page itself.
+     */
+    if (write(lazy_ram.quit_fd, &one, sizeof(one)) != sizeof(one)) {
+        error_report("%s: cannot stop the fault thread", __func__);
+        lazy_ram_fail();
+    }
+    qemu_thread_join(&lazy_ram.fault_thread);
+    for (b = 0; b < lazy_ram.nb_blocks; b++) {
+        RAMBlock *rb = lazy_ram.blocks[b];
+        struct uffdio_range range_struct;
+
+        range_struct.start = (uint64_t)(uintptr_t)rb->host;
+        range_struct.len = rb->used_length;
+        if (ioctl(lazy_ram.userfault_fd, UFFDIO_UNREGISTER, &range_struct)) {
+            error_report("%s: userfault unregister %s: %s", __func__,
+                         rb->idstr, strerror(errno));
+        }
+    }
+    qemu_bh_schedule(lazy_ram.done_bh);
+
+    qemu_vfree(buf);
+    return NULL;
+}
+
+/* Register @rb with the userfaultfd, after dropping deferred pages */
+static bool lazy_ram_register(RAMBlock *rb)
+{
+    size_t pages = rb->used_length >> TARGET_PAGE_BITS;
+    struct uffdio_register reg_struct;
+    size_t i, n;
+
+    for (i = 0; i < pages; i += n) {
+        for (n = 0; i + n < pages && rb->lazy_offsets[i + n]; n++) {
+            /* nothing */
+        }
+        if (n && ram_block_discard_range(rb, i << TARGET_PAGE_BITS,
+                                         n << TARGET_PAGE_BITS)) {
+            return false;
+        }
+        n++;
+    }
+
+    reg_struct.range.start = (uint64_t)(uintptr_t)rb->host;
+    reg_struct.range.len = rb->used_length;
+    reg_struct.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (ioctl(lazy_ram.userfault_fd, UFFDIO_REGISTER, &reg_struct)) {
+        return false;
+    }
+    if ((reg_struct.ioctls & (1ULL << _UFFDIO_COPY)) == 0 ||
+        (reg_struct.ioctls & (1ULL << _UFFDIO_ZEROPAGE)) == 0) {
+        ioctl(lazy_ram.userfault_fd, UFFDIO_UNREGISTER, &reg_struct.range);
+        return false;
+    }
+    return true;
+}
+
+static bool lazy_ram_userfault_init(void)
+{
+    struct uffdio_api api_struct;
+    Error *local_err = NULL;
+
+    error_setg(&lazy_ram.blocker, "RAM is still being loaded from "
+               "the incoming migration file");
+    if (migrate_add_blocker(lazy_ram.blocker, &local_err) < 0) {
+        error_report_err(local_err);
+        error_free(lazy_ram.blocker);
+        lazy_ram.blocker = NULL;
+        return false;
+    }
+
+    lazy_ram.userfault_fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (lazy_ram.userfault_fd == -1) {
+        goto fail;
+    }
+    api_struct.api = UFFD_API;
+    api_struct.features = 0;
+    if (ioctl(lazy_ram.userfault_fd, UFFDIO_API, &api_struct)) {
+        goto fail;
+    }
+    lazy_ram.quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (lazy_ram.quit_fd == -1) {
+        goto fail;
+    }
+    return true;
+
+fail:
+    if (lazy_ram.userfault_fd != -1) {
+        close(lazy_ram.userfault_fd);
+        lazy_ram.userfault_fd = -1;
+    }
+    migrate_del_blocker(lazy_ram.blocker);
+    error_free(lazy_ram.blocker);
+    lazy_ram.blocker = NULL;
+    return false;
+}
+
+int lazy_ram_incoming_start(void)
+{
+    bool userfault;
+    uint64_t pages = 0;
+    RAMBlock *rb;
+    int ret = 0;
+
+    if (!lazy_ram.active) {
+        return 0;
+    }
+    lazy_ram.active = false;
+
+    /* Without userfaultfd, fall back to loading everything now */
+    userfault = lazy_ram_userfault_init();
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_LAZY(rb) {
+        if (!userfault || !lazy_ram_register(rb)) {
+            ret = lazy_ram_fill_block(rb);
+            if (ret) {
+                break;
+            }
+            continue;
+        }
+        pages += rb->used_length >> TARGET_PAGE_BITS;
+        memory_region_ref(rb->mr);
+        lazy_ram.blocks = g_renew(RAMBlock *, lazy_ram.blocks,
+                                  lazy_ram.nb_blocks + 1);
+        lazy_ram.blocks[lazy_ram.nb_blocks++] = rb;
+    }
+    rcu_read_unlock();
+
+    if (ret || !pages) {
+        if (userfault) {
+            close(lazy_ram.userfault_fd);
+            close(lazy_ram.quit_fd);
+            lazy_ram.userfault_fd = -1;
+            lazy_ram.quit_fd = -1;
+            migrate_del_blocker(lazy_ram.blocker);
+            error_free(lazy_ram.blocker);
+            lazy_ram.blocker = NULL;
+        }
+        rcu_read_lock();
+        lazy_ram_cleanup();
+        rcu_read_unlock();
+        lazy_ram_release_blocks();
+        return ret;
+    }
+
+    trace_lazy_ram_start(pages);
+    /* A balloon discard would make the next access read stale data */
+    qemu_balloon_inhibit(true);
+    lazy_ram.done_bh = qemu_bh_new(lazy_ram_done_bh, NULL);
+    qemu_thread_create(&lazy_ram.fault_thread, "lazy-ram/fault",
+                       lazy_ram_fault_thread, NULL, QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&lazy_ram.fill_thread, "lazy-ram/fill",
+                       lazy_ram_fill_thread, NULL, QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
+#else /* !LAZY_RAM_SUPPORTED */
+
+void lazy_ram_incoming_init(QEMUFile *f)
+{
+    if (migrate_lazy_ram()) {
+        warn_report("x-lazy-ram is not supported on this host, "
+                    "loading RAM now");
+    }
+}
+
+int lazy_ram_incoming_start(void)
+{
+    return 0;
+}
+
+#endif /* !LAZY_RAM_SUPPORTED */
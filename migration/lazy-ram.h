@@ -0,0 +1,44 @@
+/*
+ * Lazy loading of RAM from a migration file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_LAZY_RAM_H
+#define QEMU_MIGRATION_LAZY_RAM_H
+
+#include "exec/cpu-common.h"
+#include "qemu-file.h"
+
+/*
+ * Called when RAM loading starts.  If the x-lazy-ram capability is set
+ * and @f reads from a seekable file, following pages can be deferred.
+ */
+void lazy_ram_incoming_init(QEMUFile *f);
+
+/*
+ * Record that the page at @offset of @rb is a zero page (resp. is
+ * stored at the current position of @f, which is then skipped) instead
+ * of loading it.  Return false if the page must be loaded now.
+ */
+bool lazy_ram_defer_zero(RAMBlock *rb, ram_addr_t offset);
+bool lazy_ram_defer_page(RAMBlock *rb, ram_addr_t offset, QEMUFile *f);
+/* Same, for a page stored at position @pos of the stream */
+bool lazy_ram_defer_at(RAMBlock *rb, ram_addr_t offset, int64_t pos);
+
+/* A newer copy of the page is about to be loaded in full */
+void lazy_ram_forget_page(RAMBlock *rb, ram_addr_t offset);
+
+/* Load the deferred page into @host, before it is patched in place */
+int lazy_ram_load_page(RAMBlock *rb, ram_addr_t offset, void *host);
+
+/*
+ * Called once RAM is loaded, before the device state is, since device
+ * loaders may read guest memory.  Deferred pages are then read from the
+ * file when first touched or in the background.  Does nothing if pages
+ * are already being served.
+ */
+int lazy_ram_incoming_start(void);
+
+#endif
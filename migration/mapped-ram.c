@@ -0,0 +1,469 @@
+/*
+ * Fixed-offset layout of RAM in a migration file
+ *
+ * With the x-mapped-ram capability, each RAMBlock owns a region of the
+ * migration file, reserved right after its entry in the setup section.
+ * The region holds a bitmap of the pages that have data, then one slot
+ * per target page.  Pages are written to their slot by a pool of
+ * threads, so a page that is dirtied again overwrites its slot instead
+ * of growing the file, and loading reads each page once, in parallel.
+ *
+ * After the name and length of a block, the setup section holds:
+ *
+ *   be64 target page size
+ *   be64 stream offset of the bitmap, stored as little-endian 64-bit words
+ *   be64 stream offset of the pages, aligned to MAPPED_RAM_ALIGN
+ *
+ * and the stream goes on after the last page of the block.  Offsets count
+ * from the start of the stream, which need not be the start of the file:
+ * a management tool may have written a header before it.
+ *
+ * Streams without a file descriptor, such as the one savevm writes into
+ * an image, cannot be laid out this way.  The page size is then written
+ * as zero alone, and pages are sent in the stream as usual.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/rcu_queue.h"
+#include "exec/ram_addr.h"
+#include "migration.h"
+#include "ram.h"
+#include "lazy-ram.h"
+#include "mapped-ram.h"
+#include "trace.h"
+
+/* Alignment of the pages of each block in the file */
+#define MAPPED_RAM_ALIGN (1 << 20)
+
+/* Most pages handed to a thread at once */
+#define MAPPED_RAM_SAVE_PAGES ((1 << 20) / TARGET_PAGE_SIZE)
+#define MAPPED_RAM_LOAD_PAGES ((64 << 20) / TARGET_PAGE_SIZE)
+
+struct MappedRAMParam {
+    bool done;
+    bool quit;
+    QemuMutex mutex;
+    QemuCond cond;
+    /* pages [start, start + npages) of block, read if load is set */
+    RAMBlock *block;
+    uint64_t start;
+    uint64_t npages;
+    bool load;
+};
+typedef struct MappedRAMParam MappedRAMParam;
+
+static struct {
+    int fd;
+    /* file offset of the start of the stream */
+    int64_t base;
+    int thread_count;
+    QemuThread *threads;
+    MappedRAMParam *params;
+    QemuMutex done_lock;
+    QemuCond done_cond;
+    /* first error of the threads, protected by done_lock */
+    int error;
+    /* run of data pages not yet handed to a thread */
+    RAMBlock *run_block;
+    uint64_t run_start;
+    uint64_t run_pages;
+} mapped_ram = {
+    .fd = -1,
+};
+
+#define RAMBLOCK_FOREACH_MAPPED(block)                 \
+    INTERNAL_RAMBLOCK_FOREACH(block)                   \
+        if (!(block)->file_bmap) {} else
+
+static size_t mapped_ram_bmap_size(uint64_t pages)
+{
+    return DIV_ROUND_UP(pages, 64) * sizeof(uint64_t);
+}
+
+static unsigned long *mapped_ram_bmap_new(uint64_t pages)
+{
+    /* Whole 64-bit words, so that the file layout is the same everywhere */
+    return bitmap_new(ROUND_UP(pages, 64));
+}
+
+static int mapped_ram_write(RAMBlock *rb, uint64_t start, uint64_t npages)
+{
+    size_t len = npages << TARGET_PAGE_BITS;
+    off_t pos = mapped_ram.base + rb->file_pages_offset +
+                (start << TARGET_PAGE_BITS);
+
+    if (pwrite(mapped_ram.fd, rb->host + (start << TARGET_PAGE_BITS),
+               len, pos) != len) {
+        error_report("%s: cannot write %s: %s", __func__, rb->idstr,
+                     strerror(errno));
+        return -EIO;
+    }
+    return 0;
+}
+
+static int mapped_ram_read(RAMBlock *rb, uint64_t start, uint64_t npages)
+{
+    uint64_t end = start + npages;
+    uint64_t i, next;
+
+    for (i = start; i < end; i = next) {
+        void *host = rb->host + (i << TARGET_PAGE_BITS);
+        size_t len;
+
+        if (!test_bit(i, rb->file_bmap)) {
+            /* Not written by the source, so the page is zero */
+            next = i + 1;
+            ram_handle_compressed(host, 0, TARGET_PAGE_SIZE);
+            continue;
+        }
+        next = find_next_zero_bit(rb->file_bmap, end, i);
+        len = (next - i) << TARGET_PAGE_BITS;
+        if (pread(mapped_ram.fd, host, len, mapped_ram.base +
+                  rb->file_pages_offset + (i << TARGET_PAGE_BITS)) != len) {
+            error_report("%s: cannot read %s: %s", __func__, rb->idstr,
+                         strerror(errno));
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+static void *mapped_ram_thread(void *opaque)
+{
+    MappedRAMParam *param = opaque;
+    RAMBlock *block;
+    int ret;
+
+    qemu_mutex_lock(&param->mutex);
+    while (!param->quit) {
+        if (param->block) {
+            block = param->block;
+            param->block = NULL;
+            qemu_mutex_unlock(&param->mutex);
+
+            if (param->load) {
+                ret = mapped_ram_read(block, param->start, param->npages);
+            } else {
+                ret = mapped_ram_write(block, param->start, param->npages);
+            }
+
+            qemu_mutex_lock(&mapped_ram.done_lock);
+            param->done = true;
+            if (ret && !mapped_ram.error) {
+                mapped_ram.error = ret;
+            }
+            qemu_cond_signal(&mapped_ram.done_cond);
+            qemu_mutex_unlock(&mapped_ram.done_lock);
+
+            qemu_mutex_lock(&param->mutex);
+        } else {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+    }
+    qemu_mutex_unlock(&param->mutex);
+
+    return NULL;
+}
+
+static int mapped_ram_threads_setup(QEMUFile *f)
+{
+    int64_t pos;
+    int i, fd;
+
+    fd = qemu_get_fd(f);
+    if (fd < 0) {
+        /* Use the usual layout, see the top of the file */
+        return 0;
+    }
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        error_report("x-mapped-ram needs a seekable file: %s",
+                     strerror(errno));
+        return -1;
+    }
+    mapped_ram.fd = fd;
+    mapped_ram.base = pos - qemu_ftell(f);
+    mapped_ram.error = 0;
+    mapped_ram.run_block = NULL;
+    mapped_ram.thread_count = migrate_multifd_channels();
+    mapped_ram.threads = g_new0(QemuThread, mapped_ram.thread_count);
+    mapped_ram.params = g_new0(MappedRAMParam, mapped_ram.thread_count);
+    qemu_mutex_init(&mapped_ram.done_lock);
+    qemu_cond_init(&mapped_ram.done_cond);
+    for (i = 0; i < mapped_ram.thread_count; i++) {
+        mapped_ram.params[i].done = true;
+        qemu_mutex_init(&mapped_ram.params[i].mutex);
+        qemu_cond_init(&mapped_ram.params[i].cond);
+        qemu_thread_create(mapped_ram.threads + i, "mapped-ram",
+                           mapped_ram_thread, mapped_ram.params + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+    return 0;
+}
+
+static void mapped_ram_threads_cleanup(void)
+{
+    int i;
+
+    if (!mapped_ram.threads) {
+        return;
+    }
+    for (i = 0; i < mapped_ram.thread_count; i++) {
+        qemu_mutex_lock(&mapped_ram.params[i].mutex);
+        mapped_ram.params[i].quit = true;
+        qemu_cond_signal(&mapped_ram.params[i].cond);
+        qemu_mutex_unlock(&mapped_ram.params[i].mutex);
+
+        qemu_thread_join(mapped_ram.threads + i);
+        qemu_mutex_destroy(&mapped_ram.params[i].mutex);
+        qemu_cond_destroy(&mapped_ram.params[i].cond);
+    }
+    qemu_mutex_destroy(&mapped_ram.done_lock);
+    qemu_cond_destroy(&mapped_ram.done_cond);
+    g_free(mapped_ram.threads);
+    g_free(mapped_ram.params);
+    mapped_ram.threads = NULL;
+    mapped_ram.params = NULL;
+    mapped_ram.fd = -1;
+}
+
+/* Hand pages to the first idle thread, waiting for one if needed */
+static void mapped_ram_dispatch(RAMBlock *rb, uint64_t start,
+                                uint64_t npages, bool load)
+{
+    int idx;
+
+    qemu_mutex_lock(&mapped_ram.done_lock);
+    while (true) {
+        for (idx = 0; idx < mapped_ram.thread_count; idx++) {
+            MappedRAMParam *param = &mapped_ram.params[idx];
+
+            if (param->done) {
+                param->done = false;
+                qemu_mutex_lock(&param->mutex);
+                param->block = rb;
+                param->start = start;
+                param->npages = npages;
+                param->load = load;
+                qemu_cond_signal(&param->cond);
+                qemu_mutex_unlock(&param->mutex);
+                qemu_mutex_unlock(&mapped_ram.done_lock);
+                return;
+            }
+        }
+        qemu_cond_wait(&mapped_ram.done_cond, &mapped_ram.done_lock);
+    }
+}
+
+/* Wait for all threads to be idle and return their first error */
+static int mapped_ram_wait(void)
+{
+    int idx, ret;
+
+    qemu_mutex_lock(&mapped_ram.done_lock);
+    for (idx = 0; idx < mapped_ram.thread_count; idx++) {
+        while (!mapped_ram.params[idx].done) {
+            qemu_cond_wait(&mapped_ram.done_cond, &mapped_ram.done_lock);
+        }
+    }
+    ret = mapped_ram.error;
+    qemu_mutex_unlock(&mapped_ram.done_lock);
+    return ret;
+}
+
+bool mapped_ram_active(void)
+{
+    return mapped_ram.threads != NULL;
+}
+
+int mapped_ram_save_setup(QEMUFile *f)
+{
+    return mapped_ram_threads_setup(f);
+}
+
+void mapped_ram_save_cleanup(void)
+{
+    RAMBlock *rb;
+
+    mapped_ram_threads_cleanup();
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_MAPPED(rb) {
+        g_free(rb->file_bmap);
+        rb->file_bmap = NULL;
+    }
+    rcu_read_unlock();
+}
+
+void mapped_ram_save_block(QEMUFile *f, RAMBlock *rb)
+{
+    uint64_t pages = rb->used_length >> TARGET_PAGE_BITS;
+
+    if (!mapped_ram_active()) {
+        qemu_put_be64(f, 0);
+        return;
+    }
+
+    /* The bitmap follows the three fields below */
+    rb->file_bmap_offset = qemu_ftell(f) + 3 * sizeof(uint64_t);
+    rb->file_pages_offset = ROUND_UP(rb->file_bmap_offset +
+                                     mapped_ram_bmap_size(pages),
+                                     MAPPED_RAM_ALIGN);
+    rb->file_bmap = mapped_ram_bmap_new(pages);
+
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, rb->file_bmap_offset);
+    qemu_put_be64(f, rb->file_pages_offset);
+    qemu_file_seek(f, rb->file_pages_offset + rb->used_length);
+    trace_mapped_ram_save_block(rb->idstr, rb->file_bmap_offset,
+                                rb->file_pages_offset);
+}
+
+static void mapped_ram_save_run(void)
+{
+    if (mapped_ram.run_block) {
+        mapped_ram_dispatch(mapped_ram.run_block, mapped_ram.run_start,
+                            mapped_ram.run_pages, false);
+        mapped_ram.run_block = NULL;
+    }
+}
+
+void mapped_ram_save_page(RAMBlock *rb, ram_addr_t offset, bool zero)
+{
+    uint64_t page = offset >> TARGET_PAGE_BITS;
+
+    if (zero) {
+        /* An older copy may be in the file; the bitmap hides it */
+        clear_bit(page, rb->file_bmap);
+        mapped_ram_save_run();
+        return;
+    }
+
+    set_bit(page, rb->file_bmap);
+    if (mapped_ram.run_block == rb &&
+        mapped_ram.run_start + mapped_ram.run_pages == page &&
+        mapped_ram.run_pages < MAPPED_RAM_SAVE_PAGES) {
+        mapped_ram.run_pages++;
+        return;
+    }
+    mapped_ram_save_run();
+    mapped_ram.run_block = rb;
+    mapped_ram.run_start = page;
+    mapped_ram.run_pages = 1;
+}
+
+int mapped_ram_save_flush(void)
+{
+    mapped_ram_save_run();
+    return mapped_ram_wait();
+}
+
+int mapped_ram_save_complete(void)
+{
+    RAMBlock *rb;
+    int ret;
+
+    ret = mapped_ram_save_flush();
+    if (ret) {
+        return ret;
+    }
+
+    RAMBLOCK_FOREACH_MAPPED(rb) {
+        uint64_t pages = rb->used_length >> TARGET_PAGE_BITS;
+        size_t size = mapped_ram_bmap_size(pages);
+        unsigned long *le_bmap = mapped_ram_bmap_new(pages);
+
+        bitmap_to_le(le_bmap, rb->file_bmap, pages);
+        if (pwrite(mapped_ram.fd, le_bmap, size,
+                   mapped_ram.base + rb->file_bmap_offset) != size) {
+            error_report("%s: cannot write the bitmap of %s: %s", __func__,
+                         rb->idstr, strerror(errno));
+            ret = -EIO;
+        }
+        g_free(le_bmap);
+        if (ret) {
+            break;
+        }
+    }
+    return ret;
+}
+
+int mapped_ram_load_setup(QEMUFile *f)
+{
+    return mapped_ram_threads_setup(f);
+}
+
+void mapped_ram_load_cleanup(void)
+{
+    mapped_ram_save_cleanup();
+}
+
+int mapped_ram_load_block(QEMUFile *f, RAMBlock *rb, ram_addr_t length)
+{
+    uint64_t pages = length >> TARGET_PAGE_BITS;
+    uint64_t page_size, i;
+    unsigned long *le_bmap;
+    size_t size = mapped_ram_bmap_size(pages);
+    int ret;
+
+    page_size = qemu_get_be64(f);
+    if (!page_size) {
+        /* The pages of the block follow in the stream */
+        return 0;
+    }
+    if (!mapped_ram_active()) {
+        error_report("Mapped RAM layout for %s needs a file: migration",
+                     rb->idstr);
+        return -EINVAL;
+    }
+    rb->file_bmap_offset = qemu_get_be64(f);
+    rb->file_pages_offset = qemu_get_be64(f);
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mapped RAM page size mismatch for %s: %" PRIu64
+                     " != %d", rb->idstr, page_size, TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+    trace_mapped_ram_load_block(rb->idstr, rb->file_bmap_offset,
+                                rb->file_pages_offset);
+
+    g_free(rb->file_bmap);
+    rb->file_bmap = mapped_ram_bmap_new(pages);
+    le_bmap = mapped_ram_bmap_new(pages);
+    if (pread(mapped_ram.fd, le_bmap, size,
+              mapped_ram.base + rb->file_bmap_offset) != size) {
+        error_report("%s: cannot read the bitmap of %s: %s", __func__,
+                     rb->idstr, strerror(errno));
+        g_free(le_bmap);
+        return -EIO;
+    }
+    bitmap_from_le(rb->file_bmap, le_bmap, pages);
+    g_free(le_bmap);
+
+    ret = qemu_file_seek(f, rb->file_pages_offset + length);
+    if (ret) {
+        return ret;
+    }
+
+    if (rb->lazy_offsets) {
+        for (i = 0; i < pages; i++) {
+            ram_addr_t offset = i << TARGET_PAGE_BITS;
+
+            if (test_bit(i, rb->file_bmap)) {
+                lazy_ram_defer_at(rb, offset, rb->file_pages_offset + offset);
+            } else {
+                lazy_ram_defer_zero(rb, offset);
+            }
+        }
+        return 0;
+    }
+
+    for (i = 0; i < pages; i += MAPPED_RAM_LOAD_PAGES) {
+        mapped_ram_dispatch(rb, i, MIN(pages - i, MAPPED_RAM_LOAD_PAGES), true);
+    }
+    return mapped_ram_wait();
+}
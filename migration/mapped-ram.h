@@ -0,0 +1,46 @@
+/*
+ * Fixed-offset layout of RAM in a migration file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_MAPPED_RAM_H
+#define QEMU_MIGRATION_MAPPED_RAM_H
+
+#include "exec/cpu-common.h"
+#include "qemu-file.h"
+
+/*
+ * Start the threads if @f is a file; otherwise RAM is saved or loaded in
+ * the usual layout.  Fails if @f is not seekable.
+ */
+int mapped_ram_save_setup(QEMUFile *f);
+void mapped_ram_save_cleanup(void);
+
+/* Describe @rb in the setup section and reserve its region of the file */
+void mapped_ram_save_block(QEMUFile *f, RAMBlock *rb);
+
+/* Write (or, if @zero, drop) the page at @offset of @rb */
+void mapped_ram_save_page(RAMBlock *rb, ram_addr_t offset, bool zero);
+
+/*
+ * Wait for the pages queued so far to be written.  Must be called before
+ * the dirty bitmap is synced again, so that an old copy of a page cannot
+ * land after a newer one.
+ */
+int mapped_ram_save_flush(void);
+
+/* Flush and write the bitmaps of pages present in the file */
+int mapped_ram_save_complete(void);
+
+/* Whether pages are saved or loaded at fixed offsets of the file */
+bool mapped_ram_active(void);
+
+int mapped_ram_load_setup(QEMUFile *f);
+void mapped_ram_load_cleanup(void);
+
+/* Read the entry of @rb in the setup section and load its pages */
+int mapped_ram_load_block(QEMUFile *f, RAMBlock *rb, ram_addr_t length);
+
+#endif
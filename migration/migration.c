@@ -19,6 +19,8 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
+#include "lazy-ram.h"
 #include "socket.h"
 #include "rdma.h"
 #include "ram.h"
@@ -80,6 +82,7 @@
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY (200 * 100)
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
 #define DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT 16
+#define DEFAULT_MIGRATE_LOAD_THREADS 0
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -331,6 +334,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -460,6 +465,11 @@ static void process_incoming_migration_co(void *opaque)
         colo_release_ram_cache();
     }
 
+    if (!ret) {
+        /* In case the stream had no device state after RAM */
+        ret = lazy_ram_incoming_start();
+    }
+
     if (ret < 0) {
         Error *local_err = NULL;
 
@@ -734,6 +744,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->max_postcopy_bandwidth = s->parameters.max_postcopy_bandwidth;
     params->has_max_cpu_throttle = true;
     params->max_cpu_throttle = s->parameters.max_cpu_throttle;
+    params->has_x_load_threads = true;
+    params->x_load_threads = s->parameters.x_load_threads;
 
     return params;
 }
@@ -953,6 +965,26 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_X_LAZY_RAM] &&
+        (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+         cap_list[MIGRATION_CAPABILITY_X_COLO] ||
+         cap_list[MIGRATION_CAPABILITY_X_MULTIFD])) {
+        error_setg(errp, "Lazy RAM loading is not compatible with "
+                   "postcopy, COLO or multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_X_MAPPED_RAM] &&
+        (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+         cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+         cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+         cap_list[MIGRATION_CAPABILITY_X_COLO] ||
+         cap_list[MIGRATION_CAPABILITY_X_MULTIFD])) {
+        error_setg(errp, "Mapped RAM is not compatible with xbzrle, "
+                   "compression, postcopy, COLO or multifd");
+        return false;
+    }
+
     return true;
 }
 
@@ -1110,6 +1142,14 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_x_load_threads &&
+        (params->x_load_threads < 0 || params->x_load_threads > 255)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x_load_threads",
+                   "is invalid, it should be in the range of 0 to 255");
+        return false;
+    }
+
     return true;
 }
 
@@ -1184,6 +1224,9 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_max_cpu_throttle) {
         dest->max_cpu_throttle = params->max_cpu_throttle;
     }
+    if (params->has_x_load_threads) {
+        dest->x_load_threads = params->x_load_threads;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1266,6 +1309,9 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_max_cpu_throttle) {
         s->parameters.max_cpu_throttle = params->max_cpu_throttle;
     }
+    if (params->has_x_load_threads) {
+        s->parameters.x_load_threads = params->x_load_threads;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -1798,6 +1844,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -1884,6 +1932,24 @@ bool migrate_release_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_RELEASE_RAM];
 }
 
+bool migrate_lazy_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_LAZY_RAM];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_MAPPED_RAM];
+}
+
 bool migrate_postcopy_ram(void)
 {
     MigrationState *s;
@@ -1970,6 +2036,15 @@ int migrate_decompress_threads(void)
     return s->parameters.decompress_threads;
 }
 
+int migrate_load_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_load_threads;
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s;
@@ -3264,6 +3339,9 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("max-cpu-throttle", MigrationState,
                       parameters.max_cpu_throttle,
                       DEFAULT_MIGRATE_MAX_CPU_THROTTLE),
+    DEFINE_PROP_UINT8("x-load-threads", MigrationState,
+                      parameters.x_load_threads,
+                      DEFAULT_MIGRATE_LOAD_THREADS),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -3335,6 +3413,7 @@ static void migration_instance_init(Object *obj)
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
+    params->has_x_load_threads = true;
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
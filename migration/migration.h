@@ -252,6 +252,8 @@ MigrationState *migrate_get_current(void);
 bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
+bool migrate_lazy_ram(void);
+bool migrate_mapped_ram(void);
 bool migrate_postcopy_ram(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
@@ -276,6 +278,7 @@ int migrate_compress_level(void);
 int migrate_compress_threads(void);
 int migrate_compress_wait_thread(void);
 int migrate_decompress_threads(void);
+int migrate_load_threads(void);
 bool migrate_use_events(void);
 bool migrate_postcopy_blocktime(void);
 
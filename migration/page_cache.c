@@ -18,6 +18,9 @@
 #include "qapi/error.h"
 #include "qemu-common.h"
 #include "qemu/host-utils.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 
 #ifdef DEBUG_CACHE
@@ -31,6 +34,9 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* entries whose position is equal modulo CACHE_LOCKS share a lock */
+#define CACHE_LOCKS 64
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -40,10 +46,12 @@ struct CacheItem {
 };
 
 struct PageCache {
+    struct rcu_head rcu;
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    QemuMutex locks[CACHE_LOCKS];
 };
 
 PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
@@ -94,6 +102,10 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
         cache->page_cache[i].it_addr = -1;
     }
 
+    for (i = 0; i < CACHE_LOCKS; i++) {
+        qemu_mutex_init(&cache->locks[i]);
+    }
+
     return cache;
 }
 
@@ -108,11 +120,20 @@ void cache_fini(PageCache *cache)
         g_free(cache->page_cache[i].it_data);
     }
 
+    for (i = 0; i < CACHE_LOCKS; i++) {
+        qemu_mutex_destroy(&cache->locks[i]);
+    }
+
     g_free(cache->page_cache);
     cache->page_cache = NULL;
     g_free(cache);
 }
 
+void cache_fini_rcu(PageCache *cache)
+{
+    call_rcu(cache, cache_fini, rcu);
+}
+
 static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
@@ -132,6 +153,18 @@ static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
     return &cache->page_cache[pos];
 }
 
+void cache_lock_page(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_lock(&cache->locks[cache_get_cache_pos(cache, addr) %
+                                  CACHE_LOCKS]);
+}
+
+void cache_unlock_page(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(&cache->locks[cache_get_cache_pos(cache, addr) %
+                                    CACHE_LOCKS]);
+}
+
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
     return cache_get_by_addr(cache, addr)->it_data;
@@ -173,7 +206,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             DPRINTF("Error allocating page\n");
             return -1;
         }
-        cache->num_items++;
+        atomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -15,7 +15,13 @@
 #ifndef PAGE_CACHE_H
 #define PAGE_CACHE_H
 
-/* Page cache for storing guest pages */
+/*
+ * Page cache for storing guest pages
+ *
+ * The cache can be used by several threads at once, as long as accesses
+ * to the entry of an address are done between cache_lock_page and
+ * cache_unlock_page for that address.
+ */
 typedef struct PageCache PageCache;
 
 /**
@@ -35,6 +41,30 @@ PageCache *cache_init(int64_t cache_size, size_t page_size, Error **errp);
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_fini_rcu: free all cache resources after an RCU grace period
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
+/**
+ * cache_lock_page: lock the cache entry used for an addr
+ *
+ * Entries of different addresses may share a lock.
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_lock_page(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock_page: unlock the cache entry used for an addr
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_unlock_page(PageCache *cache, uint64_t addr);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
@@ -27,7 +27,10 @@
 #include "exec/cpu-common.h"
 #include "qemu-file.h"
 #include "io/channel-socket.h"
+#include "io/channel-file.h"
 #include "qemu/iov.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
 
 
 static ssize_t channel_writev_buffer(void *opaque,
@@ -109,6 +112,28 @@ static int channel_close(void *opaque)
 }
 
 
+static int channel_get_fd(void *opaque)
+{
+    QIOChannelFile *fioc = (QIOChannelFile *)
+        object_dynamic_cast(OBJECT(opaque), TYPE_QIO_CHANNEL_FILE);
+
+    return fioc ? fioc->fd : -1;
+}
+
+
+static int channel_seek(void *opaque, int64_t offset)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    Error *local_err = NULL;
+
+    if (qio_channel_io_seek(ioc, offset, SEEK_CUR, &local_err) < 0) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+    return 0;
+}
+
+
 static int channel_shutdown(void *opaque,
                             bool rd,
                             bool wr)
@@ -162,6 +187,8 @@ static QEMUFile *channel_get_output_return_path(void *opaque)
 static const QEMUFileOps channel_input_ops = {
     .get_buffer = channel_get_buffer,
     .close = channel_close,
+    .get_fd = channel_get_fd,
+    .seek = channel_seek,
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
@@ -171,6 +198,8 @@ static const QEMUFileOps channel_input_ops = {
 static const QEMUFileOps channel_output_ops = {
     .writev_buffer = channel_writev_buffer,
     .close = channel_close,
+    .get_fd = channel_get_fd,
+    .seek = channel_seek,
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
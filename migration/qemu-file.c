@@ -313,6 +313,15 @@ void qemu_update_position(QEMUFile *f, size_t size)
     f->pos += size;
 }
 
+/*
+ * Account for @size bytes sent outside of @f, e.g. written to its file
+ * descriptor directly, so that rate limiting still applies to them.
+ */
+void qemu_file_credit_transfer(QEMUFile *f, size_t size)
+{
+    f->bytes_xfer += size;
+}
+
 /** Closes the file
  *
  * Returns negative error value if any error happened on previous operations or
@@ -475,6 +484,30 @@ size_t qemu_peek_buffer(QEMUFile *f, uint8_t **buf, size_t size, size_t offset)
     return size;
 }
 
+/*
+ * Skip 'size' bytes of data from the file without copying them.
+ * 'size' can be larger than the internal buffer.
+ *
+ * Returns the number of bytes skipped, less than size only on error.
+ */
+size_t qemu_skip_buffer(QEMUFile *f, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        uint8_t *src;
+        size_t res;
+
+        res = qemu_peek_buffer(f, &src, MIN(size - done, IO_BUF_SIZE), 0);
+        if (res == 0) {
+            break;
+        }
+        qemu_file_skip(f, res);
+        done += res;
+    }
+    return done;
+}
+
 /*
  * Read 'size' bytes of data from the file into buf.
  * 'size' can be larger than the internal buffer.
@@ -590,6 +623,54 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Position in the underlying channel of the next byte that a read from
+ * @f will return.  Only meaningful for files being read.
+ */
+int64_t qemu_file_read_pos(QEMUFile *f)
+{
+    return f->pos - f->buf_size + f->buf_index;
+}
+
+/*
+ * Move @f to stream position @pos, after writing out or dropping what is
+ * buffered.  The stream then goes on from there.  The channel is moved
+ * relative to where it is, so @pos is the same kind of position as
+ * qemu_ftell() returns even if the channel did not start at offset 0.
+ *
+ * Returns 0 on success, negative on error (also set on @f).
+ */
+int qemu_file_seek(QEMUFile *f, int64_t pos)
+{
+    int ret;
+
+    if (!f->ops->seek) {
+        ret = -ENOTSUP;
+    } else {
+        qemu_fflush(f);
+        ret = qemu_file_get_error(f);
+        if (!ret) {
+            ret = f->ops->seek(f->opaque, pos - f->pos);
+        }
+    }
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+    f->pos = pos;
+    f->buf_index = 0;
+    f->buf_size = 0;
+    return 0;
+}
+
+int qemu_get_fd(QEMUFile *f)
+{
+    if (f->ops->get_fd) {
+        return f->ops->get_fd(f->opaque);
+    }
+    return -1;
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (qemu_file_get_error(f)) {
@@ -56,6 +56,8 @@
 #include "sysemu/sysemu.h"
 #include "qemu/uuid.h"
 #include "savevm.h"
+#include "lazy-ram.h"
+#include "mapped-ram.h"
 #include "qemu/iov.h"
 
 /***********************************************************/
@@ -91,7 +93,8 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /* Cache for XBZRLE, Protected by lock.  The multifd send
+       threads read it under RCU instead. */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -118,7 +121,9 @@ static void XBZRLE_cache_unlock(void)
  * This function is called from qmp_migrate_set_cache_size in main
  * thread, possibly while a migration is in progress.  A running
  * migration may be using the cache and might finish during this call,
- * hence changes to the cache are protected by XBZRLE.lock().
+ * hence changes to the cache are protected by XBZRLE.lock().  The
+ * multifd send threads do not take the lock, so the old cache is only
+ * freed after an RCU grace period.
  *
  * Returns 0 for success or -1 for error
  *
@@ -127,7 +132,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(int64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -151,8 +156,9 @@ int xbzrle_cache_resize(int64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        old_cache = XBZRLE.cache;
+        atomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_fini_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -394,6 +400,41 @@ static QemuThread *decompress_threads;
 static QemuMutex decomp_done_lock;
 static QemuCond decomp_done_cond;
 
+/* Pages handed to a load thread at once */
+#define LOAD_BATCH_PAGES 64
+
+struct LoadPage {
+    /* RAM_SAVE_FLAG_ZERO, RAM_SAVE_FLAG_PAGE or RAM_SAVE_FLAG_XBZRLE */
+    int flags;
+    void *host;
+    /* fill byte of a zero page */
+    uint8_t ch;
+    /* length of the XBZRLE data */
+    int len;
+};
+typedef struct LoadPage LoadPage;
+
+struct LoadParam {
+    bool done;
+    bool quit;
+    bool ready;
+    QemuMutex mutex;
+    QemuCond cond;
+    int count;
+    LoadPage pages[LOAD_BATCH_PAGES];
+    /* payload of pages[i] is at buf + i * TARGET_PAGE_SIZE */
+    uint8_t *buf;
+};
+typedef struct LoadParam LoadParam;
+
+static LoadParam *load_param;
+static QemuThread *load_threads;
+static QemuMutex load_done_lock;
+static QemuCond load_done_cond;
+static QEMUFile *load_file;
+/* batch being filled by the incoming coroutine */
+static LoadParam *load_filling;
+
 static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
                                  ram_addr_t offset, uint8_t *source_buf);
 
@@ -519,6 +560,12 @@ exit:
 #define MULTIFD_VERSION 1
 
 #define MULTIFD_FLAG_SYNC (1 << 0)
+/*
+ * The packet is followed by the be32 length of each page: 0 if the page
+ * did not change, TARGET_PAGE_SIZE if it is sent in full, otherwise the
+ * length of its XBZRLE encoding.  The data of the pages comes next.
+ */
+#define MULTIFD_FLAG_XBZRLE (1 << 1)
 
 typedef struct {
     uint32_t magic;
@@ -589,6 +636,22 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* XBZRLE encode the pages against the cache */
+    bool xbzrle_cache;
+    /* bitmap generation of the pages */
+    uint64_t xbzrle_age;
+    /* length of each page */
+    uint32_t *page_len;
+    /* one page for each page of the packet */
+    uint8_t *xbzrle_buf;
+    /* buffer used for XBZRLE encoding */
+    uint8_t *encoded_buf;
+    /* page lengths and data to send */
+    struct iovec *xbzrle_iov;
+    /* statistics of the XBZRLE packets, collected when idle */
+    XBZRLECacheStats xbzrle_stats;
+    uint64_t xbzrle_normal;
+    uint64_t xbzrle_transferred;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -622,6 +685,12 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* length of each page, allocated with the first XBZRLE packet */
+    uint32_t *page_len;
+    /* one page for each page of the packet */
+    uint8_t *xbzrle_buf;
+    /* pages to receive */
+    struct iovec *xbzrle_iov;
 } MultiFDRecvParams;
 
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
@@ -814,6 +883,105 @@ struct {
     QemuSemaphore channels_ready;
 } *multifd_send_state;
 
+/*
+ * Account the XBZRLE packets sent by @p since the last call.  Called by
+ * the migration thread while the channel is idle.
+ */
+static void multifd_send_collect_xbzrle(MultiFDSendParams *p)
+{
+    xbzrle_counters.bytes += p->xbzrle_stats.bytes;
+    xbzrle_counters.pages += p->xbzrle_stats.pages;
+    xbzrle_counters.cache_miss += p->xbzrle_stats.cache_miss;
+    xbzrle_counters.overflow += p->xbzrle_stats.overflow;
+    ram_counters.normal += p->xbzrle_normal;
+    ram_counters.multifd_bytes += p->xbzrle_transferred;
+    ram_counters.transferred += p->xbzrle_transferred;
+    memset(&p->xbzrle_stats, 0, sizeof(p->xbzrle_stats));
+    p->xbzrle_normal = 0;
+    p->xbzrle_transferred = 0;
+}
+
+/*
+ * multifd_send_xbzrle_pages: encode the pages of a packet
+ *
+ * Each page is looked up in the XBZRLE cache, which several channels
+ * share, and is sent as a delta against the cached copy when that is
+ * shorter than the page.  As with save_xbzrle_page, the cache is
+ * updated with exactly the data that is sent.
+ *
+ * Returns the number of iovecs to send from p->xbzrle_iov
+ *
+ * @p: channel sending the packet
+ * @used: number of pages in the packet
+ */
+static int multifd_send_xbzrle_pages(MultiFDSendParams *p, uint32_t used)
+{
+    RAMBlock *block = p->pages->block;
+    PageCache *cache;
+    int i, n = 0;
+
+    p->xbzrle_iov[n].iov_base = p->page_len;
+    p->xbzrle_iov[n].iov_len = used * sizeof(uint32_t);
+    p->xbzrle_transferred += p->xbzrle_iov[n].iov_len;
+    n++;
+
+    rcu_read_lock();
+    cache = p->xbzrle_cache ? atomic_rcu_read(&XBZRLE.cache) : NULL;
+    for (i = 0; i < used; i++) {
+        ram_addr_t addr = block->offset + p->pages->offset[i];
+        uint8_t *data = p->pages->iov[i].iov_base;
+        int len = TARGET_PAGE_SIZE;
+
+        if (cache) {
+            uint8_t *buf = p->xbzrle_buf + i * TARGET_PAGE_SIZE;
+
+            /* the guest can still write to the page, work on a copy */
+            memcpy(buf, data, TARGET_PAGE_SIZE);
+            data = buf;
+
+            cache_lock_page(cache, addr);
+            if (!cache_is_cached(cache, addr, p->xbzrle_age)) {
+                p->xbzrle_stats.cache_miss++;
+                cache_insert(cache, addr, buf, p->xbzrle_age);
+            } else {
+                uint8_t *prev_cached_page = get_cached_data(cache, addr);
+
+                /* shorter than a page, so that the length is unambiguous */
+                len = xbzrle_encode_buffer(prev_cached_page, buf,
+                                           TARGET_PAGE_SIZE, p->encoded_buf,
+                                           TARGET_PAGE_SIZE - 1);
+                if (len) {
+                    memcpy(prev_cached_page, buf, TARGET_PAGE_SIZE);
+                }
+            }
+            cache_unlock_page(cache, addr);
+
+            if (len == -1) {
+                p->xbzrle_stats.overflow++;
+                len = TARGET_PAGE_SIZE;
+            } else if (len && len < TARGET_PAGE_SIZE) {
+                memcpy(buf, p->encoded_buf, len);
+                p->xbzrle_stats.pages++;
+                p->xbzrle_stats.bytes += len + sizeof(uint32_t);
+            }
+        }
+
+        if (len == TARGET_PAGE_SIZE) {
+            p->xbzrle_normal++;
+        }
+        p->page_len[i] = cpu_to_be32(len);
+        if (len) {
+            p->xbzrle_iov[n].iov_base = data;
+            p->xbzrle_iov[n].iov_len = len;
+            p->xbzrle_transferred += len;
+            n++;
+        }
+    }
+    rcu_read_unlock();
+
+    return n;
+}
+
 /*
  * How we use multifd_send_state->pages and channel->pages?
  *
@@ -858,7 +1026,17 @@ static void multifd_send_pages(void)
     p->pages->block = NULL;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->used) * TARGET_PAGE_SIZE + p->packet_len;
+    if (migrate_use_xbzrle()) {
+        multifd_send_collect_xbzrle(p);
+        p->flags |= MULTIFD_FLAG_XBZRLE;
+        p->xbzrle_cache = !ram_state->ram_bulk_stage;
+        p->xbzrle_age = ram_counters.dirty_sync_count;
+        /* the channel accounts for the pages once they are encoded */
+        transferred = p->packet_len;
+    } else {
+        transferred = ((uint64_t) pages->used) * TARGET_PAGE_SIZE
+                    + p->packet_len;
+    }
     ram_counters.multifd_bytes += transferred;
     ram_counters.transferred += transferred;;
     qemu_mutex_unlock(&p->mutex);
@@ -944,6 +1122,14 @@ int multifd_save_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        g_free(p->page_len);
+        p->page_len = NULL;
+        g_free(p->xbzrle_buf);
+        p->xbzrle_buf = NULL;
+        g_free(p->encoded_buf);
+        p->encoded_buf = NULL;
+        g_free(p->xbzrle_iov);
+        p->xbzrle_iov = NULL;
     }
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     qemu_sem_destroy(&multifd_send_state->sem_sync);
@@ -985,6 +1171,15 @@ static void multifd_send_sync_main(void)
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&multifd_send_state->sem_sync);
     }
+    if (migrate_use_xbzrle()) {
+        for (i = 0; i < migrate_multifd_channels(); i++) {
+            MultiFDSendParams *p = &multifd_send_state->params[i];
+
+            qemu_mutex_lock(&p->mutex);
+            multifd_send_collect_xbzrle(p);
+            qemu_mutex_unlock(&p->mutex);
+        }
+    }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
@@ -1027,7 +1222,15 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
-            ret = qio_channel_writev_all(p->c, p->pages->iov, used, &local_err);
+            if (flags & MULTIFD_FLAG_XBZRLE) {
+                int niov = multifd_send_xbzrle_pages(p, used);
+
+                ret = qio_channel_writev_all(p->c, p->xbzrle_iov, niov,
+                                             &local_err);
+            } else {
+                ret = qio_channel_writev_all(p->c, p->pages->iov, used,
+                                             &local_err);
+            }
             if (ret != 0) {
                 break;
             }
@@ -1115,6 +1318,12 @@ int multifd_save_setup(void)
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(ram_addr_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
+        if (migrate_use_xbzrle()) {
+            p->page_len = g_new0(uint32_t, page_count);
+            p->xbzrle_buf = g_malloc(page_count * TARGET_PAGE_SIZE);
+            p->encoded_buf = g_malloc(TARGET_PAGE_SIZE);
+            p->xbzrle_iov = g_new0(struct iovec, page_count + 1);
+        }
         p->name = g_strdup_printf("multifdsend_%d", i);
         socket_send_channel_create(multifd_new_send_channel_async, p);
     }
@@ -1184,6 +1393,12 @@ int multifd_load_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        g_free(p->page_len);
+        p->page_len = NULL;
+        g_free(p->xbzrle_buf);
+        p->xbzrle_buf = NULL;
+        g_free(p->xbzrle_iov);
+        p->xbzrle_iov = NULL;
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
@@ -1221,6 +1436,75 @@ static void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * multifd_recv_xbzrle_pages: receive the pages of a packet sent with
+ * MULTIFD_FLAG_XBZRLE
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: channel receiving the packet
+ * @used: number of pages in the packet
+ * @errp: set *errp if the check failed, with reason
+ */
+static int multifd_recv_xbzrle_pages(MultiFDRecvParams *p, uint32_t used,
+                                     Error **errp)
+{
+    uint32_t page_count = migrate_multifd_page_count();
+    int i, n = 0;
+
+    if (!p->page_len) {
+        p->page_len = g_new0(uint32_t, page_count);
+        p->xbzrle_buf = g_malloc(page_count * TARGET_PAGE_SIZE);
+        p->xbzrle_iov = g_new0(struct iovec, page_count);
+    }
+
+    if (qio_channel_read_all(p->c, (void *)p->page_len,
+                             used * sizeof(uint32_t), errp)) {
+        return -1;
+    }
+
+    for (i = 0; i < used; i++) {
+        uint32_t len = be32_to_cpu(p->page_len[i]);
+
+        if (len > TARGET_PAGE_SIZE) {
+            error_setg(errp, "multifd: received page with length %u "
+                       "and expected maximum length %d",
+                       len, TARGET_PAGE_SIZE);
+            return -1;
+        }
+        p->page_len[i] = len;
+        if (!len) {
+            continue;
+        }
+        if (len == TARGET_PAGE_SIZE) {
+            p->xbzrle_iov[n].iov_base = p->pages->iov[i].iov_base;
+        } else {
+            p->xbzrle_iov[n].iov_base = p->xbzrle_buf + i * TARGET_PAGE_SIZE;
+        }
+        p->xbzrle_iov[n].iov_len = len;
+        n++;
+    }
+
+    if (qio_channel_readv_all(p->c, p->xbzrle_iov, n, errp)) {
+        return -1;
+    }
+
+    for (i = 0; i < used; i++) {
+        uint32_t len = p->page_len[i];
+
+        if (len && len < TARGET_PAGE_SIZE &&
+            xbzrle_decode_buffer(p->xbzrle_buf + i * TARGET_PAGE_SIZE, len,
+                                 p->pages->iov[i].iov_base,
+                                 TARGET_PAGE_SIZE) < 0) {
+            error_setg(errp, "multifd: failed to decode XBZRLE page %d "
+                       "of packet %" PRIu64, i, p->packet_num);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1257,7 +1541,12 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        ret = qio_channel_readv_all(p->c, p->pages->iov, used, &local_err);
+        if (flags & MULTIFD_FLAG_XBZRLE) {
+            ret = multifd_recv_xbzrle_pages(p, used, &local_err);
+        } else {
+            ret = qio_channel_readv_all(p->c, p->pages->iov, used,
+                                        &local_err);
+        }
         if (ret != 0) {
             break;
         }
@@ -1433,8 +1722,10 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
+    cache_lock_page(XBZRLE.cache, current_addr);
     cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
                  ram_counters.dirty_sync_count);
+    cache_unlock_page(XBZRLE.cache, current_addr);
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -1867,11 +2158,39 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     return pages;
 }
 
+/*
+ * write the page to its slot in the file, see mapped-ram.c
+ *
+ * Returns the number of pages written.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    bool zero = is_zero_range(block->host + offset, TARGET_PAGE_SIZE);
+
+    mapped_ram_save_page(block, offset, zero);
+    if (zero) {
+        ram_counters.duplicate++;
+    } else {
+        qemu_file_credit_transfer(rs->f, TARGET_PAGE_SIZE);
+        ram_counters.transferred += TARGET_PAGE_SIZE;
+        ram_counters.normal++;
+    }
+    return 1;
+}
+
 static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
                                  ram_addr_t offset)
 {
     multifd_queue_page(block, offset);
-    ram_counters.normal++;
+    /* with XBZRLE, the channels know how each page was sent */
+    if (!migrate_use_xbzrle()) {
+        ram_counters.normal++;
+    }
 
     return 1;
 }
@@ -2320,6 +2639,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
+    if (mapped_ram_active()) {
+        return ram_save_mapped_page(rs, block, offset);
+    }
+
     if (save_compress_page(rs, block, offset)) {
         return 1;
     }
@@ -2511,11 +2834,13 @@ static void xbzrle_cleanup(void)
 {
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+        PageCache *cache = XBZRLE.cache;
+
+        atomic_rcu_set(&XBZRLE.cache, NULL);
+        cache_fini_rcu(cache);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
-        XBZRLE.cache = NULL;
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
         XBZRLE.zero_target_page = NULL;
@@ -2542,6 +2867,7 @@ static void ram_save_cleanup(void *opaque)
 
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    mapped_ram_save_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -3160,6 +3486,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->f = f;
 
+    if (migrate_mapped_ram() && mapped_ram_save_setup(f)) {
+        return -1;
+    }
+
     rcu_read_lock();
 
     qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
@@ -3171,6 +3501,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         if (migrate_postcopy_ram() && block->page_size != qemu_host_page_size) {
             qemu_put_be64(f, block->page_size);
         }
+        if (migrate_mapped_ram()) {
+            mapped_ram_save_block(f, block);
+        }
     }
 
     rcu_read_unlock();
@@ -3265,6 +3598,14 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
      */
     ram_control_after_iterate(f, RAM_CONTROL_ROUND);
 
+    /* Pages must be in the file before the next dirty bitmap sync */
+    if (mapped_ram_active()) {
+        ret = mapped_ram_save_flush();
+        if (ret) {
+            qemu_file_set_error(f, ret);
+        }
+    }
+
     multifd_send_sync_main();
 out:
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
@@ -3321,6 +3662,9 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     }
 
     flush_compressed_data(rs);
+    if (!ret && mapped_ram_active()) {
+        ret = mapped_ram_save_complete();
+    }
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
     rcu_read_unlock();
@@ -3361,11 +3705,11 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
     }
 }
 
-static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+/* Returns the length of the XBZRLE data that follows, or -1 on error */
+static int load_xbzrle_header(QEMUFile *f)
 {
     unsigned int xh_len;
     int xh_flags;
-    uint8_t *loaded_data;
 
     /* extract RLE header */
     xh_flags = qemu_get_byte(f);
@@ -3380,6 +3724,18 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
         error_report("Failed to load XBZRLE page - len overflow!");
         return -1;
     }
+    return xh_len;
+}
+
+static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+{
+    int xh_len;
+    uint8_t *loaded_data;
+
+    xh_len = load_xbzrle_header(f);
+    if (xh_len < 0) {
+        return -1;
+    }
     loaded_data = XBZRLE.decoded_buf;
     /* load data and decode */
     /* it can change loaded_data to point to an internal buffer */
@@ -3674,6 +4030,223 @@ static void decompress_data_with_multi_threads(QEMUFile *f,
     qemu_mutex_unlock(&decomp_done_lock);
 }
 
+static void load_one_page(LoadPage *page, uint8_t *data)
+{
+    switch (page->flags) {
+    case RAM_SAVE_FLAG_ZERO:
+        ram_handle_compressed(page->host, page->ch, TARGET_PAGE_SIZE);
+        break;
+    case RAM_SAVE_FLAG_PAGE:
+        memcpy(page->host, data, TARGET_PAGE_SIZE);
+        break;
+    case RAM_SAVE_FLAG_XBZRLE:
+        if (xbzrle_decode_buffer(data, page->len, page->host,
+                                 TARGET_PAGE_SIZE) == -1) {
+            error_report("Failed to load XBZRLE page - decode error!");
+            qemu_file_set_error(load_file, -EINVAL);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void *do_data_load(void *opaque)
+{
+    LoadParam *param = opaque;
+    int i;
+
+    qemu_mutex_lock(&param->mutex);
+    while (!param->quit) {
+        if (param->ready) {
+            param->ready = false;
+            qemu_mutex_unlock(&param->mutex);
+
+            for (i = 0; i < param->count; i++) {
+                load_one_page(&param->pages[i],
+                              param->buf + i * TARGET_PAGE_SIZE);
+            }
+
+            qemu_mutex_lock(&load_done_lock);
+            param->count = 0;
+            param->done = true;
+            qemu_cond_signal(&load_done_cond);
+            qemu_mutex_unlock(&load_done_lock);
+
+            qemu_mutex_lock(&param->mutex);
+        } else {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+    }
+    qemu_mutex_unlock(&param->mutex);
+
+    return NULL;
+}
+
+static void load_batch_submit(void)
+{
+    LoadParam *param = load_filling;
+
+    if (!param) {
+        return;
+    }
+    load_filling = NULL;
+    qemu_mutex_lock(&param->mutex);
+    param->ready = true;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&param->mutex);
+}
+
+/*
+ * Queue a page for the load threads.  Returns where its payload must be
+ * stored.
+ *
+ * A batch can go to any idle thread, so this relies on a page appearing
+ * at most once between two calls to wait_for_load_done(); the source
+ * sends each dirty page once per RAM section.
+ */
+static uint8_t *load_page_queue(int flags, void *host, uint8_t ch, int len)
+{
+    int idx, thread_count;
+    LoadPage *page;
+
+    if (!load_filling) {
+        thread_count = migrate_load_threads();
+        qemu_mutex_lock(&load_done_lock);
+        while (!load_filling) {
+            for (idx = 0; idx < thread_count; idx++) {
+                if (load_param[idx].done) {
+                    load_param[idx].done = false;
+                    load_filling = &load_param[idx];
+                    break;
+                }
+            }
+            if (!load_filling) {
+                qemu_cond_wait(&load_done_cond, &load_done_lock);
+            }
+        }
+        qemu_mutex_unlock(&load_done_lock);
+    }
+
+    idx = load_filling->count++;
+    page = &load_filling->pages[idx];
+    page->flags = flags;
+    page->host = host;
+    page->ch = ch;
+    page->len = len;
+    return load_filling->buf + idx * TARGET_PAGE_SIZE;
+}
+
+/* Hand the batch over to its thread once it is full */
+static void load_page_queued(void)
+{
+    if (load_filling->count == LOAD_BATCH_PAGES) {
+        load_batch_submit();
+    }
+}
+
+static void load_zero_page_with_multi_threads(void *host, uint8_t ch)
+{
+    load_page_queue(RAM_SAVE_FLAG_ZERO, host, ch, 0);
+    load_page_queued();
+}
+
+static void load_page_with_multi_threads(QEMUFile *f, void *host)
+{
+    qemu_get_buffer(f, load_page_queue(RAM_SAVE_FLAG_PAGE, host, 0, 0),
+                    TARGET_PAGE_SIZE);
+    load_page_queued();
+}
+
+static int load_xbzrle_with_multi_threads(QEMUFile *f, void *host)
+{
+    int len = load_xbzrle_header(f);
+
+    if (len < 0) {
+        return -1;
+    }
+    qemu_get_buffer(f, load_page_queue(RAM_SAVE_FLAG_XBZRLE, host, 0, len),
+                    len);
+    load_page_queued();
+    return 0;
+}
+
+static int wait_for_load_done(void)
+{
+    int idx, thread_count;
+
+    if (!load_param) {
+        return 0;
+    }
+
+    load_batch_submit();
+    thread_count = migrate_load_threads();
+    qemu_mutex_lock(&load_done_lock);
+    for (idx = 0; idx < thread_count; idx++) {
+        while (!load_param[idx].done) {
+            qemu_cond_wait(&load_done_cond, &load_done_lock);
+        }
+    }
+    qemu_mutex_unlock(&load_done_lock);
+    return qemu_file_get_error(load_file);
+}
+
+static void load_threads_cleanup(void)
+{
+    int i, thread_count;
+
+    if (!load_param) {
+        return;
+    }
+    thread_count = migrate_load_threads();
+    for (i = 0; i < thread_count; i++) {
+        qemu_mutex_lock(&load_param[i].mutex);
+        load_param[i].quit = true;
+        qemu_cond_signal(&load_param[i].cond);
+        qemu_mutex_unlock(&load_param[i].mutex);
+    }
+    for (i = 0; i < thread_count; i++) {
+        qemu_thread_join(load_threads + i);
+        qemu_mutex_destroy(&load_param[i].mutex);
+        qemu_cond_destroy(&load_param[i].cond);
+        qemu_vfree(load_param[i].buf);
+    }
+    qemu_mutex_destroy(&load_done_lock);
+    qemu_cond_destroy(&load_done_cond);
+    g_free(load_threads);
+    g_free(load_param);
+    load_threads = NULL;
+    load_param = NULL;
+    load_filling = NULL;
+    load_file = NULL;
+}
+
+static void load_threads_setup(QEMUFile *f)
+{
+    int i, thread_count;
+
+    thread_count = migrate_load_threads();
+    if (!thread_count) {
+        return;
+    }
+    load_threads = g_new0(QemuThread, thread_count);
+    load_param = g_new0(LoadParam, thread_count);
+    qemu_mutex_init(&load_done_lock);
+    qemu_cond_init(&load_done_cond);
+    load_file = f;
+    for (i = 0; i < thread_count; i++) {
+        load_param[i].buf = qemu_memalign(TARGET_PAGE_SIZE,
+                                          LOAD_BATCH_PAGES * TARGET_PAGE_SIZE);
+        qemu_mutex_init(&load_param[i].mutex);
+        qemu_cond_init(&load_param[i].cond);
+        load_param[i].done = true;
+        load_param[i].quit = false;
+        qemu_thread_create(load_threads + i, "load",
+                           do_data_load, load_param + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
 /*
  * colo cache: this is for secondary VM, we cache the whole
  * memory of the secondary VM, it is need to hold the global lock
@@ -3771,7 +4344,12 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
     }
 
     xbzrle_load_setup();
+    load_threads_setup(f);
     ramblock_recv_map_init();
+    lazy_ram_incoming_init(f);
+    if (migrate_mapped_ram() && mapped_ram_load_setup(f)) {
+        return -1;
+    }
 
     return 0;
 }
@@ -3788,6 +4366,8 @@ static int ram_load_cleanup(void *opaque)
 
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
+    load_threads_cleanup();
+    mapped_ram_load_cleanup();
 
     RAMBLOCK_FOREACH_MIGRATABLE(rb) {
         g_free(rb->receivedmap);
@@ -4051,6 +4631,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
     while (!postcopy_running && !ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
+        RAMBlock *block = NULL;
         void *host = NULL;
         uint8_t ch;
 
@@ -4069,7 +4650,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(f, flags);
 
             /*
              * After going into COLO, we should load the Page into colo_cache.
@@ -4132,6 +4713,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = mapped_ram_load_block(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4146,11 +4730,25 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
         case RAM_SAVE_FLAG_ZERO:
             ch = qemu_get_byte(f);
-            ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            if (ch || !lazy_ram_defer_zero(block, addr)) {
+                lazy_ram_forget_page(block, addr);
+                if (load_param) {
+                    load_zero_page_with_multi_threads(host, ch);
+                } else {
+                    ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+                }
+            }
             break;
 
         case RAM_SAVE_FLAG_PAGE:
-            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            if (lazy_ram_defer_page(block, addr, f)) {
+                break;
+            }
+            if (load_param) {
+                load_page_with_multi_threads(f, host);
+            } else {
+                qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            }
             break;
 
         case RAM_SAVE_FLAG_COMPRESS_PAGE:
@@ -4160,11 +4758,15 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 ret = -EINVAL;
                 break;
             }
+            lazy_ram_forget_page(block, addr);
             decompress_data_with_multi_threads(f, host, len);
             break;
 
         case RAM_SAVE_FLAG_XBZRLE:
-            if (load_xbzrle(f, addr, host) < 0) {
+            /* The delta applies to the previous copy of the page */
+            if (lazy_ram_load_page(block, addr, host) < 0 ||
+                (load_param ? load_xbzrle_with_multi_threads(f, host) :
+                              load_xbzrle(f, addr, host)) < 0) {
                 error_report("Failed to decompress XBZRLE page at "
                              RAM_ADDR_FMT, addr);
                 ret = -EINVAL;
@@ -4190,6 +4792,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     }
 
     ret |= wait_for_decompress_done();
+    ret |= wait_for_load_done();
     rcu_read_unlock();
     trace_ram_load_complete(ret, seq_iter);
 
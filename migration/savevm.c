@@ -40,6 +40,7 @@
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
+#include "lazy-ram.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/qapi-commands-misc.h"
@@ -2273,8 +2274,17 @@ retry:
 
         trace_qemu_loadvm_state_section(section_type);
         switch (section_type) {
-        case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
+            /*
+             * RAM sections are complete; device loaders may read guest
+             * memory, so deferred pages must be served from now on.
+             */
+            ret = lazy_ram_incoming_start();
+            if (ret < 0) {
+                goto out;
+            }
+            /* fall through */
+        case QEMU_VM_SECTION_START:
             ret = qemu_loadvm_section_start_full(f, mis);
             if (ret < 0) {
                 goto out;
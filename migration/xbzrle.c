@@ -12,29 +12,18 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-/*
-  page = zrun nzrun
-       | zrun nzrun page
-
-  zrun = length
-
-  nzrun = length byte...
-
-  length = uleb128 encoded integer
- */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+/* Scalar encoder, comparing a long at a time */
+static int xbzrle_encode_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
     long res;
     uint8_t *nzrun_start = NULL;
 
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
-
     while (i < slen) {
         /* overflow */
         if (d + 2 > dlen) {
@@ -126,6 +115,324 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/*
+ * The vectorized encoders compare the pages 64 bytes at a time into a
+ * mask with one bit per byte, set if the byte is unchanged, and find the
+ * ends of the runs with ctz64 on the mask of the current block.  They
+ * produce exactly the same output as xbzrle_encode_int.
+ */
+typedef uint64_t XBZRLEMaskFunc(const uint8_t *old_buf,
+                                const uint8_t *new_buf);
+
+typedef struct {
+    const uint8_t *old_buf;
+    const uint8_t *new_buf;
+    int slen;
+    /* End of the last whole block */
+    int end;
+    /* Start of the current block, and its mask if base < end */
+    int base;
+    uint64_t mask;
+} XBZRLEScan;
+
+/*
+ * Return the first index from @i where the bytes are equal (if @eq) or
+ * differ (if !@eq), or slen if there is none.  @i must be in the
+ * current block, or past the last whole block.
+ */
+static inline __attribute__((__always_inline__)) int
+xbzrle_scan(XBZRLEScan *s, int i, bool eq, XBZRLEMaskFunc *mask_fn)
+{
+    while (s->base < s->end) {
+        uint64_t mask = eq ? s->mask : ~s->mask;
+
+        mask &= -1ULL << (i - s->base);
+        if (mask) {
+            return s->base + ctz64(mask);
+        }
+        s->base += 64;
+        if (s->base < s->end) {
+            s->mask = mask_fn(s->old_buf + s->base, s->new_buf + s->base);
+        }
+        i = s->base;
+    }
+    while (i < s->slen && (s->old_buf[i] == s->new_buf[i]) != eq) {
+        i++;
+    }
+    return i;
+}
+
+static inline __attribute__((__always_inline__)) int
+xbzrle_encode_vec(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                  uint8_t *dst, int dlen, XBZRLEMaskFunc *mask_fn)
+{
+    XBZRLEScan s = {
+        .old_buf = old_buf,
+        .new_buf = new_buf,
+        .slen = slen,
+        .end = slen & ~63,
+    };
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, start;
+
+    if (s.end) {
+        s.mask = mask_fn(old_buf, new_buf);
+    }
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = xbzrle_scan(&s, i, false, mask_fn);
+        zrun_len = i - start;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = xbzrle_scan(&s, i, true, mask_fn);
+        nzrun_len = i - start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static inline __attribute__((__always_inline__)) uint64_t
+xbzrle_mask_sse2(const uint8_t *old_buf, const uint8_t *new_buf)
+{
+    uint64_t mask = 0;
+    int k;
+
+    for (k = 0; k < 4; k++) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(old_buf + k * 16));
+        __m128i b = _mm_loadu_si128((const __m128i *)(new_buf + k * 16));
+
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))
+                << (k * 16);
+    }
+    return mask;
+}
+
+static int xbzrle_encode_sse2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_vec(old_buf, new_buf, slen, dst, dlen,
+                             xbzrle_mask_sse2);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static inline __attribute__((__always_inline__)) uint64_t
+xbzrle_mask_avx2(const uint8_t *old_buf, const uint8_t *new_buf)
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)old_buf);
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)new_buf);
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(old_buf + 32));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(new_buf + 32));
+    uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0));
+    uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static int xbzrle_encode_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_vec(old_buf, new_buf, slen, dst, dlen,
+                             xbzrle_mask_avx2);
+}
+#pragma GCC pop_options
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+
+static inline __attribute__((__always_inline__)) uint64_t
+xbzrle_mask_avx512bw(const uint8_t *old_buf, const uint8_t *new_buf)
+{
+    __m512i a = _mm512_loadu_si512(old_buf);
+    __m512i b = _mm512_loadu_si512(new_buf);
+
+    return _mm512_cmpeq_epi8_mask(a, b);
+}
+
+static int xbzrle_encode_avx512bw(uint8_t *old_buf, uint8_t *new_buf,
+                                  int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_vec(old_buf, new_buf, slen, dst, dlen,
+                             xbzrle_mask_avx512bw);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512BW  1
+#define CACHE_AVX2      2
+#define CACHE_SSE2      4
+
+/* Make sure that these variables are appropriately initialized when
+ * SSE2 is enabled on the compiler command-line, but the compiler is
+ * too old to support CONFIG_AVX2_OPT.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL xbzrle_encode_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL xbzrle_encode_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static unsigned cpuid_cache_host = INIT_CACHE;
+static int (*xbzrle_accel)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+    INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) = xbzrle_encode_int;
+    if (cache & CACHE_SSE2) {
+        fn = xbzrle_encode_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_avx2;
+    }
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_encode_avx512bw;
+    }
+#endif
+#endif
+    xbzrle_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+#ifdef CONFIG_AVX512BW_OPT
+            /* ... and that the OS saves the opmask and ZMM state.  */
+            if ((bv & 0xe6) == 0xe6 &&
+                (b & bit_AVX512F) && (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+#endif
+        }
+    }
+    cpuid_cache = cpuid_cache_host = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* If no bits set, we just tested xbzrle_encode_int.  Go back to
+       the best encoder so that the next test starts from it again.  */
+    if (cpuid_cache == 0) {
+        cpuid_cache = cpuid_cache_host;
+        init_accel(cpuid_cache);
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#define select_accel_fn  xbzrle_accel
+#else
+#define select_accel_fn  xbzrle_encode_int
+bool test_xbzrle_encode_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+  page = zrun nzrun
+       | zrun nzrun page
+
+  zrun = length
+
+  nzrun = length byte...
+
+  length = uleb128 encoded integer
+ */
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    return select_accel_fn(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
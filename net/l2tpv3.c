@@ -46,7 +46,6 @@
 #define BUFFER_SIZE 2048
 #define IOVSIZE 2
 #define MAX_L2TPV3_MSGCNT 64
-#define MAX_L2TPV3_IOVCNT (MAX_L2TPV3_MSGCNT * IOVSIZE)
 
 /* Header set to 0x30000 signifies a data packet */
 
@@ -63,12 +62,16 @@ typedef struct NetL2TPV3State {
     int fd;
 
     /*
-     * these are used for xmit - that happens packet a time
-     * and for first sign of life packet (easier to parse that once)
+     * these are used for xmit - packets are copied into the vector as
+     * they arrive and pushed out with a single sendmmsg() once the sender
+     * has finished its burst (or the vector is full)
      */
 
-    uint8_t *header_buf;
-    struct iovec *vec;
+    struct mmsghdr *tx_msgvec;
+    size_t *tx_buf_size;
+    int tx_head;
+    int tx_count;
+    QEMUBH *tx_bh;
 
     /*
      * these are used for receive - try to "eat" up to 32 packets at a time
@@ -135,6 +138,7 @@ typedef struct NetL2TPV3State {
 
 static void net_l2tpv3_send(void *opaque);
 static void l2tpv3_writable(void *opaque);
+static void l2tpv3_flush(NetL2TPV3State *s);
 
 static void l2tpv3_update_fd_handler(NetL2TPV3State *s)
 {
@@ -164,6 +168,11 @@ static void l2tpv3_writable(void *opaque)
 {
     NetL2TPV3State *s = opaque;
     l2tpv3_write_poll(s, false);
+    l2tpv3_flush(s);
+    if (s->tx_count > 0) {
+        /* still blocked, l2tpv3_flush re-armed write_poll */
+        return;
+    }
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -180,32 +189,32 @@ static void l2tpv3_poll(NetClientState *nc, bool enable)
     l2tpv3_read_poll(s, enable);
 }
 
-static void l2tpv3_form_header(NetL2TPV3State *s)
+static void l2tpv3_form_header(NetL2TPV3State *s, uint8_t *header_buf)
 {
     uint32_t *counter;
 
     if (s->udp) {
-        stl_be_p((uint32_t *) s->header_buf, L2TPV3_DATA_PACKET);
+        stl_be_p((uint32_t *) header_buf, L2TPV3_DATA_PACKET);
     }
     stl_be_p(
-            (uint32_t *) (s->header_buf + s->session_offset),
+            (uint32_t *) (header_buf + s->session_offset),
             s->tx_session
         );
     if (s->cookie) {
         if (s->cookie_is_64) {
             stq_be_p(
-                (uint64_t *)(s->header_buf + s->cookie_offset),
+                (uint64_t *)(header_buf + s->cookie_offset),
                 s->tx_cookie
             );
         } else {
             stl_be_p(
-                (uint32_t *) (s->header_buf + s->cookie_offset),
+                (uint32_t *) (header_buf + s->cookie_offset),
                 s->tx_cookie
             );
         }
     }
     if (s->has_counter) {
-        counter = (uint32_t *)(s->header_buf + s->counter_offset);
+        counter = (uint32_t *)(header_buf + s->counter_offset);
         if (s->pin_counter) {
             *counter = 0;
         } else {
@@ -214,97 +223,91 @@ static void l2tpv3_form_header(NetL2TPV3State *s)
     }
 }
 
+static void l2tpv3_flush(NetL2TPV3State *s)
+{
+    int ret;
+
+    while (s->tx_count > 0) {
+        do {
+            ret = sendmmsg(s->fd, s->tx_msgvec + s->tx_head, s->tx_count, 0);
+        } while ((ret == -1) && (errno == EINTR));
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == ENOBUFS) {
+                /* signal upper layer that socket buffer is full */
+                l2tpv3_write_poll(s, true);
+                return;
+            }
+            /* hard error - drop the offending packet and carry on */
+            ret = 1;
+        }
+        s->tx_head += ret;
+        s->tx_count -= ret;
+    }
+    s->tx_head = 0;
+}
+
+static void l2tpv3_flush_bh(void *opaque)
+{
+    NetL2TPV3State *s = opaque;
+
+    /* if we are waiting for the socket, l2tpv3_writable will flush */
+    if (!s->write_poll) {
+        l2tpv3_flush(s);
+    }
+}
+
 static ssize_t net_l2tpv3_receive_dgram_iov(NetClientState *nc,
                     const struct iovec *iov,
                     int iovcnt)
 {
     NetL2TPV3State *s = DO_UPCAST(NetL2TPV3State, nc, nc);
 
-    struct msghdr message;
-    int ret;
+    struct iovec *vec;
+    size_t size = iov_size(iov, iovcnt);
+    int index;
 
-    if (iovcnt > MAX_L2TPV3_IOVCNT - 1) {
-        error_report(
-            "iovec too long %d > %d, change l2tpv3.h",
-            iovcnt, MAX_L2TPV3_IOVCNT
-        );
-        return -1;
+    if (s->tx_head + s->tx_count == MAX_L2TPV3_MSGCNT) {
+        if (s->write_poll) {
+            return 0;
+        }
+        l2tpv3_flush(s);
+        if (s->tx_count > 0) {
+            /* upper layer queues the packet until l2tpv3_writable */
+            return 0;
+        }
     }
-    l2tpv3_form_header(s);
-    memcpy(s->vec + 1, iov, iovcnt * sizeof(struct iovec));
-    s->vec->iov_base = s->header_buf;
-    s->vec->iov_len = s->offset;
-    message.msg_name = s->dgram_dst;
-    message.msg_namelen = s->dst_size;
-    message.msg_iov = s->vec;
-    message.msg_iovlen = iovcnt + 1;
-    message.msg_control = NULL;
-    message.msg_controllen = 0;
-    message.msg_flags = 0;
-    do {
-        ret = sendmsg(s->fd, &message, 0);
-    } while ((ret == -1) && (errno == EINTR));
-    if (ret > 0) {
-        ret -= s->offset;
-    } else if (ret == 0) {
-        /* belt and braces - should not occur on DGRAM
-        * we should get an error and never a 0 send
-        */
-        ret = iov_size(iov, iovcnt);
+
+    index = s->tx_head + s->tx_count;
+    vec = s->tx_msgvec[index].msg_hdr.msg_iov;
+    l2tpv3_form_header(s, vec->iov_base);
+    vec++;
+    if (s->tx_buf_size[index] < size) {
+        g_free(vec->iov_base);
+        vec->iov_base = g_malloc(size);
+        s->tx_buf_size[index] = size;
+    }
+    vec->iov_len = size;
+    iov_to_buf(iov, iovcnt, 0, vec->iov_base, size);
+    s->tx_count++;
+
+    if (s->tx_head + s->tx_count == MAX_L2TPV3_MSGCNT) {
+        l2tpv3_flush(s);
     } else {
-        /* signal upper layer that socket buffer is full */
-        ret = -errno;
-        if (ret == -EAGAIN || ret == -ENOBUFS) {
-            l2tpv3_write_poll(s, true);
-            ret = 0;
-        }
+        qemu_bh_schedule(s->tx_bh);
     }
-    return ret;
+    return size;
 }
 
 static ssize_t net_l2tpv3_receive_dgram(NetClientState *nc,
                     const uint8_t *buf,
                     size_t size)
 {
-    NetL2TPV3State *s = DO_UPCAST(NetL2TPV3State, nc, nc);
-
-    struct iovec *vec;
-    struct msghdr message;
-    ssize_t ret = 0;
+    struct iovec vec = {
+        .iov_base = (void *) buf,
+        .iov_len = size,
+    };
 
-    l2tpv3_form_header(s);
-    vec = s->vec;
-    vec->iov_base = s->header_buf;
-    vec->iov_len = s->offset;
-    vec++;
-    vec->iov_base = (void *) buf;
-    vec->iov_len = size;
-    message.msg_name = s->dgram_dst;
-    message.msg_namelen = s->dst_size;
-    message.msg_iov = s->vec;
-    message.msg_iovlen = 2;
-    message.msg_control = NULL;
-    message.msg_controllen = 0;
-    message.msg_flags = 0;
-    do {
-        ret = sendmsg(s->fd, &message, 0);
-    } while ((ret == -1) && (errno == EINTR));
-    if (ret > 0) {
-        ret -= s->offset;
-    } else if (ret == 0) {
-        /* belt and braces - should not occur on DGRAM
-        * we should get an error and never a 0 send
-        */
-        ret = size;
-    } else {
-        ret = -errno;
-        if (ret == -EAGAIN || ret == -ENOBUFS) {
-            /* signal upper layer that socket buffer is full */
-            l2tpv3_write_poll(s, true);
-            ret = 0;
-        }
-    }
-    return ret;
+    return net_l2tpv3_receive_dgram_iov(nc, &vec, 1);
 }
 
 static int l2tpv3_verify_header(NetL2TPV3State *s, uint8_t *buf)
@@ -501,6 +504,34 @@ static struct mmsghdr *build_l2tpv3_vector(NetL2TPV3State *s, int count)
     return result;
 }
 
+static struct mmsghdr *build_l2tpv3_tx_vector(NetL2TPV3State *s, int count)
+{
+    int i;
+    struct iovec *iov;
+    struct mmsghdr *msgvec, *result;
+
+    msgvec = g_new(struct mmsghdr, count);
+    result = msgvec;
+    for (i = 0; i < count ; i++) {
+        msgvec->msg_hdr.msg_name = s->dgram_dst;
+        msgvec->msg_hdr.msg_namelen = s->dst_size;
+        iov =  g_new(struct iovec, IOVSIZE);
+        msgvec->msg_hdr.msg_iov = iov;
+        iov->iov_base = g_malloc(s->offset);
+        iov->iov_len = s->offset;
+        iov++ ;
+        /* payload buffers are sized on demand */
+        iov->iov_base = NULL;
+        iov->iov_len = 0;
+        msgvec->msg_hdr.msg_iovlen = 2;
+        msgvec->msg_hdr.msg_control = NULL;
+        msgvec->msg_hdr.msg_controllen = 0;
+        msgvec->msg_hdr.msg_flags = 0;
+        msgvec++;
+    }
+    return result;
+}
+
 static void net_l2tpv3_cleanup(NetClientState *nc)
 {
     NetL2TPV3State *s = DO_UPCAST(NetL2TPV3State, nc, nc);
@@ -510,9 +541,12 @@ static void net_l2tpv3_cleanup(NetClientState *nc)
     if (s->fd >= 0) {
         close(s->fd);
     }
+    if (s->tx_bh) {
+        qemu_bh_delete(s->tx_bh);
+    }
     destroy_vector(s->msgvec, MAX_L2TPV3_MSGCNT, IOVSIZE);
-    g_free(s->vec);
-    g_free(s->header_buf);
+    destroy_vector(s->tx_msgvec, MAX_L2TPV3_MSGCNT, IOVSIZE);
+    g_free(s->tx_buf_size);
     g_free(s->dgram_dst);
 }
 
@@ -717,8 +751,9 @@ int net_init_l2tpv3(const Netdev *netdev,
     }
 
     s->msgvec = build_l2tpv3_vector(s, MAX_L2TPV3_MSGCNT);
-    s->vec = g_new(struct iovec, MAX_L2TPV3_IOVCNT);
-    s->header_buf = g_malloc(s->header_size);
+    s->tx_msgvec = build_l2tpv3_tx_vector(s, MAX_L2TPV3_MSGCNT);
+    s->tx_buf_size = g_new0(size_t, MAX_L2TPV3_MSGCNT);
+    s->tx_bh = qemu_bh_new(l2tpv3_flush_bh, s);
 
     qemu_set_nonblock(fd);
 
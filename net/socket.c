@@ -34,6 +34,17 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 
+#ifdef CONFIG_SENDMMSG
+/* Number of datagrams moved per sendmmsg()/recvmmsg() call */
+#define NET_SOCKET_DGRAM_BATCH 32
+
+typedef struct NetSocketDgramSlot {
+    struct iovec iov;
+    uint8_t *buf;
+    size_t buf_size;
+} NetSocketDgramSlot;
+#endif
+
 typedef struct NetSocketState {
     NetClientState nc;
     int listen_fd;
@@ -44,10 +55,30 @@ typedef struct NetSocketState {
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
     bool write_poll;              /* waiting to transmit data? */
+#ifdef CONFIG_SENDMMSG
+    /*
+     * Batched datagram I/O (SOCK_DGRAM only).  Transmitted packets are
+     * copied into tx_slots and sent with a single sendmmsg() from a bottom
+     * half once the sender has finished its burst; received datagrams are
+     * read with recvmmsg() into rx_slots and handed to the peer in order.
+     */
+    struct mmsghdr *tx_msgvec;
+    NetSocketDgramSlot *tx_slots;
+    int tx_head;                  /* first datagram not yet sent */
+    int tx_count;                 /* number of datagrams waiting to be sent */
+    QEMUBH *tx_bh;
+    struct mmsghdr *rx_msgvec;
+    NetSocketDgramSlot *rx_slots;
+    int rx_head;                  /* first datagram not yet delivered */
+    int rx_count;                 /* number of datagrams not yet delivered */
+#endif
 } NetSocketState;
 
 static void net_socket_accept(void *opaque);
 static void net_socket_writable(void *opaque);
+#ifdef CONFIG_SENDMMSG
+static void net_socket_dgram_flush(NetSocketState *s);
+#endif
 
 static void net_socket_update_fd_handler(NetSocketState *s)
 {
@@ -75,6 +106,15 @@ static void net_socket_writable(void *opaque)
 
     net_socket_write_poll(s, false);
 
+#ifdef CONFIG_SENDMMSG
+    if (s->tx_msgvec) {
+        net_socket_dgram_flush(s);
+        if (s->tx_count) {
+            /* still blocked, net_socket_dgram_flush re-armed write_poll */
+            return;
+        }
+    }
+#endif
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -113,6 +153,126 @@ static ssize_t net_socket_receive(NetClientState *nc, const uint8_t *buf, size_t
     return size;
 }
 
+#ifdef CONFIG_SENDMMSG
+static void net_socket_dgram_slot_reserve(NetSocketDgramSlot *slot,
+                                          size_t size)
+{
+    if (slot->buf_size < size) {
+        g_free(slot->buf);
+        slot->buf = g_malloc(size);
+        slot->buf_size = size;
+    }
+    slot->iov.iov_base = slot->buf;
+    slot->iov.iov_len = size;
+}
+
+static struct mmsghdr *net_socket_dgram_build_vector(NetSocketState *s,
+                                                     NetSocketDgramSlot *slots,
+                                                     bool tx)
+{
+    struct mmsghdr *msgvec = g_new0(struct mmsghdr, NET_SOCKET_DGRAM_BATCH);
+    int i;
+
+    for (i = 0; i < NET_SOCKET_DGRAM_BATCH; i++) {
+        if (tx) {
+            msgvec[i].msg_hdr.msg_name = &s->dgram_dst;
+            msgvec[i].msg_hdr.msg_namelen = sizeof(s->dgram_dst);
+        } else {
+            net_socket_dgram_slot_reserve(&slots[i], NET_BUFSIZE);
+        }
+        msgvec[i].msg_hdr.msg_iov = &slots[i].iov;
+        msgvec[i].msg_hdr.msg_iovlen = 1;
+    }
+    return msgvec;
+}
+
+static void net_socket_dgram_free_slots(NetSocketDgramSlot *slots)
+{
+    int i;
+
+    for (i = 0; i < NET_SOCKET_DGRAM_BATCH; i++) {
+        g_free(slots[i].buf);
+    }
+    g_free(slots);
+}
+
+/* Push the pending transmit batch to the socket */
+static void net_socket_dgram_flush(NetSocketState *s)
+{
+    int ret;
+
+    while (s->tx_count > 0) {
+        do {
+            ret = sendmmsg(s->fd, s->tx_msgvec + s->tx_head, s->tx_count, 0);
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret == -1) {
+            if (errno == EAGAIN || errno == ENOBUFS) {
+                net_socket_write_poll(s, true);
+                return;
+            }
+            /* drop the datagram that failed, as a plain sendto() would */
+            ret = 1;
+        }
+        s->tx_head += ret;
+        s->tx_count -= ret;
+    }
+    s->tx_head = 0;
+}
+
+static void net_socket_dgram_flush_bh(void *opaque)
+{
+    NetSocketState *s = opaque;
+
+    if (s->write_poll) {
+        /* net_socket_writable will flush once the socket drains */
+        return;
+    }
+    net_socket_dgram_flush(s);
+}
+
+static ssize_t net_socket_receive_dgram_iov(NetClientState *nc,
+                                            const struct iovec *iov,
+                                            int iovcnt)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+    NetSocketDgramSlot *slot;
+    size_t size = iov_size(iov, iovcnt);
+
+    if (s->tx_head + s->tx_count == NET_SOCKET_DGRAM_BATCH) {
+        if (s->write_poll) {
+            return 0;
+        }
+        net_socket_dgram_flush(s);
+        if (s->tx_count) {
+            /* the peer queues the packet until net_socket_writable */
+            return 0;
+        }
+    }
+
+    slot = &s->tx_slots[s->tx_head + s->tx_count];
+    net_socket_dgram_slot_reserve(slot, size);
+    iov_to_buf(iov, iovcnt, 0, slot->buf, size);
+    s->tx_count++;
+
+    if (s->tx_head + s->tx_count == NET_SOCKET_DGRAM_BATCH) {
+        net_socket_dgram_flush(s);
+    } else {
+        qemu_bh_schedule(s->tx_bh);
+    }
+    return size;
+}
+
+static ssize_t net_socket_receive_dgram(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return net_socket_receive_dgram_iov(nc, &iov, 1);
+}
+#else
 static ssize_t net_socket_receive_dgram(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
@@ -130,6 +290,7 @@ static ssize_t net_socket_receive_dgram(NetClientState *nc, const uint8_t *buf,
     }
     return ret;
 }
+#endif
 
 static void net_socket_send_completed(NetClientState *nc, ssize_t len)
 {
@@ -189,6 +350,62 @@ static void net_socket_send(void *opaque)
     }
 }
 
+#ifdef CONFIG_SENDMMSG
+static void net_socket_dgram_send_completed(NetClientState *nc, ssize_t len);
+
+/* Hand the datagrams read by recvmmsg to the peer until it pushes back */
+static void net_socket_dgram_deliver(NetSocketState *s)
+{
+    int index, size;
+
+    while (s->rx_count > 0) {
+        index = s->rx_head++;
+        size = s->rx_msgvec[index].msg_len;
+        s->rx_count--;
+        if (size == 0) {
+            /* end of connection */
+            s->rx_count = 0;
+            net_socket_read_poll(s, false);
+            net_socket_write_poll(s, false);
+            return;
+        }
+        if (qemu_send_packet_async(&s->nc, s->rx_slots[index].buf, size,
+                                   net_socket_dgram_send_completed) == 0) {
+            net_socket_read_poll(s, false);
+            return;
+        }
+    }
+}
+
+static void net_socket_dgram_send_completed(NetClientState *nc, ssize_t len)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    if (!s->read_poll) {
+        net_socket_read_poll(s, true);
+    }
+    net_socket_dgram_deliver(s);
+}
+
+static void net_socket_send_dgram(void *opaque)
+{
+    NetSocketState *s = opaque;
+    int count;
+
+    if (s->rx_count == 0) {
+        do {
+            count = recvmmsg(s->fd, s->rx_msgvec, NET_SOCKET_DGRAM_BATCH,
+                             MSG_DONTWAIT, NULL);
+        } while (count == -1 && errno == EINTR);
+        if (count < 0) {
+            return;
+        }
+        s->rx_head = 0;
+        s->rx_count = count;
+    }
+    net_socket_dgram_deliver(s);
+}
+#else
 static void net_socket_send_dgram(void *opaque)
 {
     NetSocketState *s = opaque;
@@ -208,6 +425,7 @@ static void net_socket_send_dgram(void *opaque)
         net_socket_read_poll(s, false);
     }
 }
+#endif
 
 static int net_socket_mcast_create(struct sockaddr_in *mcastaddr,
                                    struct in_addr *localaddr,
@@ -316,12 +534,27 @@ static void net_socket_cleanup(NetClientState *nc)
         closesocket(s->listen_fd);
         s->listen_fd = -1;
     }
+#ifdef CONFIG_SENDMMSG
+    if (s->tx_msgvec) {
+        qemu_bh_delete(s->tx_bh);
+        s->tx_bh = NULL;
+        g_free(s->tx_msgvec);
+        s->tx_msgvec = NULL;
+        net_socket_dgram_free_slots(s->tx_slots);
+        g_free(s->rx_msgvec);
+        s->rx_msgvec = NULL;
+        net_socket_dgram_free_slots(s->rx_slots);
+    }
+#endif
 }
 
 static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
+#ifdef CONFIG_SENDMMSG
+    .receive_iov = net_socket_receive_dgram_iov,
+#endif
     .cleanup = net_socket_cleanup,
 };
 
@@ -370,6 +603,13 @@ static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
     s->listen_fd = -1;
     s->send_fn = net_socket_send_dgram;
     net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
+#ifdef CONFIG_SENDMMSG
+    s->tx_slots = g_new0(NetSocketDgramSlot, NET_SOCKET_DGRAM_BATCH);
+    s->tx_msgvec = net_socket_dgram_build_vector(s, s->tx_slots, true);
+    s->tx_bh = qemu_bh_new(net_socket_dgram_flush_bh, s);
+    s->rx_slots = g_new0(NetSocketDgramSlot, NET_SOCKET_DGRAM_BATCH);
+    s->rx_msgvec = net_socket_dgram_build_vector(s, s->rx_slots, false);
+#endif
     net_socket_read_poll(s, true);
 
     /* mcast: save bound address as dst */
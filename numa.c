@@ -637,6 +637,17 @@ MemdevList *qmp_query_memdev(Error **errp)
     return list;
 }
 
+MemPreallocInfo *qmp_query_mem_prealloc(Error **errp)
+{
+    MemPreallocInfo *info = g_new0(MemPreallocInfo, 1);
+    size_t done, total;
+
+    os_mem_prealloc_progress(&done, &total);
+    info->done = done;
+    info->total = total;
+    return info;
+}
+
 void ram_block_notifier_add(RAMBlockNotifier *n)
 {
     QLIST_INSERT_HEAD(&ram_list.ramblock_notifiers, n, next);
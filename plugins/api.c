@@ -0,0 +1,181 @@
+/*
+ * QEMU TCG plugin API, the functions plugins call
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/log.h"
+#include "plugin.h"
+
+/* Global registration */
+
+static struct qemu_plugin_ctx *plugin_installing_ctx(qemu_plugin_id_t id,
+                                                     const char *what)
+{
+    struct qemu_plugin_ctx *ctx = plugin_id_to_ctx(id);
+
+    if (ctx == NULL || ctx != plugin_installing()) {
+        error_report("plugin: %s can only be registered from "
+                     "qemu_plugin_install()", what);
+        return NULL;
+    }
+    return ctx;
+}
+
+void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
+                                           qemu_plugin_vcpu_tb_trans_cb_t cb)
+{
+    struct qemu_plugin_ctx *ctx = plugin_installing_ctx(id, "tb_trans");
+
+    if (ctx && cb) {
+        plugin_register_tb_trans_cb(ctx, cb);
+    }
+}
+
+void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
+                                    qemu_plugin_simple_cb_t cb,
+                                    void *userdata)
+{
+    struct qemu_plugin_ctx *ctx = plugin_installing_ctx(id, "atexit");
+
+    if (ctx && cb) {
+        plugin_register_atexit_cb(ctx, cb, userdata);
+    }
+}
+
+/* TB and insn inspection */
+
+size_t qemu_plugin_tb_n_insns(const struct qemu_plugin_tb *tb)
+{
+    return tb->n;
+}
+
+uint64_t qemu_plugin_tb_vaddr(const struct qemu_plugin_tb *tb)
+{
+    return tb->vaddr;
+}
+
+struct qemu_plugin_insn *
+qemu_plugin_tb_get_insn(const struct qemu_plugin_tb *tb, size_t idx)
+{
+    if (idx >= tb->n) {
+        return NULL;
+    }
+    return g_ptr_array_index(tb->insns, idx);
+}
+
+uint64_t qemu_plugin_insn_vaddr(const struct qemu_plugin_insn *insn)
+{
+    return insn->vaddr;
+}
+
+size_t qemu_plugin_insn_size(const struct qemu_plugin_insn *insn)
+{
+    return insn->size;
+}
+
+/* Instrumentation */
+
+static void plugin_add_regular_cb(GArray *cbs, void *f,
+                                  enum qemu_plugin_mem_rw rw, void *userdata)
+{
+    struct qemu_plugin_dyn_cb cb = {
+        .type = PLUGIN_CB_REGULAR,
+        .rw = rw,
+        .f = f,
+        .userp = userdata,
+    };
+
+    g_array_append_val(cbs, cb);
+}
+
+static void plugin_add_inline_op(GArray *cbs, enum qemu_plugin_mem_rw rw,
+                                 enum qemu_plugin_op op, void *ptr,
+                                 uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb cb = {
+        .type = PLUGIN_CB_INLINE,
+        .rw = rw,
+        .userp = ptr,
+        .op = op,
+        .imm = imm,
+    };
+
+    g_assert(op == QEMU_PLUGIN_INLINE_ADD_U64);
+    g_array_append_val(cbs, cb);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
+                                          qemu_plugin_vcpu_udata_cb_t cb,
+                                          void *userdata)
+{
+    plugin_add_regular_cb(tb->exec_cbs, cb, 0, userdata);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
+                                              enum qemu_plugin_op op,
+                                              void *ptr, uint64_t imm)
+{
+    plugin_add_inline_op(tb->exec_cbs, 0, op, ptr, imm);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
+                                            qemu_plugin_vcpu_udata_cb_t cb,
+                                            void *userdata)
+{
+    plugin_add_regular_cb(insn->exec_cbs, cb, 0, userdata);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
+                                                enum qemu_plugin_op op,
+                                                void *ptr, uint64_t imm)
+{
+    plugin_add_inline_op(insn->exec_cbs, 0, op, ptr, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
+                                      qemu_plugin_vcpu_mem_cb_t cb,
+                                      enum qemu_plugin_mem_rw rw,
+                                      void *userdata)
+{
+    plugin_add_regular_cb(insn->mem_cbs, cb, rw, userdata);
+}
+
+void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          enum qemu_plugin_op op,
+                                          void *ptr, uint64_t imm)
+{
+    plugin_add_inline_op(insn->mem_cbs, rw, op, ptr, imm);
+}
+
+/* Memory access information */
+
+unsigned int qemu_plugin_mem_size_shift(qemu_plugin_meminfo_t info)
+{
+    return info & PLUGIN_MEMINFO_SHIFT_MASK;
+}
+
+bool qemu_plugin_mem_is_sign_extended(qemu_plugin_meminfo_t info)
+{
+    return !!(info & PLUGIN_MEMINFO_SIGN_EXTEND);
+}
+
+bool qemu_plugin_mem_is_big_endian(qemu_plugin_meminfo_t info)
+{
+    return !!(info & PLUGIN_MEMINFO_BIG_ENDIAN);
+}
+
+bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info)
+{
+    return !!(info & PLUGIN_MEMINFO_STORE);
+}
+
+/* Output */
+
+void qemu_plugin_outs(const char *string)
+{
+    qemu_log_mask(CPU_LOG_PLUGIN, "%s", string);
+}
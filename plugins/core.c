@@ -0,0 +1,148 @@
+/*
+ * QEMU TCG plugin support, callback registry
+ *
+ * Plugins are installed before any vCPU runs, and global callbacks can
+ * only be registered at that point, so the registry is read without
+ * locking once the guest is running.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qom/cpu.h"
+#include "plugin.h"
+
+struct plugin_tb_trans_cb {
+    struct qemu_plugin_ctx *ctx;
+    qemu_plugin_vcpu_tb_trans_cb_t f;
+};
+
+struct plugin_atexit_cb {
+    struct qemu_plugin_ctx *ctx;
+    qemu_plugin_simple_cb_t f;
+    void *userdata;
+};
+
+static struct {
+    GPtrArray *ctxs;
+    GArray *tb_trans_cbs;
+    GArray *atexit_cbs;
+    struct qemu_plugin_ctx *installing;
+    bool exited;
+} plugin;
+
+static void plugin_init(void)
+{
+    if (plugin.ctxs) {
+        return;
+    }
+    plugin.ctxs = g_ptr_array_new();
+    plugin.tb_trans_cbs = g_array_new(false, false,
+                                      sizeof(struct plugin_tb_trans_cb));
+    plugin.atexit_cbs = g_array_new(false, false,
+                                    sizeof(struct plugin_atexit_cb));
+}
+
+struct qemu_plugin_ctx *plugin_ctx_new(GModule *handle, const char *path)
+{
+    struct qemu_plugin_ctx *ctx = g_new0(struct qemu_plugin_ctx, 1);
+
+    plugin_init();
+    ctx->handle = handle;
+    ctx->path = g_strdup(path);
+    ctx->id = plugin.ctxs->len;
+    g_ptr_array_add(plugin.ctxs, ctx);
+    return ctx;
+}
+
+void plugin_ctx_reset(struct qemu_plugin_ctx *ctx)
+{
+    guint i;
+
+    for (i = 0; i < plugin.tb_trans_cbs->len; ) {
+        if (g_array_index(plugin.tb_trans_cbs,
+                          struct plugin_tb_trans_cb, i).ctx == ctx) {
+            g_array_remove_index(plugin.tb_trans_cbs, i);
+        } else {
+            i++;
+        }
+    }
+    for (i = 0; i < plugin.atexit_cbs->len; ) {
+        if (g_array_index(plugin.atexit_cbs,
+                          struct plugin_atexit_cb, i).ctx == ctx) {
+            g_array_remove_index(plugin.atexit_cbs, i);
+        } else {
+            i++;
+        }
+    }
+    /* Keep the slot so that ids stay stable */
+    g_ptr_array_index(plugin.ctxs, ctx->id) = NULL;
+    g_free(ctx->path);
+    g_free(ctx);
+}
+
+struct qemu_plugin_ctx *plugin_id_to_ctx(qemu_plugin_id_t id)
+{
+    g_assert(plugin.ctxs && id < plugin.ctxs->len);
+    return g_ptr_array_index(plugin.ctxs, id);
+}
+
+struct qemu_plugin_ctx *plugin_installing(void)
+{
+    return plugin.installing;
+}
+
+void plugin_set_installing(struct qemu_plugin_ctx *ctx)
+{
+    plugin.installing = ctx;
+}
+
+void plugin_register_tb_trans_cb(struct qemu_plugin_ctx *ctx,
+                                 qemu_plugin_vcpu_tb_trans_cb_t cb)
+{
+    struct plugin_tb_trans_cb e = { .ctx = ctx, .f = cb };
+
+    g_array_append_val(plugin.tb_trans_cbs, e);
+}
+
+void plugin_register_atexit_cb(struct qemu_plugin_ctx *ctx,
+                               qemu_plugin_simple_cb_t cb, void *userdata)
+{
+    struct plugin_atexit_cb e = { .ctx = ctx, .f = cb, .userdata = userdata };
+
+    g_array_append_val(plugin.atexit_cbs, e);
+}
+
+bool qemu_plugin_tb_trans_enabled(void)
+{
+    return plugin.tb_trans_cbs && plugin.tb_trans_cbs->len;
+}
+
+void qemu_plugin_tb_trans_cb(CPUState *cpu, struct qemu_plugin_tb *tb)
+{
+    guint i;
+
+    for (i = 0; i < plugin.tb_trans_cbs->len; i++) {
+        struct plugin_tb_trans_cb *e =
+            &g_array_index(plugin.tb_trans_cbs, struct plugin_tb_trans_cb, i);
+
+        e->f(e->ctx->id, cpu->cpu_index, tb);
+    }
+}
+
+void qemu_plugin_atexit_cb(void)
+{
+    guint i;
+
+    if (!plugin.atexit_cbs || atomic_xchg(&plugin.exited, true)) {
+        return;
+    }
+    for (i = 0; i < plugin.atexit_cbs->len; i++) {
+        struct plugin_atexit_cb *e =
+            &g_array_index(plugin.atexit_cbs, struct plugin_atexit_cb, i);
+
+        e->f(e->ctx->id, e->userdata);
+    }
+}
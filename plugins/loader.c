@@ -0,0 +1,143 @@
+/*
+ * QEMU TCG plugin support, command line handling and loading
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qemu/option.h"
+#include "qemu/queue.h"
+#include "plugin.h"
+
+QemuOptsList qemu_plugin_opts = {
+    .name = "plugin",
+    .implied_opt_name = "file",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_plugin_opts.head),
+    .desc = {
+        /* no elements => accept any params */
+        { /* end of list */ }
+    },
+};
+
+struct qemu_plugin_desc {
+    char *path;
+    char **argv;
+    int argc;
+    QTAILQ_ENTRY(qemu_plugin_desc) entry;
+};
+
+static QTAILQ_HEAD(, qemu_plugin_desc) plugin_list =
+    QTAILQ_HEAD_INITIALIZER(plugin_list);
+
+static int plugin_add_arg(void *opaque, const char *name, const char *value,
+                          Error **errp)
+{
+    struct qemu_plugin_desc *desc = opaque;
+
+    if (!strcmp(name, "file")) {
+        if (desc->path) {
+            error_setg(errp, "plugin file given twice");
+            return 1;
+        }
+        desc->path = g_strdup(value);
+    } else if (!strcmp(name, "arg")) {
+        desc->argv = g_renew(char *, desc->argv, desc->argc + 2);
+        desc->argv[desc->argc++] = g_strdup(value);
+        desc->argv[desc->argc] = NULL;
+    } else {
+        error_setg(errp, "invalid plugin option '%s'", name);
+        return 1;
+    }
+    return 0;
+}
+
+void qemu_plugin_opt_parse(const char *optarg)
+{
+    struct qemu_plugin_desc *desc;
+    QemuOpts *opts;
+
+    opts = qemu_opts_parse_noisily(&qemu_plugin_opts, optarg, true);
+    if (!opts) {
+        exit(1);
+    }
+    desc = g_new0(struct qemu_plugin_desc, 1);
+    qemu_opt_foreach(opts, plugin_add_arg, desc, &error_fatal);
+    qemu_opts_del(opts);
+    if (!desc->path) {
+        error_report("plugin file not specified");
+        exit(1);
+    }
+    QTAILQ_INSERT_TAIL(&plugin_list, desc, entry);
+}
+
+static int plugin_load(struct qemu_plugin_desc *desc)
+{
+    qemu_plugin_install_func_t install;
+    struct qemu_plugin_ctx *ctx;
+    GModule *handle;
+    int *version;
+    int rc;
+
+    handle = g_module_open(desc->path, G_MODULE_BIND_LOCAL);
+    if (!handle) {
+        error_report("Could not load plugin %s: %s", desc->path,
+                     g_module_error());
+        return -1;
+    }
+    if (!g_module_symbol(handle, "qemu_plugin_version",
+                         (gpointer *)&version)) {
+        error_report("Plugin %s does not export qemu_plugin_version",
+                     desc->path);
+        goto err_close;
+    }
+    if (*version != QEMU_PLUGIN_VERSION) {
+        error_report("Plugin %s has API version %d, this QEMU expects %d",
+                     desc->path, *version, QEMU_PLUGIN_VERSION);
+        goto err_close;
+    }
+    if (!g_module_symbol(handle, "qemu_plugin_install",
+                         (gpointer *)&install)) {
+        error_report("Plugin %s does not export qemu_plugin_install",
+                     desc->path);
+        goto err_close;
+    }
+
+    ctx = plugin_ctx_new(handle, desc->path);
+    plugin_set_installing(ctx);
+    rc = install(ctx->id, desc->argc, desc->argv);
+    plugin_set_installing(NULL);
+    if (rc) {
+        error_report("Plugin %s failed to install (%d)", desc->path, rc);
+        plugin_ctx_reset(ctx);
+        goto err_close;
+    }
+    return 0;
+
+ err_close:
+    g_module_close(handle);
+    return -1;
+}
+
+int qemu_plugin_load_list(void)
+{
+    struct qemu_plugin_desc *desc, *next;
+    bool loaded = false;
+    int ret = 0;
+
+    QTAILQ_FOREACH_SAFE(desc, &plugin_list, entry, next) {
+        if (ret == 0) {
+            ret = plugin_load(desc);
+            loaded = true;
+        }
+        QTAILQ_REMOVE(&plugin_list, desc, entry);
+        g_strfreev(desc->argv);
+        g_free(desc->path);
+        g_free(desc);
+    }
+    if (ret == 0 && loaded) {
+        atexit(qemu_plugin_atexit_cb);
+    }
+    return ret;
+}
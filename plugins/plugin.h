@@ -0,0 +1,39 @@
+/*
+ * QEMU TCG plugin support, private to plugins/
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef PLUGINS_PLUGIN_H
+#define PLUGINS_PLUGIN_H
+
+#include <gmodule.h>
+#include "qemu/plugin.h"
+
+struct qemu_plugin_ctx {
+    GModule *handle;
+    qemu_plugin_id_t id;
+    char *path;
+};
+
+/* Register a newly opened plugin, returning its context */
+struct qemu_plugin_ctx *plugin_ctx_new(GModule *handle, const char *path);
+
+/* Forget @ctx and every callback it registered */
+void plugin_ctx_reset(struct qemu_plugin_ctx *ctx);
+
+/*
+ * The plugin being installed, if any.  Global callbacks can only be
+ * registered while its qemu_plugin_install() runs.
+ */
+struct qemu_plugin_ctx *plugin_installing(void);
+void plugin_set_installing(struct qemu_plugin_ctx *ctx);
+
+void plugin_register_tb_trans_cb(struct qemu_plugin_ctx *ctx,
+                                 qemu_plugin_vcpu_tb_trans_cb_t cb);
+void plugin_register_atexit_cb(struct qemu_plugin_ctx *ctx,
+                               qemu_plugin_simple_cb_t cb, void *userdata);
+
+struct qemu_plugin_ctx *plugin_id_to_ctx(qemu_plugin_id_t id);
+
+#endif /* PLUGINS_PLUGIN_H */
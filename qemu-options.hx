@@ -118,9 +118,10 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,jmp-cache-bits=n]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                jmp-cache-bits=n (2^n sets in each vCPU's TB jump cache)\n", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -134,6 +135,11 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item jmp-cache-bits=@var{n}
+Sets the size of the per-vCPU cache that maps guest addresses to translated
+blocks to 2^@var{n} sets of 4 entries each, with @var{n} between 4 and 16.
+The default of 10 suits most guests; guests with very large code footprints
+may benefit from a bigger cache.  The hit rate is shown by @code{info jit}.
 @end table
 ETEXI
 
@@ -3509,12 +3515,12 @@ re-inject them.
 ETEXI
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>,rrperiod=<insns>,rrseek=<icount>]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping\n", QEMU_ARCH_ALL)
 STEXI
-@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot}]
+@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot},rrperiod=@var{insns},rrseek=@var{icount}]
 @findex -icount
 Enable virtual instruction counter.  The virtual cpu will execute one
 instruction every 2^@var{N} ns of virtual time.  If @code{auto} is specified
@@ -3551,6 +3557,11 @@ read from this file in replay mode.
 Option rrsnapshot is used to create new vm snapshot named @var{snapshot}
 at the start of execution recording. In replay mode this option is used
 to load the initial VM state.
+
+Option rrperiod makes recording also create a snapshot named
+@var{snapshot}-@var{icount} about every @var{insns} instructions.
+Option rrseek stops replay once instruction @var{icount} is reached,
+starting from the latest periodic snapshot taken before it.
 ETEXI
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -3671,6 +3682,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:path\n" \
+    "                load incoming migration from a file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3689,6 +3702,14 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{path}
+Load incoming migration from a file written by @code{migrate "file:path"}.
+With the @code{x-lazy-ram} capability, the VM can start before guest RAM
+has been read from the file.
+With the @code{x-mapped-ram} capability set on both sides, each RAM page
+has a fixed offset in the file, so that pages are written and read back
+in parallel and the file does not grow when a page is sent again.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
@@ -3863,6 +3884,21 @@ HXCOMM HX does not support conditional compilation of text.
 @include qemu-option-trace.texi
 ETEXI
 
+#ifdef CONFIG_PLUGIN
+DEF("plugin", HAS_ARG, QEMU_OPTION_plugin,
+    "-plugin [file=]<file>[,arg=<string>]\n"
+    "                load a TCG plugin\n",
+    QEMU_ARCH_ALL)
+#endif
+STEXI
+@item -plugin [file=]@var{file}[,arg=@var{string}]
+@findex -plugin
+Load a TCG plugin from the shared library @var{file} before the guest
+starts.  Each @option{arg} is passed on to the plugin, in order.  The
+option can be repeated to load several plugins.  Plugin output goes to
+the log, under @option{-d plugin}.  See @file{docs/devel/tcg-plugins.txt}.
+ETEXI
+
 HXCOMM Internal use
 DEF("qtest", HAS_ARG, QEMU_OPTION_qtest, "", QEMU_ARCH_ALL)
 DEF("qtest-log", HAS_ARG, QEMU_OPTION_qtest_log, "", QEMU_ARCH_ALL)
@@ -3984,6 +4020,10 @@ Setting the @option{dump} boolean option to @var{off} excludes the memory from
 core dumps. This feature is also known as MADV_DONTDUMP.
 
 The @option{prealloc} boolean option enables memory preallocation.
+Pages are touched from one thread per host CPU; with a @option{policy}
+other than default, the threads run on the @option{host-nodes} that
+will own the pages they touch.  Progress can be followed with the
+query-mem-prealloc QMP command.
 
 The @option{host-nodes} option binds the memory range to a list of NUMA host
 nodes.
@@ -35,6 +35,8 @@
 
 CPUInterruptHandler cpu_interrupt_handler;
 
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS;
+
 CPUState *cpu_by_arch_id(int64_t id)
 {
     CPUState *cpu;
@@ -371,6 +373,7 @@ static void cpu_common_initfn(Object *obj)
     cpu->nr_cores = 1;
     cpu->nr_threads = 1;
 
+    cpu->tb_jmp_cache = g_new0(struct TranslationBlock *, tb_jmp_cache_size());
     qemu_mutex_init(&cpu->work_mutex);
     QTAILQ_INIT(&cpu->breakpoints);
     QTAILQ_INIT(&cpu->watchpoints);
@@ -380,6 +383,9 @@ static void cpu_common_initfn(Object *obj)
 
 static void cpu_common_finalize(Object *obj)
 {
+    CPUState *cpu = CPU(obj);
+
+    g_free(cpu->tb_jmp_cache);
 }
 
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
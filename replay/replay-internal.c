@@ -14,7 +14,10 @@
 #include "sysemu/replay.h"
 #include "replay-internal.h"
 #include "qemu/error-report.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
 #include "sysemu/sysemu.h"
+#include <zlib.h>
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -27,6 +30,33 @@ static QemuMutex lock;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * The log is stored as a sequence of zlib-compressed chunks holding
+ * REPLAY_CHUNK_SIZE bytes of events each (the last one may be shorter).
+ * Positions in the log count uncompressed bytes, so that chunk N starts
+ * at position N * REPLAY_CHUNK_SIZE; the file offsets of the chunks are
+ * kept in an index at the end of the file, which makes seeking cheap.
+ *
+ * The header holds the version of the format and the file offset of the
+ * index.  The index lists the chunks and then the instruction counts at
+ * which periodic snapshots were taken.
+ */
+#define REPLAY_CHUNK_SIZE           (64 * KiB)
+
+static struct {
+    uint8_t *buf;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+    /* Bytes in buf, and read position in it when replaying */
+    size_t len;
+    size_t pos;
+    /* Index of the chunk in buf */
+    uint64_t chunk;
+    /* File offsets of the chunks, then icounts of the snapshots */
+    GArray *offsets;
+    GArray *snapshots;
+} replay_log;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -41,11 +71,205 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static void replay_file_put_dword(uint32_t dword)
+{
+    uint8_t b[4];
+
+    stl_be_p(b, dword);
+    if (fwrite(b, 1, sizeof(b), replay_file) != sizeof(b)) {
+        replay_write_error();
+    }
+}
+
+static void replay_file_put_qword(uint64_t qword)
+{
+    replay_file_put_dword(qword >> 32);
+    replay_file_put_dword(qword);
+}
+
+static uint32_t replay_file_get_dword(void)
+{
+    uint8_t b[4];
+
+    if (fread(b, 1, sizeof(b), replay_file) != sizeof(b)) {
+        replay_read_error();
+    }
+    return ldl_be_p(b);
+}
+
+static uint64_t replay_file_get_qword(void)
+{
+    uint64_t qword = replay_file_get_dword();
+
+    return (qword << 32) | replay_file_get_dword();
+}
+
+static void replay_log_write_chunk(void)
+{
+    uLongf zlen = replay_log.zbuf_size;
+    uint64_t offset = ftell(replay_file);
+
+    if (compress2(replay_log.zbuf, &zlen, replay_log.buf, replay_log.len,
+                  Z_BEST_SPEED) != Z_OK) {
+        replay_write_error();
+        return;
+    }
+    g_array_append_val(replay_log.offsets, offset);
+    replay_file_put_dword(replay_log.len);
+    replay_file_put_dword(zlen);
+    if (fwrite(replay_log.zbuf, 1, zlen, replay_file) != zlen) {
+        replay_write_error();
+    }
+    replay_log.chunk++;
+    replay_log.len = 0;
+}
+
+static void replay_log_read_chunk(uint64_t chunk)
+{
+    uLongf len = REPLAY_CHUNK_SIZE;
+    uint32_t raw_len, zlen;
+
+    if (chunk >= replay_log.offsets->len) {
+        replay_read_error();
+    }
+    fseek(replay_file, g_array_index(replay_log.offsets, uint64_t, chunk),
+          SEEK_SET);
+    raw_len = replay_file_get_dword();
+    zlen = replay_file_get_dword();
+    if (zlen > replay_log.zbuf_size ||
+        fread(replay_log.zbuf, 1, zlen, replay_file) != zlen ||
+        uncompress(replay_log.buf, &len, replay_log.zbuf, zlen) != Z_OK ||
+        len != raw_len) {
+        replay_read_error();
+    }
+    replay_log.chunk = chunk;
+    replay_log.len = len;
+    replay_log.pos = 0;
+}
+
+void replay_log_open(void)
+{
+    uint64_t index_offset;
+    uint32_t i, n;
+
+    replay_log.buf = g_malloc(REPLAY_CHUNK_SIZE);
+    replay_log.zbuf_size = compressBound(REPLAY_CHUNK_SIZE);
+    replay_log.zbuf = g_malloc(replay_log.zbuf_size);
+    replay_log.offsets = g_array_new(false, false, sizeof(uint64_t));
+    replay_log.snapshots = g_array_new(false, false, sizeof(uint64_t));
+    replay_log.chunk = 0;
+    replay_log.len = 0;
+    replay_log.pos = 0;
+
+    /* skip file header for RECORD and check it for PLAY */
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        fseek(replay_file, REPLAY_HEADER_SIZE, SEEK_SET);
+        return;
+    }
+
+    if (replay_file_get_dword() != REPLAY_VERSION) {
+        fprintf(stderr, "Replay: invalid input log file version\n");
+        exit(1);
+    }
+    index_offset = replay_file_get_qword();
+    fseek(replay_file, index_offset, SEEK_SET);
+    n = replay_file_get_dword();
+    for (i = 0; i < n; i++) {
+        uint64_t offset = replay_file_get_qword();
+        g_array_append_val(replay_log.offsets, offset);
+    }
+    n = replay_file_get_dword();
+    for (i = 0; i < n; i++) {
+        uint64_t icount = replay_file_get_qword();
+        g_array_append_val(replay_log.snapshots, icount);
+    }
+    if (replay_log.offsets->len) {
+        replay_log_read_chunk(0);
+    }
+}
+
+void replay_log_close(void)
+{
+    uint64_t index_offset;
+    guint i;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        if (replay_log.len) {
+            replay_log_write_chunk();
+        }
+        index_offset = ftell(replay_file);
+        replay_file_put_dword(replay_log.offsets->len);
+        for (i = 0; i < replay_log.offsets->len; i++) {
+            replay_file_put_qword(g_array_index(replay_log.offsets,
+                                                uint64_t, i));
+        }
+        replay_file_put_dword(replay_log.snapshots->len);
+        for (i = 0; i < replay_log.snapshots->len; i++) {
+            replay_file_put_qword(g_array_index(replay_log.snapshots,
+                                                uint64_t, i));
+        }
+
+        /* write header */
+        fseek(replay_file, 0, SEEK_SET);
+        replay_file_put_dword(REPLAY_VERSION);
+        replay_file_put_qword(index_offset);
+    }
+
+    g_free(replay_log.buf);
+    g_free(replay_log.zbuf);
+    g_array_free(replay_log.offsets, true);
+    g_array_free(replay_log.snapshots, true);
+    memset(&replay_log, 0, sizeof(replay_log));
+}
+
+uint64_t replay_log_tell(void)
+{
+    uint64_t pos = replay_log.chunk * REPLAY_CHUNK_SIZE;
+
+    return pos + (replay_mode == REPLAY_MODE_RECORD ? replay_log.len
+                                                    : replay_log.pos);
+}
+
+void replay_log_seek(uint64_t pos)
+{
+    /* At a chunk boundary stay at the end of the previous chunk, since
+       the next one may not exist */
+    uint64_t chunk = pos ? (pos - 1) / REPLAY_CHUNK_SIZE : 0;
+
+    assert(replay_mode == REPLAY_MODE_PLAY);
+    if (chunk != replay_log.chunk) {
+        replay_log_read_chunk(chunk);
+    }
+    replay_log.pos = pos - chunk * REPLAY_CHUNK_SIZE;
+}
+
+void replay_log_add_snapshot(uint64_t icount)
+{
+    g_array_append_val(replay_log.snapshots, icount);
+}
+
+bool replay_log_find_snapshot(uint64_t icount, uint64_t *found)
+{
+    bool res = false;
+    guint i;
+
+    for (i = 0; i < replay_log.snapshots->len; i++) {
+        uint64_t snapshot = g_array_index(replay_log.snapshots, uint64_t, i);
+
+        if (snapshot <= icount && (!res || snapshot > *found)) {
+            *found = snapshot;
+            res = true;
+        }
+    }
+    return res;
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        replay_log.buf[replay_log.len++] = byte;
+        if (replay_log.len == REPLAY_CHUNK_SIZE) {
+            replay_log_write_chunk();
         }
     }
 }
@@ -79,8 +303,16 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size) {
+            size_t n = MIN(size, REPLAY_CHUNK_SIZE - replay_log.len);
+
+            memcpy(replay_log.buf + replay_log.len, buf, n);
+            replay_log.len += n;
+            buf += n;
+            size -= n;
+            if (replay_log.len == REPLAY_CHUNK_SIZE) {
+                replay_log_write_chunk();
+            }
         }
     }
 }
@@ -89,11 +321,10 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
+        if (replay_log.pos == replay_log.len) {
+            replay_log_read_chunk(replay_log.chunk + 1);
         }
-        byte = r;
+        byte = replay_log.buf[replay_log.pos++];
     }
     return byte;
 }
@@ -131,13 +362,27 @@ int64_t replay_get_qword(void)
     return qword;
 }
 
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n;
+
+        if (replay_log.pos == replay_log.len) {
+            replay_log_read_chunk(replay_log.chunk + 1);
+        }
+        n = MIN(size, replay_log.len - replay_log.pos);
+        memcpy(buf, replay_log.buf + replay_log.pos, n);
+        replay_log.pos += n;
+        buf += n;
+        size -= n;
+    }
+}
+
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -146,9 +391,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
@@ -12,6 +12,12 @@
  *
  */
 
+/* Current version of the replay mechanism.
+   Increase it when file format changes. */
+#define REPLAY_VERSION              0xe02008
+/* Size of replay log header */
+#define REPLAY_HEADER_SIZE          (sizeof(uint32_t) + sizeof(uint64_t))
+
 /* Any changes to order/number of events will need to bump REPLAY_VERSION */
 enum ReplayEvents {
     /* for instruction event */
@@ -91,6 +97,24 @@ extern ReplayState replay_state;
 
 /* File for replay writing */
 extern FILE *replay_file;
+/* Instructions between periodic snapshots, 0 when disabled */
+extern uint64_t replay_snapshot_period;
+/* Instruction to stop replaying at, -1 when not seeking.
+   Accessed with the replay mutex held once replay has started.  */
+extern int64_t replay_break_icount;
+
+/*! Sets up the log buffers, and reads the header and index when replaying. */
+void replay_log_open(void);
+/*! Flushes the log and writes the index and header when recording. */
+void replay_log_close(void);
+/*! Returns the current position in the log. */
+uint64_t replay_log_tell(void);
+/*! Moves to the position in the log returned by replay_log_tell. */
+void replay_log_seek(uint64_t pos);
+/*! Records in the index that a periodic snapshot was taken at @icount. */
+void replay_log_add_snapshot(uint64_t icount);
+/*! Finds the latest periodic snapshot taken at or before @icount. */
+bool replay_log_find_snapshot(uint64_t icount, uint64_t *found);
 
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
@@ -189,5 +213,7 @@ void *replay_event_net_load(void);
    Should be called before virtual devices initialization
    to make cached timers available for post_load functions. */
 void replay_vmstate_register(void);
+/* Starts taking periodic snapshots while recording */
+void replay_snapshot_timer_init(void);
 
 #endif
@@ -18,13 +18,21 @@
 #include "monitor/monitor.h"
 #include "qapi/qmp/qstring.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "migration/vmstate.h"
 #include "migration/snapshot.h"
 
+/* Period of the check for taking a periodic snapshot, in ms */
+#define REPLAY_SNAPSHOT_CHECK_MS    100
+
+static QEMUTimer *replay_snapshot_timer;
+/* Instruction count at which the next periodic snapshot is due */
+static uint64_t replay_snapshot_next;
+
 static int replay_pre_save(void *opaque)
 {
     ReplayState *state = opaque;
-    state->file_offset = ftell(replay_file);
+    state->file_offset = replay_log_tell();
     state->host_clock_last = qemu_clock_get_last(QEMU_CLOCK_HOST);
 
     return 0;
@@ -34,7 +42,7 @@ static int replay_post_load(void *opaque, int version_id)
 {
     ReplayState *state = opaque;
     if (replay_mode == REPLAY_MODE_PLAY) {
-        fseek(replay_file, state->file_offset, SEEK_SET);
+        replay_log_seek(state->file_offset);
         qemu_clock_set_last(QEMU_CLOCK_HOST, state->host_clock_last);
         /* If this was a vmstate, saved in recording mode,
            we need to initialize replay data fields. */
@@ -76,11 +84,70 @@ void replay_vmstate_register(void)
     vmstate_register(NULL, 0, &vmstate_replay, &replay_state);
 }
 
+static char *replay_snapshot_name(uint64_t icount)
+{
+    return g_strdup_printf("%s-%" PRIu64, replay_snapshot, icount);
+}
+
+static void replay_snapshot_tick(void *opaque)
+{
+    Error *err = NULL;
+    uint64_t icount;
+    char *name;
+
+    timer_mod(replay_snapshot_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+              + REPLAY_SNAPSHOT_CHECK_MS);
+    if (!runstate_is_running()
+        || replay_get_current_step() < replay_snapshot_next) {
+        return;
+    }
+
+    /* Stop first, so that the snapshot is named after its icount */
+    vm_stop(RUN_STATE_SAVE_VM);
+    if (replay_can_snapshot()) {
+        icount = replay_get_current_step();
+        name = replay_snapshot_name(icount);
+        if (save_snapshot(name, &err) == 0) {
+            replay_log_add_snapshot(icount);
+            replay_snapshot_next = icount + replay_snapshot_period;
+        } else {
+            error_report_err(err);
+            error_report("Could not create periodic snapshot %s", name);
+        }
+        g_free(name);
+    }
+    vm_start();
+}
+
+void replay_snapshot_timer_init(void)
+{
+    replay_snapshot_next = replay_snapshot_period;
+    replay_snapshot_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                         replay_snapshot_tick, NULL);
+    timer_mod(replay_snapshot_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+              + REPLAY_SNAPSHOT_CHECK_MS);
+}
+
 void replay_vmstate_init(void)
 {
     Error *err = NULL;
+    uint64_t icount;
+    char *name;
 
-    if (replay_snapshot) {
+    if (replay_mode == REPLAY_MODE_PLAY && replay_break_icount != -1
+        && replay_snapshot
+        && replay_log_find_snapshot(replay_break_icount, &icount)) {
+        /* Start from the periodic snapshot closest to the seek target */
+        name = replay_snapshot_name(icount);
+        if (load_snapshot(name, &err) != 0) {
+            error_report_err(err);
+            error_report("Could not load snapshot %s for icount replay", name);
+            exit(1);
+        }
+        g_free(name);
+    } else if (replay_snapshot) {
         if (replay_mode == REPLAY_MODE_RECORD) {
             if (save_snapshot(replay_snapshot, &err) != 0) {
                 error_report_err(err);
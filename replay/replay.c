@@ -20,14 +20,11 @@
 #include "sysemu/sysemu.h"
 #include "qemu/error-report.h"
 
-/* Current version of the replay mechanism.
-   Increase it when file format changes. */
-#define REPLAY_VERSION              0xe02007
-/* Size of replay log header */
-#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
-
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
+uint64_t replay_snapshot_period;
+int64_t replay_break_icount = -1;
+static QEMUTimer *replay_break_timer;
 
 /* Name of replay file  */
 static char *replay_filename;
@@ -73,6 +70,19 @@ int replay_get_instructions(void)
     replay_mutex_lock();
     if (replay_next_event_is(EVENT_INSTRUCTION)) {
         res = replay_state.instructions_count;
+        /* Do not run past the instruction we were asked to stop at */
+        if (replay_break_icount != -1) {
+            uint64_t current = replay_get_current_step();
+
+            if (current >= replay_break_icount) {
+                /* Reached, or already past after a loadvm: stop now */
+                res = 0;
+                timer_mod_ns(replay_break_timer,
+                             qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+            } else {
+                res = MIN(res, replay_break_icount - current);
+            }
+        }
     }
     replay_mutex_unlock();
     return res;
@@ -91,6 +101,12 @@ void replay_account_executed_instructions(void)
 
             replay_state.instructions_count -= count;
             replay_state.current_step += count;
+            if (replay_break_icount != -1
+                && replay_state.current_step == replay_break_icount) {
+                /* The VM cannot be stopped from the vCPU thread */
+                timer_mod_ns(replay_break_timer,
+                             qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+            }
             if (replay_state.instructions_count == 0) {
                 assert(replay_state.data_kind == EVENT_INSTRUCTION);
                 replay_finish_event();
@@ -277,17 +293,8 @@ static void replay_enable(const char *fname, int mode)
     replay_state.current_step = 0;
     replay_state.has_unread_data = 0;
 
-    /* skip file header for RECORD and check it for PLAY */
-    if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
-    } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
-            fprintf(stderr, "Replay: invalid input log file version\n");
-            exit(1);
-        }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+    replay_log_open();
+    if (replay_mode == REPLAY_MODE_PLAY) {
         replay_fetch_data_kind();
     }
 
@@ -328,6 +335,19 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    replay_snapshot_period = qemu_opt_get_number(opts, "rrperiod", 0);
+    if (replay_snapshot_period &&
+        (mode != REPLAY_MODE_RECORD || !replay_snapshot)) {
+        error_report("rrperiod needs rr=record and rrsnapshot");
+        exit(1);
+    }
+    if (qemu_opt_get(opts, "rrseek")) {
+        if (mode != REPLAY_MODE_PLAY) {
+            error_report("rrseek needs rr=replay");
+            exit(1);
+        }
+        replay_break_icount = qemu_opt_get_number(opts, "rrseek", 0);
+    }
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -335,6 +355,16 @@ out:
     loc_pop(&loc);
 }
 
+static void replay_break_cb(void *opaque)
+{
+    /* The main loop runs timers with the replay mutex held */
+    g_assert(replay_mutex_locked());
+    vm_stop(RUN_STATE_PAUSED);
+    replay_break_icount = -1;
+    info_report("Replay: stopped at instruction %" PRIu64,
+                replay_get_current_step());
+}
+
 void replay_start(void)
 {
     if (replay_mode == REPLAY_MODE_NONE) {
@@ -350,7 +380,13 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    if (replay_snapshot_period) {
+        replay_snapshot_timer_init();
+    }
+    if (replay_break_icount != -1) {
+        replay_break_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                          replay_break_cb, NULL);
+    }
 
     replay_enable_events();
 }
@@ -368,12 +404,9 @@ void replay_finish(void)
         if (replay_mode == REPLAY_MODE_RECORD) {
             /* write end event */
             replay_put_event(EVENT_END);
-
-            /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
         }
 
+        replay_log_close();
         fclose(replay_file);
         replay_file = NULL;
     }
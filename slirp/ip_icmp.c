@@ -110,6 +110,7 @@ static int icmp_send(struct socket *so, struct mbuf *m, int hlen)
 
 void icmp_detach(struct socket *so)
 {
+    slirp_poll_forget(so);
     closesocket(so->s);
     sofree(so);
 }
@@ -330,6 +330,15 @@ Slirp *slirp_init(int restricted, bool in_enabled, struct in_addr vnetwork,
 
     slirp->opaque = opaque;
 
+#ifdef CONFIG_EPOLL_CREATE1
+    slirp->epoll_pollfds_idx = -1;
+    slirp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (slirp->epoll_fd == -1) {
+        /* fall back to one GPollFD per socket */
+        warn_report("slirp: epoll unavailable: %s", strerror(errno));
+    }
+#endif
+
     register_savevm_live(NULL, "slirp", 0, 4, &savevm_slirp_state, slirp);
 
     QTAILQ_INSERT_TAIL(&slirp_instances, slirp, entry);
@@ -349,6 +358,12 @@ void slirp_cleanup(Slirp *slirp)
 
     g_rand_free(slirp->grand);
 
+#ifdef CONFIG_EPOLL_CREATE1
+    if (slirp->epoll_fd != -1) {
+        close(slirp->epoll_fd);
+    }
+#endif
+
     g_free(slirp->vdnssearch);
     g_free(slirp->tftp_prefix);
     g_free(slirp->bootp_filename);
@@ -385,6 +400,124 @@ static void slirp_update_timeout(uint32_t *timeout)
     *timeout = t;
 }
 
+static void slirp_tcp_dispatch(struct socket *so, int revents);
+static void slirp_udp_dispatch(struct socket *so, int revents);
+static void slirp_icmp_dispatch(struct socket *so, int revents);
+
+#ifdef CONFIG_EPOLL_CREATE1
+static inline int slirp_epoll_events_from_pfd(int pfd_events)
+{
+    return (pfd_events & G_IO_IN ? EPOLLIN : 0) |
+           (pfd_events & G_IO_OUT ? EPOLLOUT : 0) |
+           (pfd_events & G_IO_PRI ? EPOLLPRI : 0) |
+           (pfd_events & G_IO_HUP ? EPOLLHUP : 0) |
+           (pfd_events & G_IO_ERR ? EPOLLERR : 0);
+}
+
+static inline int slirp_pfd_events_from_epoll(int epoll_events)
+{
+    return (epoll_events & EPOLLIN ? G_IO_IN : 0) |
+           (epoll_events & EPOLLOUT ? G_IO_OUT : 0) |
+           (epoll_events & EPOLLPRI ? G_IO_PRI : 0) |
+           (epoll_events & EPOLLHUP ? G_IO_HUP : 0) |
+           (epoll_events & EPOLLERR ? G_IO_ERR : 0);
+}
+
+/*
+ * Bring the epoll interest set of @so in line with @events.  The kernel
+ * keeps the set between iterations, so this is a no-op for sockets whose
+ * state did not change.
+ */
+static void slirp_epoll_update(Slirp *slirp, struct socket *so, int events)
+{
+    struct epoll_event event = {
+        .events = slirp_epoll_events_from_pfd(events),
+        .data.ptr = so,
+    };
+    int op, ret;
+
+    if (so->s == -1 || events == so->epoll_events) {
+        return;
+    }
+
+    if (!so->epoll_events) {
+        op = EPOLL_CTL_ADD;
+    } else if (!events) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        op = EPOLL_CTL_MOD;
+    }
+
+    ret = epoll_ctl(slirp->epoll_fd, op, so->s, &event);
+    if (ret == -1 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+        ret = epoll_ctl(slirp->epoll_fd, EPOLL_CTL_ADD, so->s, &event);
+    }
+    if (ret == -1 && op != EPOLL_CTL_DEL) {
+        error_report("slirp: failed to watch socket: %s", strerror(errno));
+        return;
+    }
+    so->epoll_events = events;
+}
+#endif
+
+/*
+ * Stop watching @so.  Must be called before its descriptor is closed:
+ * an epoll registration outlives close() while a forked child still
+ * holds the file open.
+ */
+void slirp_poll_forget(struct socket *so)
+{
+#ifdef CONFIG_EPOLL_CREATE1
+    Slirp *slirp = so->slirp;
+    int i;
+
+    if (slirp->epoll_fd == -1) {
+        return;
+    }
+    if (so->epoll_events && so->s != -1) {
+        epoll_ctl(slirp->epoll_fd, EPOLL_CTL_DEL, so->s, NULL);
+    }
+    so->epoll_events = 0;
+
+    /* a socket freed while dispatching must not be visited later on */
+    for (i = 0; i < slirp->epoll_nready; i++) {
+        if (slirp->epoll_ready[i].data.ptr == so) {
+            slirp->epoll_ready[i].data.ptr = NULL;
+        }
+    }
+#endif
+}
+
+/*
+ * Ask for @events on @so in the coming poll: with epoll the interest set
+ * lives in the kernel and only changes are pushed, otherwise the socket
+ * gets its own GPollFD.
+ */
+static void slirp_poll_socket(Slirp *slirp, GArray *pollfds,
+                              struct socket *so, int events,
+                              void (*dispatch)(struct socket *, int))
+{
+    so->pollfds_idx = -1;
+
+#ifdef CONFIG_EPOLL_CREATE1
+    if (slirp->epoll_fd != -1) {
+        /* the socket's list is not known from the epoll event alone */
+        so->epoll_dispatch = dispatch;
+        slirp_epoll_update(slirp, so, events);
+        return;
+    }
+#endif
+
+    if (events) {
+        GPollFD pfd = {
+            .fd = so->s,
+            .events = events,
+        };
+        so->pollfds_idx = pollfds->len;
+        g_array_append_val(pollfds, pfd);
+    }
+}
+
 void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
 {
     Slirp *slirp;
@@ -412,8 +545,6 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
 
             so_next = so->so_next;
 
-            so->pollfds_idx = -1;
-
             /*
              * See if we need a tcp_fasttimo
              */
@@ -427,6 +558,8 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
              * newly socreated() sockets etc. Don't want to select these.
              */
             if (so->so_state & SS_NOFDREF || so->s == -1) {
+                slirp_poll_socket(slirp, pollfds, so, 0,
+                                  slirp_tcp_dispatch);
                 continue;
             }
 
@@ -434,12 +567,9 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
              * Set for reading sockets which are accepting
              */
             if (so->so_state & SS_FACCEPTCONN) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
+                slirp_poll_socket(slirp, pollfds, so,
+                                  G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                  slirp_tcp_dispatch);
                 continue;
             }
 
@@ -447,12 +577,8 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
              * Set for writing sockets which are connecting
              */
             if (so->so_state & SS_ISFCONNECTING) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_OUT | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
+                slirp_poll_socket(slirp, pollfds, so, G_IO_OUT | G_IO_ERR,
+                                  slirp_tcp_dispatch);
                 continue;
             }
 
@@ -473,14 +599,8 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
                 events |= G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_PRI;
             }
 
-            if (events) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = events,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
-            }
+            slirp_poll_socket(slirp, pollfds, so, events,
+                              slirp_tcp_dispatch);
         }
 
         /*
@@ -490,8 +610,6 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
                 so = so_next) {
             so_next = so->so_next;
 
-            so->pollfds_idx = -1;
-
             /*
              * See if it's timed out
              */
@@ -515,12 +633,12 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
              * (XXX <= 4 ?)
              */
             if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
+                slirp_poll_socket(slirp, pollfds, so,
+                                  G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                  slirp_udp_dispatch);
+            } else {
+                slirp_poll_socket(slirp, pollfds, so, 0,
+                                  slirp_udp_dispatch);
             }
         }
 
@@ -531,8 +649,6 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
                 so = so_next) {
             so_next = so->so_next;
 
-            so->pollfds_idx = -1;
-
             /*
              * See if it's timed out
              */
@@ -546,23 +662,226 @@ void slirp_pollfds_fill(GArray *pollfds, uint32_t *timeout)
             }
 
             if (so->so_state & SS_ISFCONNECTED) {
-                GPollFD pfd = {
-                    .fd = so->s,
-                    .events = G_IO_IN | G_IO_HUP | G_IO_ERR,
-                };
-                so->pollfds_idx = pollfds->len;
-                g_array_append_val(pollfds, pfd);
+                slirp_poll_socket(slirp, pollfds, so,
+                                  G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                  slirp_icmp_dispatch);
+            } else {
+                slirp_poll_socket(slirp, pollfds, so, 0,
+                                  slirp_icmp_dispatch);
             }
         }
+
+#ifdef CONFIG_EPOLL_CREATE1
+        /* all of this instance's sockets are reported through one fd */
+        if (slirp->epoll_fd != -1) {
+            GPollFD pfd = {
+                .fd = slirp->epoll_fd,
+                .events = G_IO_IN,
+            };
+            slirp->epoll_pollfds_idx = pollfds->len;
+            g_array_append_val(pollfds, pfd);
+        }
+#endif
     }
     slirp_update_timeout(timeout);
 }
 
+static void slirp_tcp_dispatch(struct socket *so, int revents)
+{
+    int ret;
+
+    if (so->so_state & SS_NOFDREF || so->s == -1) {
+        return;
+    }
+
+    /*
+     * Check for URG data
+     * This will soread as well, so no need to
+     * test for G_IO_IN below if this succeeds
+     */
+    if (revents & G_IO_PRI) {
+        ret = sorecvoob(so);
+        if (ret < 0) {
+            /* Socket error might have resulted in the socket being
+             * removed, do not try to do anything more with it. */
+            return;
+        }
+    }
+    /*
+     * Check sockets for reading
+     */
+    else if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
+        /*
+         * Check for incoming connections
+         */
+        if (so->so_state & SS_FACCEPTCONN) {
+            tcp_connect(so);
+            return;
+        } /* else */
+        ret = soread(so);
+
+        /* Output it if we read something */
+        if (ret > 0) {
+            tcp_output(sototcpcb(so));
+        }
+        if (ret < 0) {
+            /* Socket error might have resulted in the socket being
+             * removed, do not try to do anything more with it. */
+            return;
+        }
+    }
+
+    /*
+     * Check sockets for writing
+     */
+    if (!(so->so_state & SS_NOFDREF) &&
+            (revents & (G_IO_OUT | G_IO_ERR))) {
+        /*
+         * Check for non-blocking, still-connecting sockets
+         */
+        if (so->so_state & SS_ISFCONNECTING) {
+            /* Connected */
+            so->so_state &= ~SS_ISFCONNECTING;
+
+            ret = send(so->s, (const void *) &ret, 0, 0);
+            if (ret < 0) {
+                /* XXXXX Must fix, zero bytes is a NOP */
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == ENOTCONN) {
+                    return;
+                }
+
+                /* else failed */
+                so->so_state &= SS_PERSISTENT_MASK;
+                so->so_state |= SS_NOFDREF;
+            }
+            /* else so->so_state &= ~SS_ISFCONNECTING; */
+
+            /*
+             * Continue tcp_input
+             */
+            tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
+                      so->so_ffamily);
+            /* continue; */
+        } else {
+            ret = sowrite(so);
+            if (ret > 0) {
+                /* Call tcp_output in case we need to send a window
+                 * update to the guest, otherwise it will be stuck
+                 * until it sends a window probe. */
+                tcp_output(sototcpcb(so));
+            }
+        }
+    }
+
+    /*
+     * Probe a still-connecting, non-blocking socket
+     * to check if it's still alive
+     */
+#ifdef PROBE_CONN
+    if (so->so_state & SS_ISFCONNECTING) {
+        ret = qemu_recv(so->s, &ret, 0, 0);
+
+        if (ret < 0) {
+            /* XXX */
+            if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == EINPROGRESS || errno == ENOTCONN) {
+                return; /* Still connecting, continue */
+            }
+
+            /* else failed */
+            so->so_state &= SS_PERSISTENT_MASK;
+            so->so_state |= SS_NOFDREF;
+
+            /* tcp_input will take care of it */
+        } else {
+            ret = send(so->s, &ret, 0, 0);
+            if (ret < 0) {
+                /* XXX */
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == ENOTCONN) {
+                    return;
+                }
+                /* else failed */
+                so->so_state &= SS_PERSISTENT_MASK;
+                so->so_state |= SS_NOFDREF;
+            } else {
+                so->so_state &= ~SS_ISFCONNECTING;
+            }
+
+        }
+        tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
+                  so->so_ffamily);
+    } /* SS_ISFCONNECTING */
+#endif
+}
+
+/*
+ * Incoming UDP packets are sent straight away, they're not buffered.
+ * Incoming UDP data isn't buffered either.
+ */
+static void slirp_udp_dispatch(struct socket *so, int revents)
+{
+    if (so->s != -1 &&
+        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
+        sorecvfrom(so);
+    }
+}
+
+/*
+ * Check incoming ICMP relies.
+ */
+static void slirp_icmp_dispatch(struct socket *so, int revents)
+{
+    if (so->s != -1 &&
+        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
+        icmp_receive(so);
+    }
+}
+
+static inline int slirp_socket_revents(GArray *pollfds, struct socket *so)
+{
+    if (so->pollfds_idx == -1) {
+        return 0;
+    }
+    return g_array_index(pollfds, GPollFD, so->pollfds_idx).revents;
+}
+
+#ifdef CONFIG_EPOLL_CREATE1
+/* Visit only the sockets epoll reported as ready */
+static void slirp_epoll_dispatch(Slirp *slirp, GArray *pollfds)
+{
+    struct socket *so;
+    int i, revents;
+
+    if (slirp->epoll_pollfds_idx == -1 ||
+        !(g_array_index(pollfds, GPollFD,
+                        slirp->epoll_pollfds_idx).revents & G_IO_IN)) {
+        return;
+    }
+    slirp->epoll_pollfds_idx = -1;
+
+    do {
+        slirp->epoll_nready = epoll_wait(slirp->epoll_fd, slirp->epoll_ready,
+                                         SLIRP_EPOLL_MAX_EVENTS, 0);
+    } while (slirp->epoll_nready == -1 && errno == EINTR);
+
+    for (i = 0; i < slirp->epoll_nready; i++) {
+        so = slirp->epoll_ready[i].data.ptr;
+        if (!so) {
+            continue;   /* freed by an earlier socket's handler */
+        }
+        revents = slirp_pfd_events_from_epoll(slirp->epoll_ready[i].events);
+        so->epoll_dispatch(so, revents);
+    }
+    slirp->epoll_nready = 0;
+}
+#endif
+
 void slirp_pollfds_poll(GArray *pollfds, int select_error)
 {
     Slirp *slirp;
     struct socket *so, *so_next;
-    int ret;
 
     if (QTAILQ_EMPTY(&slirp_instances)) {
         return;
@@ -590,168 +909,30 @@ void slirp_pollfds_poll(GArray *pollfds, int select_error)
          * Check sockets
          */
         if (!select_error) {
+#ifdef CONFIG_EPOLL_CREATE1
+            if (slirp->epoll_fd != -1) {
+                slirp_epoll_dispatch(slirp, pollfds);
+                if_start(slirp);
+                continue;
+            }
+#endif
+
             /*
              * Check TCP sockets
              */
             for (so = slirp->tcb.so_next; so != &slirp->tcb;
                     so = so_next) {
-                int revents;
-
                 so_next = so->so_next;
-
-                revents = 0;
-                if (so->pollfds_idx != -1) {
-                    revents = g_array_index(pollfds, GPollFD,
-                                            so->pollfds_idx).revents;
-                }
-
-                if (so->so_state & SS_NOFDREF || so->s == -1) {
-                    continue;
-                }
-
-                /*
-                 * Check for URG data
-                 * This will soread as well, so no need to
-                 * test for G_IO_IN below if this succeeds
-                 */
-                if (revents & G_IO_PRI) {
-                    ret = sorecvoob(so);
-                    if (ret < 0) {
-                        /* Socket error might have resulted in the socket being
-                         * removed, do not try to do anything more with it. */
-                        continue;
-                    }
-                }
-                /*
-                 * Check sockets for reading
-                 */
-                else if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
-                    /*
-                     * Check for incoming connections
-                     */
-                    if (so->so_state & SS_FACCEPTCONN) {
-                        tcp_connect(so);
-                        continue;
-                    } /* else */
-                    ret = soread(so);
-
-                    /* Output it if we read something */
-                    if (ret > 0) {
-                        tcp_output(sototcpcb(so));
-                    }
-                    if (ret < 0) {
-                        /* Socket error might have resulted in the socket being
-                         * removed, do not try to do anything more with it. */
-                        continue;
-                    }
-                }
-
-                /*
-                 * Check sockets for writing
-                 */
-                if (!(so->so_state & SS_NOFDREF) &&
-                        (revents & (G_IO_OUT | G_IO_ERR))) {
-                    /*
-                     * Check for non-blocking, still-connecting sockets
-                     */
-                    if (so->so_state & SS_ISFCONNECTING) {
-                        /* Connected */
-                        so->so_state &= ~SS_ISFCONNECTING;
-
-                        ret = send(so->s, (const void *) &ret, 0, 0);
-                        if (ret < 0) {
-                            /* XXXXX Must fix, zero bytes is a NOP */
-                            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                                errno == EINPROGRESS || errno == ENOTCONN) {
-                                continue;
-                            }
-
-                            /* else failed */
-                            so->so_state &= SS_PERSISTENT_MASK;
-                            so->so_state |= SS_NOFDREF;
-                        }
-                        /* else so->so_state &= ~SS_ISFCONNECTING; */
-
-                        /*
-                         * Continue tcp_input
-                         */
-                        tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
-                                  so->so_ffamily);
-                        /* continue; */
-                    } else {
-                        ret = sowrite(so);
-                        if (ret > 0) {
-                            /* Call tcp_output in case we need to send a window
-                             * update to the guest, otherwise it will be stuck
-                             * until it sends a window probe. */
-                            tcp_output(sototcpcb(so));
-                        }
-                    }
-                }
-
-                /*
-                 * Probe a still-connecting, non-blocking socket
-                 * to check if it's still alive
-                 */
-#ifdef PROBE_CONN
-                if (so->so_state & SS_ISFCONNECTING) {
-                    ret = qemu_recv(so->s, &ret, 0, 0);
-
-                    if (ret < 0) {
-                        /* XXX */
-                        if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                            errno == EINPROGRESS || errno == ENOTCONN) {
-                            continue; /* Still connecting, continue */
-                        }
-
-                        /* else failed */
-                        so->so_state &= SS_PERSISTENT_MASK;
-                        so->so_state |= SS_NOFDREF;
-
-                        /* tcp_input will take care of it */
-                    } else {
-                        ret = send(so->s, &ret, 0, 0);
-                        if (ret < 0) {
-                            /* XXX */
-                            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                                errno == EINPROGRESS || errno == ENOTCONN) {
-                                continue;
-                            }
-                            /* else failed */
-                            so->so_state &= SS_PERSISTENT_MASK;
-                            so->so_state |= SS_NOFDREF;
-                        } else {
-                            so->so_state &= ~SS_ISFCONNECTING;
-                        }
-
-                    }
-                    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so,
-                              so->so_ffamily);
-                } /* SS_ISFCONNECTING */
-#endif
+                slirp_tcp_dispatch(so, slirp_socket_revents(pollfds, so));
             }
 
             /*
              * Now UDP sockets.
-             * Incoming packets are sent straight away, they're not buffered.
-             * Incoming UDP data isn't buffered either.
              */
             for (so = slirp->udb.so_next; so != &slirp->udb;
                     so = so_next) {
-                int revents;
-
                 so_next = so->so_next;
-
-                revents = 0;
-                if (so->pollfds_idx != -1) {
-                    revents = g_array_index(pollfds, GPollFD,
-                            so->pollfds_idx).revents;
-                }
-
-                if (so->s != -1 &&
-                    (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
-                    sorecvfrom(so);
-                }
+                slirp_udp_dispatch(so, slirp_socket_revents(pollfds, so));
             }
 
             /*
@@ -759,20 +940,8 @@ void slirp_pollfds_poll(GArray *pollfds, int select_error)
              */
             for (so = slirp->icmp.so_next; so != &slirp->icmp;
                     so = so_next) {
-                    int revents;
-
-                    so_next = so->so_next;
-
-                    revents = 0;
-                    if (so->pollfds_idx != -1) {
-                        revents = g_array_index(pollfds, GPollFD,
-                                                so->pollfds_idx).revents;
-                    }
-
-                    if (so->s != -1 &&
-                        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
-                    icmp_receive(so);
-                }
+                so_next = so->so_next;
+                slirp_icmp_dispatch(so, slirp_socket_revents(pollfds, so));
             }
         }
 
@@ -1038,7 +1207,8 @@ int slirp_remove_hostfwd(Slirp *slirp, int is_udp, struct in_addr host_addr,
             getsockname(so->s, (struct sockaddr *)&addr, &addr_len) == 0 &&
             addr.sin_addr.s_addr == host_addr.s_addr &&
             addr.sin_port == port) {
-            close(so->s);
+            slirp_poll_forget(so);
+            closesocket(so->s);
             sofree(so);
             return 0;
         }
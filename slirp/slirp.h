@@ -149,6 +149,13 @@ void ndp_table_add(Slirp *slirp, struct in6_addr ip_addr,
 bool ndp_table_search(Slirp *slirp, struct in6_addr ip_addr,
                       uint8_t out_ethaddr[ETH_ALEN]);
 
+#ifdef CONFIG_EPOLL_CREATE1
+#include <sys/epoll.h>
+
+/* ready sockets fetched per epoll_wait() */
+#define SLIRP_EPOLL_MAX_EVENTS 128
+#endif
+
 struct Slirp {
     QTAILQ_ENTRY(Slirp) entry;
     u_int time_fasttimo;
@@ -220,6 +227,14 @@ struct Slirp {
     GRand *grand;
     QEMUTimer *ra_timer;
 
+#ifdef CONFIG_EPOLL_CREATE1
+    /* socket readiness is tracked by epoll when available (fd != -1) */
+    int epoll_fd;
+    int epoll_pollfds_idx;
+    struct epoll_event epoll_ready[SLIRP_EPOLL_MAX_EVENTS];
+    int epoll_nready;
+#endif
+
     void *opaque;
 };
 
@@ -230,6 +245,7 @@ extern Slirp *slirp_instance;
 #endif
 
 void if_start(Slirp *);
+void slirp_poll_forget(struct socket *so);
 
 /* ncsi.c */
 void ncsi_input(Slirp *slirp, const uint8_t *pkt, int pkt_len);
@@ -86,6 +86,7 @@ sofree(struct socket *so)
 {
   Slirp *slirp = so->slirp;
 
+  slirp_poll_forget(so);
   soqfree(so, &slirp->if_fastq);
   soqfree(so, &slirp->if_batchq);
 
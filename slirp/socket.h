@@ -27,6 +27,8 @@ struct socket {
   int s;                           /* The actual socket */
 
   int pollfds_idx;                 /* GPollFD GArray index */
+  int epoll_events;                /* G_IO_* events registered with epoll */
+  void (*epoll_dispatch)(struct socket *so, int revents);
 
   Slirp *slirp;			   /* managing slirp instance */
 
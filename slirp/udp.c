@@ -293,6 +293,7 @@ udp_attach(struct socket *so, unsigned short af)
 void
 udp_detach(struct socket *so)
 {
+	slirp_poll_forget(so);
 	closesocket(so->s);
 	sofree(so);
 }
@@ -1351,6 +1351,51 @@ static inline AArch64DecodeFn *lookup_disas_fn(const AArch64DecodeTable *table,
  * match up with those in the manual.
  */
 
+/* Go on translating a hot superblock at @dest instead of jumping there */
+static void superblock_continue(DisasContext *s, uint64_t dest)
+{
+    /* The remaining insns must still fit in this page */
+    int bound = -(dest | TARGET_PAGE_MASK) / 4;
+
+    s->base.max_insns = MIN(s->base.max_insns, s->base.num_insns + bound);
+    s->pc = dest;
+}
+
+/*
+ * End a conditional branch to @addr, whose condition jumps to
+ * @label_match when true.
+ *
+ * A hot superblock goes on along the side that is likely to be taken:
+ * a backward branch is assumed to close a loop and be taken, a forward
+ * one to skip over cold code and fall through.  There is no profile to
+ * say otherwise.  The other side leaves the TB through
+ * lookup_and_goto_ptr, which needs none of the two goto_tb slots.
+ */
+static void gen_cond_b(DisasContext *s, TCGLabel *label_match, uint64_t addr)
+{
+    bool backward = addr < s->pc;
+    uint64_t hot = backward ? addr : s->pc;
+
+    if (use_goto_tb(s, 0, hot) &&
+        translator_superblock_goto(&s->base, s->pc, hot)) {
+        TCGLabel *label_hot = backward ? label_match : gen_new_label();
+
+        if (!backward) {
+            tcg_gen_br(label_hot);
+            gen_set_label(label_match);
+        }
+        gen_a64_set_pc_im(backward ? s->pc : addr);
+        tcg_gen_lookup_and_goto_ptr();
+        gen_set_label(label_hot);
+        superblock_continue(s, hot);
+        return;
+    }
+
+    gen_goto_tb(s, 0, s->pc);
+    gen_set_label(label_match);
+    gen_goto_tb(s, 1, addr);
+}
+
 /* Unconditional branch (immediate)
  *   31  30       26 25                                  0
  * +----+-----------+-------------------------------------+
@@ -1366,6 +1411,13 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
         tcg_gen_movi_i64(cpu_reg(s, 30), s->pc);
     }
 
+    /* Hot superblock: keep translating at the destination */
+    if (use_goto_tb(s, 0, addr) &&
+        translator_superblock_goto(&s->base, s->pc, addr)) {
+        superblock_continue(s, addr);
+        return;
+    }
+
     /* B Branch / BL Branch with link */
     gen_goto_tb(s, 0, addr);
 }
@@ -1394,9 +1446,7 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
     tcg_gen_brcondi_i64(op ? TCG_COND_NE : TCG_COND_EQ,
                         tcg_cmp, 0, label_match);
 
-    gen_goto_tb(s, 0, s->pc);
-    gen_set_label(label_match);
-    gen_goto_tb(s, 1, addr);
+    gen_cond_b(s, label_match, addr);
 }
 
 /* Test and branch (immediate)
@@ -1423,9 +1473,7 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
     tcg_gen_brcondi_i64(op ? TCG_COND_NE : TCG_COND_EQ,
                         tcg_cmp, 0, label_match);
     tcg_temp_free_i64(tcg_cmp);
-    gen_goto_tb(s, 0, s->pc);
-    gen_set_label(label_match);
-    gen_goto_tb(s, 1, addr);
+    gen_cond_b(s, label_match, addr);
 }
 
 /* Conditional branch (immediate)
@@ -1450,11 +1498,14 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
         /* genuinely conditional branches */
         TCGLabel *label_match = gen_new_label();
         arm_gen_test_cc(cond, label_match);
-        gen_goto_tb(s, 0, s->pc);
-        gen_set_label(label_match);
-        gen_goto_tb(s, 1, addr);
+        gen_cond_b(s, label_match, addr);
     } else {
         /* 0xe and 0xf are both "always" conditions */
+        if (use_goto_tb(s, 0, addr) &&
+            translator_superblock_goto(&s->base, s->pc, addr)) {
+            superblock_continue(s, addr);
+            return;
+        }
         gen_goto_tb(s, 0, addr);
     }
 }
@@ -1933,7 +1984,8 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
         if (opc == 1) {
             tcg_gen_movi_i64(cpu_reg(s, 30), s->pc);
         }
-        break;
+        s->base.is_jmp = DISAS_JUMP_IND;
+        return;
     case 4: /* ERET */
         if (s->current_el == 0) {
             unallocated_encoding(s);
@@ -1960,8 +2012,6 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
         unallocated_encoding(s);
         return;
     }
-
-    s->base.is_jmp = DISAS_JUMP;
 }
 
 /* Branches, exception generating and system instructions */
@@ -13524,6 +13574,7 @@ static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
             /* fall through */
         case DISAS_EXIT:
         case DISAS_JUMP:
+        case DISAS_JUMP_IND:
             if (dc->base.singlestep_enabled) {
                 gen_exception_internal(EXCP_DEBUG);
             } else {
@@ -13549,6 +13600,14 @@ static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
         case DISAS_JUMP:
             tcg_gen_lookup_and_goto_ptr();
             break;
+        case DISAS_JUMP_IND:
+            /* BR, BLR and RET end the TB, so no goto_tb slot is in use */
+            if (tb_cflags(dc->base.tb) & CF_LAST_IO) {
+                tcg_gen_lookup_and_goto_ptr();
+            } else {
+                tcg_gen_lookup_and_goto_ptr_pred(dc->base.tb, 0, cpu_pc);
+            }
+            break;
         case DISAS_NORETURN:
         case DISAS_SWI:
             break;
@@ -13600,4 +13659,5 @@ const TranslatorOps aarch64_translator_ops = {
     .translate_insn     = aarch64_tr_translate_insn,
     .tb_stop            = aarch64_tr_tb_stop,
     .disas_log          = aarch64_tr_disas_log,
+    .superblocks        = true,
 };
@@ -151,6 +151,10 @@ static inline void disas_set_insn_syndrome(DisasContext *s, uint32_t syn)
  * helper) has done so before we reach return from cpu_tb_exec.
  */
 #define DISAS_EXIT      DISAS_TARGET_9
+/* Indirect branch which only changed the PC, so that the target can be
+ * predicted with tcg_gen_lookup_and_goto_ptr_pred().
+ */
+#define DISAS_JUMP_IND  DISAS_TARGET_10
 
 #ifdef TARGET_AARCH64
 void a64_translate_init(void);
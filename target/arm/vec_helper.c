@@ -690,17 +690,26 @@ void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
     }                                                                      \
 }
 
+/* Likewise, for operations that softfloat provides on whole vectors */
+#define DO_3OP_VEC(NAME, FUNC, TYPE) \
+void HELPER(NAME)(void *vd, void *vn, void *vm, void *stat, uint32_t desc) \
+{                                                                          \
+    FUNC(vd, vn, vm, simd_oprsz(desc) / sizeof(TYPE), stat);               \
+}
+
 DO_3OP(gvec_fadd_h, float16_add, float16)
-DO_3OP(gvec_fadd_s, float32_add, float32)
-DO_3OP(gvec_fadd_d, float64_add, float64)
+DO_3OP_VEC(gvec_fadd_s, float32_vec_add, float32)
+DO_3OP_VEC(gvec_fadd_d, float64_vec_add, float64)
 
 DO_3OP(gvec_fsub_h, float16_sub, float16)
-DO_3OP(gvec_fsub_s, float32_sub, float32)
-DO_3OP(gvec_fsub_d, float64_sub, float64)
+DO_3OP_VEC(gvec_fsub_s, float32_vec_sub, float32)
+DO_3OP_VEC(gvec_fsub_d, float64_vec_sub, float64)
 
 DO_3OP(gvec_fmul_h, float16_mul, float16)
-DO_3OP(gvec_fmul_s, float32_mul, float32)
-DO_3OP(gvec_fmul_d, float64_mul, float64)
+DO_3OP_VEC(gvec_fmul_s, float32_vec_mul, float32)
+DO_3OP_VEC(gvec_fmul_d, float64_vec_mul, float64)
+
+#undef DO_3OP_VEC
 
 DO_3OP(gvec_ftsmul_h, float16_ftsmul, float16)
 DO_3OP(gvec_ftsmul_s, float32_ftsmul, float32)
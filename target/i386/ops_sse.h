@@ -619,9 +619,41 @@ void glue(helper_pshufhw, SUFFIX)(Reg *d, Reg *s, int order)
 #define FPU_MAX(size, a, b)                                     \
     (float ## size ## _lt(b, a, &env->sse_status) ? (a) : (b))
 
-SSE_HELPER_S(add, FPU_ADD)
-SSE_HELPER_S(sub, FPU_SUB)
-SSE_HELPER_S(mul, FPU_MUL)
+/*
+ * Packed forms of the operations softfloat provides on whole vectors.
+ * The lanes are contiguous in memory whatever the host byte order, in
+ * reverse order on big-endian hosts, which does not matter element-wise.
+ */
+#define SSE_HELPER_S_VEC(name, F)                                       \
+    void helper_ ## name ## ps(CPUX86State *env, Reg *d, Reg *s)        \
+    {                                                                   \
+        float32 *dp = MIN(&d->ZMM_S(0), &d->ZMM_S(3));                  \
+                                                                        \
+        float32_vec_ ## name(dp, dp, MIN(&s->ZMM_S(0), &s->ZMM_S(3)),   \
+                             4, &env->sse_status);                      \
+    }                                                                   \
+                                                                        \
+    void helper_ ## name ## ss(CPUX86State *env, Reg *d, Reg *s)        \
+    {                                                                   \
+        d->ZMM_S(0) = F(32, d->ZMM_S(0), s->ZMM_S(0));                  \
+    }                                                                   \
+                                                                        \
+    void helper_ ## name ## pd(CPUX86State *env, Reg *d, Reg *s)        \
+    {                                                                   \
+        float64 *dp = MIN(&d->ZMM_D(0), &d->ZMM_D(1));                  \
+                                                                        \
+        float64_vec_ ## name(dp, dp, MIN(&s->ZMM_D(0), &s->ZMM_D(1)),   \
+                             2, &env->sse_status);                      \
+    }                                                                   \
+                                                                        \
+    void helper_ ## name ## sd(CPUX86State *env, Reg *d, Reg *s)        \
+    {                                                                   \
+        d->ZMM_D(0) = F(64, d->ZMM_D(0), s->ZMM_D(0));                  \
+    }
+
+SSE_HELPER_S_VEC(add, FPU_ADD)
+SSE_HELPER_S_VEC(sub, FPU_SUB)
+SSE_HELPER_S_VEC(mul, FPU_MUL)
 SSE_HELPER_S(div, FPU_DIV)
 SSE_HELPER_S(min, FPU_MIN)
 SSE_HELPER_S(max, FPU_MAX)
@@ -154,6 +154,8 @@ bool have_bmi1;
 bool have_popcnt;
 bool have_avx1;
 bool have_avx2;
+/* AVX-512 F, BW and DQ: all element sizes, and vpmovm2* for compares.  */
+bool have_avx512;
 
 #ifdef CONFIG_CPUID_H
 static bool have_movbe;
@@ -323,6 +325,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define P_SIMDF3        0x20000         /* 0xf3 opcode prefix */
 #define P_SIMDF2        0x40000         /* 0xf2 opcode prefix */
 #define P_VEXL          0x80000         /* Set VEX.L = 1 */
+#define P_EVEX          0x100000        /* EVEX encoding, 512-bit length */
 
 #define OPC_ARITH_EvIz	(0x81)
 #define OPC_ARITH_EvIb	(0x83)
@@ -441,6 +444,11 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_VPBROADCASTD (0x58 | P_EXT38 | P_DATA16)
 #define OPC_VPBROADCASTQ (0x59 | P_EXT38 | P_DATA16)
 #define OPC_VPERMQ      (0x00 | P_EXT3A | P_DATA16 | P_REXW)
+#define OPC_VPMOVM2B    (0x28 | P_EXT38 | P_SIMDF3)
+#define OPC_VPMOVM2W    (0x28 | P_EXT38 | P_SIMDF3 | P_REXW)
+#define OPC_VPMOVM2D    (0x38 | P_EXT38 | P_SIMDF3)
+#define OPC_VPMOVM2Q    (0x38 | P_EXT38 | P_SIMDF3 | P_REXW)
+#define OPC_VPTERNLOGD  (0x25 | P_EXT3A | P_DATA16)
 #define OPC_VPERM2I128  (0x46 | P_EXT3A | P_DATA16 | P_VEXL)
 #define OPC_VZEROUPPER  (0x77 | P_EXT)
 #define OPC_XCHG_ax_r32	(0x90)
@@ -594,11 +602,60 @@ static void tcg_out_modrm(TCGContext *s, int opc, int r, int rm)
     tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
 }
 
+/* Output an EVEX prefix for a 512-bit operation.  Only zmm0-15 are
+   allocated, so EVEX.R' and EVEX.V' are constant, and no write mask
+   is used.  */
+static void tcg_out_evex_opc(TCGContext *s, int opc, int r, int v,
+                             int rm, int index)
+{
+    int tmp;
+
+    tcg_out8(s, 0x62);
+
+    /* EVEX.mm */
+    if (opc & P_EXT3A) {
+        tmp = 3;
+    } else if (opc & P_EXT38) {
+        tmp = 2;
+    } else if (opc & P_EXT) {
+        tmp = 1;
+    } else {
+        g_assert_not_reached();
+    }
+    tmp |= (r & 8 ? 0 : 0x80);             /* EVEX.R */
+    tmp |= (index & 8 ? 0 : 0x40);         /* EVEX.X */
+    tmp |= (rm & 8 ? 0 : 0x20);            /* EVEX.B */
+    tmp |= 0x10;                           /* EVEX.R' */
+    tcg_out8(s, tmp);
+
+    tmp = (opc & P_REXW ? 0x80 : 0);       /* EVEX.W */
+    tmp |= (~v & 15) << 3;                 /* EVEX.vvvv */
+    tmp |= 0x04;
+    /* EVEX.pp */
+    if (opc & P_DATA16) {
+        tmp |= 1;                          /* 0x66 */
+    } else if (opc & P_SIMDF3) {
+        tmp |= 2;                          /* 0xf3 */
+    } else if (opc & P_SIMDF2) {
+        tmp |= 3;                          /* 0xf2 */
+    }
+    tcg_out8(s, tmp);
+
+    /* EVEX.L'L = 512 bits, EVEX.V', no masking.  */
+    tcg_out8(s, 0x48);
+    tcg_out8(s, opc);
+}
+
 static void tcg_out_vex_opc(TCGContext *s, int opc, int r, int v,
                             int rm, int index)
 {
     int tmp;
 
+    if (opc & P_EVEX) {
+        tcg_out_evex_opc(s, opc, r, v, rm, index);
+        return;
+    }
+
     /* Use the two byte form if possible, which cannot encode
        VEX.W, VEX.B, VEX.X, or an m-mmmm field other than P_EXT.  */
     if ((opc & (P_EXT | P_EXT38 | P_EXT3A | P_REXW)) == P_EXT
@@ -655,8 +712,9 @@ static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
    that will follow the instruction.  */
 
 static void tcg_out_sib_offset(TCGContext *s, int r, int rm, int index,
-                               int shift, intptr_t offset)
+                               int shift, intptr_t offset, int disp8_shift)
 {
+    intptr_t disp8 = offset >> disp8_shift;
     int mod, len;
 
     if (index < 0 && rm < 0) {
@@ -697,7 +755,7 @@ static void tcg_out_sib_offset(TCGContext *s, int r, int rm, int index,
         mod = 0, len = 4, rm = 5;
     } else if (offset == 0 && LOWREGMASK(rm) != TCG_REG_EBP) {
         mod = 0, len = 0;
-    } else if (offset == (int8_t)offset) {
+    } else if (disp8 == (int8_t)disp8 && disp8 << disp8_shift == offset) {
         mod = 0x40, len = 1;
     } else {
         mod = 0x80, len = 4;
@@ -725,7 +783,7 @@ static void tcg_out_sib_offset(TCGContext *s, int r, int rm, int index,
     }
 
     if (len == 1) {
-        tcg_out8(s, offset);
+        tcg_out8(s, disp8);
     } else if (len == 4) {
         tcg_out32(s, offset);
     }
@@ -735,7 +793,7 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
                                      int index, int shift, intptr_t offset)
 {
     tcg_out_opc(s, opc, r, rm < 0 ? 0 : rm, index < 0 ? 0 : index);
-    tcg_out_sib_offset(s, r, rm, index, shift, offset);
+    tcg_out_sib_offset(s, r, rm, index, shift, offset, 0);
 }
 
 static void tcg_out_vex_modrm_sib_offset(TCGContext *s, int opc, int r, int v,
@@ -743,7 +801,10 @@ static void tcg_out_vex_modrm_sib_offset(TCGContext *s, int opc, int r, int v,
                                          intptr_t offset)
 {
     tcg_out_vex_opc(s, opc, r, v, rm < 0 ? 0 : rm, index < 0 ? 0 : index);
-    tcg_out_sib_offset(s, r, rm, index, shift, offset);
+    /* EVEX scales an 8-bit displacement by the access size, which is
+       the whole vector for the loads and stores that use memory.  */
+    tcg_out_sib_offset(s, r, rm, index, shift, offset,
+                       opc & P_EVEX ? 6 : 0);
 }
 
 /* A simplification of the above with no index or shift.  */
@@ -826,12 +887,30 @@ static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
         tcg_debug_assert(ret >= 16 && arg >= 16);
         tcg_out_vex_modrm(s, OPC_MOVDQA_VxWx | P_VEXL, ret, 0, arg);
         break;
+    case TCG_TYPE_V512:
+        tcg_debug_assert(ret >= 16 && arg >= 16);
+        tcg_out_vex_modrm(s, OPC_MOVDQA_VxWx | P_EVEX, ret, 0, arg);
+        break;
 
     default:
         g_assert_not_reached();
     }
 }
 
+/* Return the prefix flags that select the vector length of TYPE.
+   With EVEX, W also selects the 64-bit element form of most insns.  */
+static int vec_len_flags(TCGType type, unsigned vece)
+{
+    switch (type) {
+    case TCG_TYPE_V256:
+        return P_VEXL;
+    case TCG_TYPE_V512:
+        return P_EVEX | (vece == MO_64 ? P_REXW : 0);
+    default:
+        return 0;
+    }
+}
+
 static void tcg_out_dup_vec(TCGContext *s, TCGType type, unsigned vece,
                             TCGReg r, TCGReg a)
 {
@@ -840,8 +919,8 @@ static void tcg_out_dup_vec(TCGContext *s, TCGType type, unsigned vece,
             OPC_VPBROADCASTB, OPC_VPBROADCASTW,
             OPC_VPBROADCASTD, OPC_VPBROADCASTQ,
         };
-        int vex_l = (type == TCG_TYPE_V256 ? P_VEXL : 0);
-        tcg_out_vex_modrm(s, dup_insn[vece] + vex_l, r, 0, a);
+        tcg_out_vex_modrm(s, dup_insn[vece] | vec_len_flags(type, vece),
+                          r, 0, a);
     } else {
         switch (vece) {
         case MO_8:
@@ -872,12 +951,19 @@ static void tcg_out_dupi_vec(TCGContext *s, TCGType type,
 {
     int vex_l = (type == TCG_TYPE_V256 ? P_VEXL : 0);
 
+    /* VEX-encoded insns also clear the high part of a zmm register.  */
     if (arg == 0) {
         tcg_out_vex_modrm(s, OPC_PXOR, ret, ret, ret);
         return;
     }
     if (arg == -1) {
-        tcg_out_vex_modrm(s, OPC_PCMPEQB + vex_l, ret, ret, ret);
+        if (type == TCG_TYPE_V512) {
+            /* There is no EVEX compare into a vector register.  */
+            tcg_out_vex_modrm(s, OPC_VPTERNLOGD | P_EVEX, ret, ret, ret);
+            tcg_out8(s, 0xff);
+        } else {
+            tcg_out_vex_modrm(s, OPC_PCMPEQB + vex_l, ret, ret, ret);
+        }
         return;
     }
 
@@ -885,7 +971,8 @@ static void tcg_out_dupi_vec(TCGContext *s, TCGType type,
         if (type == TCG_TYPE_V64) {
             tcg_out_vex_modrm_pool(s, OPC_MOVQ_VqWq, ret);
         } else if (have_avx2) {
-            tcg_out_vex_modrm_pool(s, OPC_VPBROADCASTQ + vex_l, ret);
+            tcg_out_vex_modrm_pool(s, OPC_VPBROADCASTQ
+                                   | vec_len_flags(type, MO_64), ret);
         } else {
             tcg_out_vex_modrm_pool(s, OPC_MOVDDUP, ret);
         }
@@ -917,6 +1004,7 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     case TCG_TYPE_V64:
     case TCG_TYPE_V128:
     case TCG_TYPE_V256:
+    case TCG_TYPE_V512:
         tcg_debug_assert(ret >= 16);
         tcg_out_dupi_vec(s, type, ret, arg);
         return;
@@ -1017,6 +1105,11 @@ static void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret,
         tcg_out_vex_modrm_offset(s, OPC_MOVDQU_VxWx | P_VEXL,
                                  ret, 0, arg1, arg2);
         break;
+    case TCG_TYPE_V512:
+        tcg_debug_assert(ret >= 16);
+        tcg_out_vex_modrm_offset(s, OPC_MOVDQU_VxWx | P_EVEX,
+                                 ret, 0, arg1, arg2);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -1052,6 +1145,11 @@ static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg,
         tcg_out_vex_modrm_offset(s, OPC_MOVDQU_WxVx | P_VEXL,
                                  arg, 0, arg1, arg2);
         break;
+    case TCG_TYPE_V512:
+        tcg_debug_assert(arg >= 16);
+        tcg_out_vex_modrm_offset(s, OPC_MOVDQU_WxVx | P_EVEX,
+                                 arg, 0, arg1, arg2);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -2606,6 +2704,9 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
     static int const cmpgt_insn[4] = {
         OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD, OPC_PCMPGTQ
     };
+    static int const vpmovm2_insn[4] = {
+        OPC_VPMOVM2B, OPC_VPMOVM2W, OPC_VPMOVM2D, OPC_VPMOVM2Q
+    };
     static int const punpckl_insn[4] = {
         OPC_PUNPCKLBW, OPC_PUNPCKLWD, OPC_PUNPCKLDQ, OPC_PUNPCKLQDQ
     };
@@ -2636,6 +2737,10 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         goto gen_simd;
     case INDEX_op_mul_vec:
         insn = mul_insn[vece];
+        if (type == TCG_TYPE_V512 && vece == MO_64) {
+            /* vpmullq shares its opcode with vpmulld, with EVEX.W set.  */
+            insn = OPC_PMULLD;
+        }
         goto gen_simd;
     case INDEX_op_and_vec:
         insn = OPC_PAND;
@@ -2666,9 +2771,7 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
 #endif
     gen_simd:
         tcg_debug_assert(insn != OPC_UD2);
-        if (type == TCG_TYPE_V256) {
-            insn |= P_VEXL;
-        }
+        insn |= vec_len_flags(type, vece);
         tcg_out_vex_modrm(s, insn, a0, a1, a2);
         break;
 
@@ -2681,31 +2784,40 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         } else {
             g_assert_not_reached();
         }
+        if (type == TCG_TYPE_V512) {
+            /* EVEX compares write a mask register: compare into k1,
+               the only mask register used, and expand it to lanes.  */
+            tcg_out_vex_modrm(s, insn | vec_len_flags(type, vece), 1, a1, a2);
+            tcg_out_vex_modrm(s, vpmovm2_insn[vece] | P_EVEX, a0, 0, 1);
+            break;
+        }
         goto gen_simd;
 
     case INDEX_op_andc_vec:
         insn = OPC_PANDN;
-        if (type == TCG_TYPE_V256) {
-            insn |= P_VEXL;
-        }
+        insn |= vec_len_flags(type, vece);
         tcg_out_vex_modrm(s, insn, a0, a2, a1);
         break;
 
     case INDEX_op_shli_vec:
         sub = 6;
+        insn = shift_imm_insn[vece];
         goto gen_shift;
     case INDEX_op_shri_vec:
         sub = 2;
+        insn = shift_imm_insn[vece];
         goto gen_shift;
     case INDEX_op_sari_vec:
-        tcg_debug_assert(vece != MO_64);
         sub = 4;
-    gen_shift:
-        tcg_debug_assert(vece != MO_8);
         insn = shift_imm_insn[vece];
-        if (type == TCG_TYPE_V256) {
-            insn |= P_VEXL;
+        if (vece == MO_64) {
+            /* vpsraq only exists with EVEX, as EVEX.W1 0x72 /4.  */
+            tcg_debug_assert(type == TCG_TYPE_V512);
+            insn = OPC_PSHIFTD_Ib;
         }
+    gen_shift:
+        tcg_debug_assert(vece != MO_8);
+        insn |= vec_len_flags(type, vece);
         tcg_out_vex_modrm(s, insn, sub, a0, a1);
         tcg_out8(s, a2);
         break;
@@ -2739,18 +2851,14 @@ static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
         sub = args[3];
         goto gen_simd_imm8;
     gen_simd_imm8:
-        if (type == TCG_TYPE_V256) {
-            insn |= P_VEXL;
-        }
+        insn |= vec_len_flags(type, vece);
         tcg_out_vex_modrm(s, insn, a0, a1, a2);
         tcg_out8(s, sub);
         break;
 
     case INDEX_op_x86_vpblendvb_vec:
         insn = OPC_VPBLENDVB;
-        if (type == TCG_TYPE_V256) {
-            insn |= P_VEXL;
-        }
+        insn |= vec_len_flags(type, vece);
         tcg_out_vex_modrm(s, insn, a0, a1, a2);
         tcg_out8(s, args[3] << 4);
         break;
@@ -3036,6 +3144,29 @@ static const TCGTargetOpDef *tcg_target_op_def(TCGOpcode op)
 
 int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
 {
+    if (type == TCG_TYPE_V512) {
+        /* Only the operations that map directly onto EVEX insns; the
+           expansions below rely on insns that lack an EVEX form.  */
+        switch (opc) {
+        case INDEX_op_add_vec:
+        case INDEX_op_sub_vec:
+        case INDEX_op_and_vec:
+        case INDEX_op_or_vec:
+        case INDEX_op_xor_vec:
+        case INDEX_op_andc_vec:
+            return 1;
+        case INDEX_op_cmp_vec:
+            return -1;
+        case INDEX_op_shli_vec:
+        case INDEX_op_shri_vec:
+        case INDEX_op_sari_vec:
+        case INDEX_op_mul_vec:
+            return vece != MO_8;
+        default:
+            return 0;
+        }
+    }
+
     switch (opc) {
     case INDEX_op_add_vec:
     case INDEX_op_sub_vec:
@@ -3481,6 +3612,14 @@ static void tcg_target_init(TCGContext *s)
                 have_avx1 = (c & bit_AVX) != 0;
                 have_avx2 = (b7 & bit_AVX2) != 0;
             }
+            /* AVX-512 also needs the OS to save the opmask and zmm
+               state.  Without EVEX.W in 32-bit mode, leave it to 64-bit
+               hosts.  */
+            if (TCG_TARGET_REG_BITS == 64 && have_avx2
+                && (xcrl & 0xe6) == 0xe6) {
+                have_avx512 = (b7 & bit_AVX512F) && (b7 & bit_AVX512BW)
+                              && (b7 & bit_AVX512DQ);
+            }
         }
     }
 
@@ -3503,6 +3642,9 @@ static void tcg_target_init(TCGContext *s)
     if (have_avx2) {
         tcg_target_available_regs[TCG_TYPE_V256] = ALL_VECTOR_REGS;
     }
+    if (have_avx512) {
+        tcg_target_available_regs[TCG_TYPE_V512] = ALL_VECTOR_REGS;
+    }
 
     tcg_target_call_clobber_regs = ALL_VECTOR_REGS;
     tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_EAX);
@@ -596,6 +596,291 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/* Loads and stores against env.
+
+   Translators often load the same CPUArchState field several times in a
+   row, or store a field only to overwrite it a few ops later.  Track the
+   env slots accessed since the start of the basic block: which temp
+   holds the value of each, and which store to it has not been observed
+   yet.  A load from a slot whose value is known becomes a move, a store
+   of the value a slot already holds is dropped, and a store overwritten
+   before anything could read env is removed.  */
+
+#define MAX_ENV_SLOTS 32
+
+typedef struct EnvSlot {
+    intptr_t ofs;
+    intptr_t size;
+    TCGOpcode ld_opc;   /* load yielding TS from the slot, or NB_OPS */
+    TCGTemp *ts;        /* temp holding the slot's value, or NULL */
+    TCGOp *store;       /* store to the slot not observed yet, or NULL */
+} EnvSlot;
+
+typedef struct EnvState {
+    EnvSlot slot[MAX_ENV_SLOTS];
+    int nb;
+    int victim;
+} EnvState;
+
+static void env_reset(EnvState *e)
+{
+    e->nb = 0;
+    e->victim = 0;
+}
+
+/* Everything stored so far may be read.  */
+static void env_observe_all(EnvState *e)
+{
+    int i;
+
+    for (i = 0; i < e->nb; i++) {
+        e->slot[i].store = NULL;
+    }
+}
+
+/* Forget which temps hold the value of slots; with ALL unset, only
+   forget those that do not survive the end of the basic block.  */
+static void env_forget_values(EnvState *e, bool all)
+{
+    int i;
+
+    for (i = 0; i < e->nb; i++) {
+        TCGTemp *ts = e->slot[i].ts;
+        if (ts && (all || !(ts->temp_global || ts->temp_local))) {
+            e->slot[i].ts = NULL;
+        }
+    }
+}
+
+static void env_forget_temp(EnvState *e, TCGTemp *ts)
+{
+    int i;
+
+    for (i = 0; i < e->nb; i++) {
+        if (e->slot[i].ts == ts) {
+            e->slot[i].ts = NULL;
+        }
+    }
+}
+
+/* An access to [OFS, OFS + SIZE) other than through the slot of that
+   exact range: stores clobber the values of the overlapping slots, and
+   any access makes their pending stores visible.  */
+static void env_access_range(EnvState *e, intptr_t ofs, intptr_t size,
+                             bool is_store, bool exact_too)
+{
+    int i;
+
+    for (i = 0; i < e->nb; i++) {
+        EnvSlot *sl = &e->slot[i];
+        if (sl->ofs < ofs + size && ofs < sl->ofs + sl->size
+            && (exact_too || sl->ofs != ofs || sl->size != size)) {
+            sl->store = NULL;
+            if (is_store) {
+                sl->ts = NULL;
+            }
+        }
+    }
+}
+
+static EnvSlot *env_find_slot(EnvState *e, intptr_t ofs, intptr_t size)
+{
+    EnvSlot *sl;
+    int i;
+
+    for (i = 0; i < e->nb; i++) {
+        if (e->slot[i].ofs == ofs && e->slot[i].size == size) {
+            return &e->slot[i];
+        }
+    }
+
+    /* Reuse a slot that no longer tells anything, or evict one.  */
+    for (i = 0; i < e->nb; i++) {
+        if (e->slot[i].ts == NULL && e->slot[i].store == NULL) {
+            break;
+        }
+    }
+    if (i == e->nb) {
+        if (e->nb < MAX_ENV_SLOTS) {
+            e->nb++;
+        } else {
+            i = e->victim;
+            e->victim = (e->victim + 1) % MAX_ENV_SLOTS;
+        }
+    }
+    sl = &e->slot[i];
+    sl->ofs = ofs;
+    sl->size = size;
+    sl->ld_opc = NB_OPS;
+    sl->ts = NULL;
+    sl->store = NULL;
+    return sl;
+}
+
+static unsigned env_ld_size(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+        return 1;
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/* Return the size of a store, and in *LD_OPC the load that yields the
+   stored temp back, if any.  */
+static unsigned env_st_size(TCGOpcode opc, TCGOpcode *ld_opc)
+{
+    *ld_opc = NB_OPS;
+    switch (opc) {
+    case INDEX_op_st8_i32:
+    case INDEX_op_st8_i64:
+        return 1;
+    case INDEX_op_st16_i32:
+    case INDEX_op_st16_i64:
+        return 2;
+    case INDEX_op_st_i32:
+        *ld_opc = INDEX_op_ld_i32;
+        return 4;
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_st_i64:
+        *ld_opc = INDEX_op_ld_i64;
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/* Update E for OP, before its outputs are considered.  Return true if
+   OP has been replaced by a move or removed.  */
+static bool env_opt(TCGContext *s, EnvState *e, TCGOp *op,
+                    int nb_oargs, int nb_iargs,
+                    struct tcg_temp_info *infos, TCGTempSet *temps_used)
+{
+    TCGOpcode opc = op->opc;
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    TCGOpcode ld_opc;
+    unsigned size;
+    EnvSlot *sl;
+    int i;
+
+    if ((size = env_ld_size(opc)) != 0) {
+        if (arg_temp(op->args[1]) != env) {
+            env_observe_all(e);
+            goto done;
+        }
+        env_access_range(e, op->args[2], size, false, false);
+        sl = env_find_slot(e, op->args[2], size);
+        if (sl->ts && sl->ld_opc == opc) {
+            TCGTemp *ts = sl->ts;
+
+            /* The move does not read env, so a pending store stays dead
+               if the slot is overwritten.  */
+            if (arg_temp(op->args[0]) != ts) {
+                env_forget_temp(e, arg_temp(op->args[0]));
+            }
+            init_ts_info(infos, temps_used, ts);
+            tcg_opt_gen_mov(s, op, op->args[0], temp_arg(ts));
+            return true;
+        }
+        sl->store = NULL;
+        env_forget_temp(e, arg_temp(op->args[0]));
+        sl->ts = arg_temp(op->args[0]);
+        sl->ld_opc = opc;
+        return false;
+    }
+
+    if ((size = env_st_size(opc, &ld_opc)) != 0) {
+        TCGTemp *val = arg_temp(op->args[0]);
+
+        if (arg_temp(op->args[1]) != env) {
+            /* Might point into env.  */
+            env_reset(e);
+            goto done;
+        }
+        env_access_range(e, op->args[2], size, true, false);
+        sl = env_find_slot(e, op->args[2], size);
+        if (sl->ts == val && sl->ld_opc == ld_opc) {
+            /* The slot holds this value already.  */
+            tcg_op_remove(s, op);
+            return true;
+        }
+        if (sl->store) {
+            tcg_op_remove(s, sl->store);
+        }
+        sl->store = op;
+        sl->ts = ld_opc != NB_OPS ? val : NULL;
+        sl->ld_opc = ld_opc;
+        return false;
+    }
+
+    switch (opc) {
+    case INDEX_op_insn_start:
+    case INDEX_op_mb:
+        break;
+
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+        if (arg_temp(op->args[1]) == env) {
+            env_access_range(e, op->args[2], 8 << TCGOP_VECL(op),
+                             opc == INDEX_op_st_vec, true);
+        } else if (opc == INDEX_op_st_vec) {
+            env_reset(e);
+        } else {
+            env_observe_all(e);
+        }
+        break;
+
+    case INDEX_op_call:
+        if (op->args[nb_oargs + nb_iargs + 1] & TCG_CALL_NO_SIDE_EFFECTS) {
+            env_observe_all(e);
+        } else {
+            env_reset(e);
+        }
+        break;
+
+    default:
+        if (def->flags & TCG_OPF_COND_BRANCH) {
+            env_observe_all(e);
+            env_forget_values(e, false);
+        } else if (def->flags & TCG_OPF_BB_END) {
+            env_reset(e);
+        } else if (def->flags & (TCG_OPF_SIDE_EFFECTS | TCG_OPF_CALL_CLOBBER)) {
+            /* Guest memory accesses may fault and unwind to code that
+               reads env; I/O callbacks may also modify it.  */
+            env_observe_all(e);
+#ifdef CONFIG_SOFTMMU
+            env_forget_values(e, true);
+#endif
+        }
+        break;
+    }
+
+ done:
+    if (e->nb) {
+        for (i = 0; i < nb_oargs; i++) {
+            env_forget_temp(e, arg_temp(op->args[i]));
+        }
+    }
+    return false;
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -603,6 +888,7 @@ void tcg_optimize(TCGContext *s)
     TCGOp *op, *op_next, *prev_mb = NULL;
     struct tcg_temp_info *infos;
     TCGTempSet temps_used;
+    EnvState *env_state;
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -613,6 +899,8 @@ void tcg_optimize(TCGContext *s)
     nb_globals = s->nb_globals;
     bitmap_zero(temps_used.l, nb_temps);
     infos = tcg_malloc(sizeof(struct tcg_temp_info) * nb_temps);
+    env_state = tcg_malloc(sizeof(EnvState));
+    env_reset(env_state);
 
     QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
         tcg_target_ulong mask, partmask, affected;
@@ -648,6 +936,12 @@ void tcg_optimize(TCGContext *s)
             }
         }
 
+        /* Forward env stores and loads, drop dead env stores */
+        if (env_opt(s, env_state, op, nb_oargs, nb_iargs,
+                    infos, &temps_used)) {
+            continue;
+        }
+
         /* For commutative operations make constant second argument */
         switch (opc) {
         CASE_OP_32_64_VEC(add):
@@ -825,6 +825,20 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr_pred() - indirect jump with inline prediction
+ * @tb: the TB being translated
+ * @idx: a goto_tb slot not used otherwise by @tb
+ * @dest: the guest address being jumped to, already stored to the CPU state
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but if @dest matches the last target
+ * seen at runtime, jump straight to its TB without calling a helper.  The
+ * caller must guarantee that the jump does not change cs_base or the TB
+ * flags, since only the guest address is compared.
+ */
+void tcg_gen_lookup_and_goto_ptr_pred(TranslationBlock *tb, unsigned idx,
+                                      TCGv dest);
+
 #if TARGET_LONG_BITS == 32
 #define tcg_temp_new() tcg_temp_new_i32()
 #define tcg_global_reg_new tcg_global_reg_new_i32
@@ -1211,6 +1225,11 @@ static inline void tcg_gen_ld_ptr(TCGv_ptr r, TCGv_ptr a, intptr_t o)
     glue(tcg_gen_ld_,PTR)((NAT)r, a, o);
 }
 
+static inline void tcg_gen_movi_ptr(TCGv_ptr r, intptr_t a)
+{
+    glue(tcg_gen_movi_,PTR)((NAT)r, tcg_note_host_ptr(a));
+}
+
 static inline void tcg_gen_discard_ptr(TCGv_ptr a)
 {
     glue(tcg_gen_discard_,PTR)((NAT)a);
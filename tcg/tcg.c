@@ -34,6 +34,7 @@
 #include "qemu/cutils.h"
 #include "qemu/host-utils.h"
 #include "qemu/timer.h"
+#include "qemu/rcu.h"
 
 /* Note: the long term plan is to reduce the dependencies on the QEMU
    CPU definitions. Currently they are used for qemu_ld/st
@@ -147,7 +148,32 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * A region that has filled up stays FULL until it is evicted: its TBs are
+ * invalidated and, once an RCU grace period guarantees that no vCPU is
+ * still executing from it, it becomes FREE again.  Only when eviction
+ * cannot keep up does tb_flush() reset the whole buffer.
  */
+enum tcg_region_status {
+    TCG_REGION_FREE,
+    TCG_REGION_ACTIVE,      /* assigned to a TCGContext */
+    TCG_REGION_FULL,
+    TCG_REGION_EVICTING,    /* TBs invalidated, waiting for RCU */
+};
+
+struct tcg_region_info {
+    enum tcg_region_status status;
+    uint64_t seq;           /* alloc_seq when the region was assigned */
+    size_t size_full;       /* contribution to agg_size_full */
+    unsigned int evict_gen;
+};
+
+struct tcg_region_evict {
+    struct rcu_head rcu;
+    size_t idx;
+    unsigned int evict_gen;
+};
+
 struct tcg_region_state {
     QemuMutex lock;
 
@@ -158,10 +184,14 @@ struct tcg_region_state {
     size_t n;
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
+    size_t evict_watermark; /* evict when fewer regions than this are free */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    size_t n_free; /* number of FREE regions, read locklessly */
+    size_t n_full; /* number of FULL regions, read locklessly */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t alloc_seq;
+    struct tcg_region_info *info;
 };
 
 static struct tcg_region_state region;
@@ -375,22 +405,24 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(void *p)
 {
-    size_t region_idx;
-
     if (p < region.start_aligned) {
-        region_idx = 0;
+        return 0;
     } else {
         ptrdiff_t offset = p - region.start_aligned;
 
         if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
+            return region.n - 1;
         } else {
-            region_idx = offset / region.stride;
+            return offset / region.stride;
         }
     }
-    return region_trees + region_idx * tree_size;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -493,6 +525,16 @@ static void tcg_region_tree_reset_all(void)
     tcg_region_tree_unlock_all();
 }
 
+static void tcg_region_tree_reset(size_t curr_region)
+{
+    struct tcg_region_tree *rt = region_trees + curr_region * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+}
+
 static void tcg_region_bounds(size_t curr_region, void **pstart, void **pend)
 {
     void *start, *end;
@@ -525,11 +567,22 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i;
+
+    if (region.n_free == 0) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    for (i = 0; i < region.n; i++) {
+        if (region.info[i].status == TCG_REGION_FREE) {
+            break;
+        }
+    }
+    g_assert(i < region.n);
+
+    tcg_region_assign(s, i);
+    region.info[i].status = TCG_REGION_ACTIVE;
+    region.info[i].seq = region.alloc_seq++;
+    atomic_set(&region.n_free, region.n_free - 1);
     return false;
 }
 
@@ -540,18 +593,114 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 static bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full_region = tc_ptr_to_region_idx(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.info[full_region].status = TCG_REGION_FULL;
+        region.info[full_region].size_full = size_full - TCG_HIGHWATER;
+        atomic_set(&region.n_full, region.n_full + 1);
     }
     qemu_mutex_unlock(&region.lock);
     return err;
 }
 
+/*
+ * Whether free regions are running low, so that the coldest full region
+ * should be evicted.  Racy, which is fine for a heuristic.
+ */
+bool tcg_region_evict_wanted(void)
+{
+    return atomic_read(&region.n_free) < region.evict_watermark &&
+           atomic_read(&region.n_full) > 0;
+}
+
+/*
+ * Pick the region that was assigned longest ago among the full ones and
+ * mark it for eviction.  Returns false if there is none.  The caller must
+ * invalidate every TB in the region, then call tcg_region_evict_end().
+ */
+bool tcg_region_evict_begin(size_t *pidx)
+{
+    size_t i, best = region.n;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.n; i++) {
+        if (region.info[i].status == TCG_REGION_FULL &&
+            (best == region.n || region.info[i].seq < region.info[best].seq)) {
+            best = i;
+        }
+    }
+    if (best < region.n) {
+        region.info[best].status = TCG_REGION_EVICTING;
+        region.info[best].evict_gen++;
+        atomic_set(&region.n_full, region.n_full - 1);
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    *pidx = best;
+    return best < region.n;
+}
+
+/* Call @func on every TB translated into region @idx */
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/* Whether @p points into region @idx */
+bool tcg_region_contains(size_t idx, const void *p)
+{
+    void *start, *end;
+
+    tcg_region_bounds(idx, &start, &end);
+    return p >= start && p < end;
+}
+
+static void tcg_region_evict_rcu(struct tcg_region_evict *ev)
+{
+    struct tcg_region_info *info = &region.info[ev->idx];
+
+    qemu_mutex_lock(&region.lock);
+    /* a tb_flush() in the meantime may have recycled the region already */
+    if (info->status == TCG_REGION_EVICTING &&
+        info->evict_gen == ev->evict_gen) {
+        tcg_region_tree_reset(ev->idx);
+        region.agg_size_full -= info->size_full;
+        info->size_full = 0;
+        info->status = TCG_REGION_FREE;
+        atomic_set(&region.n_free, region.n_free + 1);
+    }
+    qemu_mutex_unlock(&region.lock);
+    g_free(ev);
+}
+
+/*
+ * All TBs in region @idx are invalid and no jump cache refers to them,
+ * so no new execution can enter it.  Hand it back to the allocator once
+ * vCPUs that may still be running code from it have left their RCU
+ * read-side critical section.
+ */
+void tcg_region_evict_end(size_t idx)
+{
+    struct tcg_region_evict *ev = g_new(struct tcg_region_evict, 1);
+
+    ev->idx = idx;
+    qemu_mutex_lock(&region.lock);
+    ev->evict_gen = region.info[idx].evict_gen;
+    qemu_mutex_unlock(&region.lock);
+
+    call_rcu(ev, tcg_region_evict_rcu, rcu);
+}
+
 /*
  * Perform a context's first region allocation.
  * This function does _not_ increment region.agg_size_full.
@@ -568,7 +717,12 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
-    region.current = 0;
+    for (i = 0; i < region.n; i++) {
+        region.info[i].status = TCG_REGION_FREE;
+        region.info[i].size_full = 0;
+    }
+    atomic_set(&region.n_free, region.n);
+    atomic_set(&region.n_full, 0);
     region.agg_size_full = 0;
 
     for (i = 0; i < n_ctxs; i++) {
@@ -583,40 +737,51 @@ void tcg_region_reset_all(void)
 }
 
 #ifdef CONFIG_USER_ONLY
+static size_t tcg_n_threads(void)
+{
+    return 1;
+}
+
 static size_t tcg_n_regions(void)
 {
     return 1;
 }
 #else
+static size_t tcg_n_threads(void)
+{
+    return qemu_tcg_mttcg_enabled() ? max_cpus : 1;
+}
+
 /*
  * It is likely that some vCPUs will translate more code than others, so we
- * first try to set more regions than max_cpus, with those regions being of
- * reasonable size. If that's not possible we make do by evenly dividing
- * the code_gen_buffer among the vCPUs.
+ * first try to set more regions than vCPU threads, with those regions being
+ * of reasonable size. Spare regions are also what allows cold code to be
+ * evicted a region at a time instead of flushing everything. If that's not
+ * possible we make do by evenly dividing the code_gen_buffer among the vCPUs.
  */
 static size_t tcg_n_regions(void)
 {
+    size_t n_threads = tcg_n_threads();
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
-    }
-
-    /* Try to have more regions than max_cpus, with each region being >= 2 MB */
+    /* Try to have more regions than threads, with each region being >= 2 MB */
     for (i = 8; i > 0; i--) {
         size_t regions_per_thread = i;
         size_t region_size;
 
         region_size = tcg_init_ctx.code_gen_buffer_size;
-        region_size /= max_cpus * regions_per_thread;
+        region_size /= n_threads * regions_per_thread;
 
         if (region_size >= 2 * 1024u * 1024) {
-            return max_cpus * regions_per_thread;
+            return n_threads * regions_per_thread;
         }
     }
+    /* Otherwise keep a spare region per thread, unless they get too small */
+    if (tcg_init_ctx.code_gen_buffer_size / (n_threads * 2) >= 256 * 1024u) {
+        return n_threads * 2;
+    }
     /* If we can't, then just allocate one region per vCPU thread */
-    return max_cpus;
+    return n_threads;
 }
 #endif
 
@@ -677,6 +842,12 @@ void tcg_region_init(void)
     /* init the region struct */
     qemu_mutex_init(&region.lock);
     region.n = n_regions;
+    region.n_free = n_regions;
+    region.info = g_new0(struct tcg_region_info, n_regions);
+    /* without spare regions, there is nothing to evict ahead of time */
+    if (n_regions > tcg_n_threads()) {
+        region.evict_watermark = MAX((n_regions - tcg_n_threads()) / 4, 1);
+    }
     region.size = region_size - page_size;
     region.stride = region_size;
     region.start = buf;
@@ -1085,6 +1256,9 @@ void tcg_func_start(TCGContext *s)
     s->nb_ops = 0;
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+#ifdef CONFIG_USER_ONLY
+    s->tb_unanchored_ptrs = false;
+#endif
 
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
@@ -1257,6 +1431,9 @@ TCGv_vec tcg_temp_new_vec(TCGType type)
     case TCG_TYPE_V256:
         assert(TCG_TARGET_HAS_v256);
         break;
+    case TCG_TYPE_V512:
+        assert(TCG_TARGET_HAS_v512);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -1314,6 +1491,28 @@ TCGv_i64 tcg_const_i64(int64_t val)
     return t0;
 }
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * Only the qemu image and the code buffer are at the same address in
+ * every process that may reuse this TB from the persistent translation
+ * cache.  Remember when any other host pointer, e.g. to heap data passed
+ * to a helper, is embedded in the code.
+ */
+intptr_t tcg_note_host_ptr(intptr_t ptr)
+{
+    extern char __executable_start[], _end[];
+    TCGContext *s = tcg_ctx;
+    uintptr_t p = ptr;
+
+    if (p && !(p >= (uintptr_t)__executable_start && p < (uintptr_t)_end) &&
+        !(p >= (uintptr_t)s->code_gen_buffer &&
+          p - (uintptr_t)s->code_gen_buffer < s->code_gen_buffer_size)) {
+        s->tb_unanchored_ptrs = true;
+    }
+    return ptr;
+}
+#endif
+
 TCGv_i32 tcg_const_local_i32(int32_t val)
 {
     TCGv_i32 t0;
@@ -1356,7 +1555,8 @@ int tcg_check_temp_count(void)
 bool tcg_op_supported(TCGOpcode op)
 {
     const bool have_vec
-        = TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128 | TCG_TARGET_HAS_v256;
+        = (TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128 | TCG_TARGET_HAS_v256
+           | TCG_TARGET_HAS_v512);
 
     switch (op) {
     case INDEX_op_discard:
@@ -2259,6 +2459,28 @@ static void tcg_la_bb_end(TCGContext *s)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced but remain live on the fall-through
+   path.  Indirect globals are the exception: liveness_pass_2 gives them
+   a direct temp that, like any temp, dies at the branch.  */
+static void tcg_la_bb_sync(TCGContext *s)
+{
+    int ng = s->nb_globals;
+    int nt = s->nb_temps;
+    int i;
+
+    for (i = 0; i < ng; ++i) {
+        s->temps[i].state = (s->temps[i].indirect_reg
+                             ? TS_DEAD | TS_MEM
+                             : s->temps[i].state | TS_MEM);
+    }
+    for (i = ng; i < nt; ++i) {
+        s->temps[i].state = (s->temps[i].temp_local
+                             ? s->temps[i].state | TS_MEM
+                             : TS_DEAD);
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -2457,7 +2679,9 @@ static void liveness_pass_1(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if (def->flags & TCG_OPF_COND_BRANCH) {
+                    tcg_la_bb_sync(s);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -2711,20 +2935,29 @@ static void check_regs(TCGContext *s)
 
 static void temp_allocate_frame(TCGContext *s, TCGTemp *ts)
 {
+    tcg_target_long size = sizeof(tcg_target_long);
+    tcg_target_long align;
+
+    /* Vectors need room for the whole register; the backends access
+       them unaligned, so do not align them beyond 16 bytes.  */
+    if (ts->type >= TCG_TYPE_V64) {
+        size = 8 << (ts->type - TCG_TYPE_V64);
+    }
+    align = MIN(size, 16);
+    align = MAX(align, (tcg_target_long)sizeof(tcg_target_long));
+
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
-    s->current_frame_offset = (s->current_frame_offset +
-                               (tcg_target_long)sizeof(tcg_target_long) - 1) &
-        ~(sizeof(tcg_target_long) - 1);
+    s->current_frame_offset = (s->current_frame_offset + align - 1) &
+        ~(align - 1);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_base = s->frame_temp;
     ts->mem_allocated = 1;
-    s->current_frame_offset += sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
 static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet);
@@ -2807,6 +3040,75 @@ static void tcg_reg_free(TCGContext *s, TCGReg reg, TCGRegSet allocated_regs)
     }
 }
 
+/* How many ops to look ahead when choosing a register to spill */
+#define SPILL_LOOKAHEAD 64
+
+static void spill_note_use(TCGContext *s, TCGArg arg, int dist,
+                           TCGRegSet *pending, int *next_use)
+{
+    TCGTemp *ts = arg_temp(arg);
+
+    if (ts && ts->val_type == TEMP_VAL_REG
+        && tcg_regset_test_reg(*pending, ts->reg)
+        && s->reg_to_temp[ts->reg] == ts) {
+        next_use[ts->reg] = dist;
+        tcg_regset_reset_reg(*pending, ts->reg);
+    }
+}
+
+/* Choose which register of 'regs' to spill, all of them being in use.
+   Liveness analysis has killed every value that is not read again, so
+   the register whose value is read furthest from the current op is the
+   best victim; a value that is overwritten, or not read before the end
+   of the basic block or the next call, will not need reloading at all.
+   Among equals, prefer a value already in memory, which needs no store
+   either.  */
+static TCGReg tcg_reg_spill_choice(TCGContext *s, TCGRegSet regs,
+                                   const int *order, int n)
+{
+    int next_use[TCG_TARGET_NB_REGS];
+    TCGRegSet pending = regs;
+    const TCGOp *op = s->alloc_op;
+    TCGReg reg, best = order[0];
+    int dist, i, score, best_score = -1;
+
+    for (dist = 0; op && pending && dist < SPILL_LOOKAHEAD;
+         dist++, op = QTAILQ_NEXT(op, link)) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+        if (op->opc == INDEX_op_call) {
+            break;
+        }
+        if (dist > 0 && (def->flags & TCG_OPF_BB_END)
+            && !(def->flags & TCG_OPF_COND_BRANCH)) {
+            break;
+        }
+        for (i = def->nb_oargs; i < def->nb_oargs + def->nb_iargs; i++) {
+            spill_note_use(s, op->args[i], dist, &pending, next_use);
+        }
+        /* Overwritten before being read again.  */
+        for (i = 0; i < def->nb_oargs; i++) {
+            spill_note_use(s, op->args[i], SPILL_LOOKAHEAD,
+                           &pending, next_use);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        reg = order[i];
+        if (!tcg_regset_test_reg(regs, reg)) {
+            continue;
+        }
+        dist = (tcg_regset_test_reg(pending, reg)
+                ? SPILL_LOOKAHEAD : next_use[reg]);
+        score = dist * 2 + s->reg_to_temp[reg]->mem_coherent;
+        if (score > best_score) {
+            best_score = score;
+            best = reg;
+        }
+    }
+    return best;
+}
+
 /* Allocate a register belonging to reg1 & ~reg2 */
 static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet desired_regs,
                             TCGRegSet allocated_regs, bool rev)
@@ -2826,13 +3128,11 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet desired_regs,
             return reg;
     }
 
-    /* XXX: do better spill choice */
-    for(i = 0; i < n; i++) {
-        reg = order[i];
-        if (tcg_regset_test_reg(reg_ct, reg)) {
-            tcg_reg_free(s, reg, allocated_regs);
-            return reg;
-        }
+    /* otherwise spill the register that is needed the latest */
+    if (reg_ct) {
+        reg = tcg_reg_spill_choice(s, reg_ct, order, n);
+        tcg_reg_free(s, reg, allocated_regs);
+        return reg;
     }
 
     tcg_abort();
@@ -2903,6 +3203,29 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/* at a conditional branch, we assume all temporaries are dead and all
+   globals and local temps are synced to their canonical location; they
+   stay in their registers for the fall-through path.  */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (ts->temp_local) {
+            if (ts->val_type != TEMP_VAL_DEAD) {
+                temp_sync(s, ts, allocated_regs, 0);
+            }
+        } else {
+            /* The liveness analysis already ensures that temps are dead.
+               Keep an tcg_debug_assert for safety. */
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 /* at the end of a basic block, we assume all temporaries are dead and
    all globals are stored at their canonical location. */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
@@ -3118,7 +3441,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -3549,6 +3874,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #ifdef CONFIG_PROFILER
         atomic_set(&prof->table_op_count[opc], prof->table_op_count[opc] + 1);
 #endif
+        s->alloc_op = op;
 
         switch (opc) {
         case INDEX_op_mov_i32:
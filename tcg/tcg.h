@@ -173,7 +173,8 @@ typedef uint64_t TCGRegSet;
 
 #if !defined(TCG_TARGET_HAS_v64) \
     && !defined(TCG_TARGET_HAS_v128) \
-    && !defined(TCG_TARGET_HAS_v256)
+    && !defined(TCG_TARGET_HAS_v256) \
+    && !defined(TCG_TARGET_HAS_v512)
 #define TCG_TARGET_MAYBE_vec            0
 #define TCG_TARGET_HAS_neg_vec          0
 #define TCG_TARGET_HAS_not_vec          0
@@ -195,6 +196,9 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_HAS_v256
 #define TCG_TARGET_HAS_v256             0
 #endif
+#ifndef TCG_TARGET_HAS_v512
+#define TCG_TARGET_HAS_v512             0
+#endif
 
 #ifndef TARGET_INSN_START_EXTRA_WORDS
 # define TARGET_INSN_START_WORDS 1
@@ -274,6 +278,7 @@ typedef enum TCGType {
     TCG_TYPE_V64,
     TCG_TYPE_V128,
     TCG_TYPE_V256,
+    TCG_TYPE_V512,
 
     TCG_TYPE_COUNT, /* number of different types */
 
@@ -665,6 +670,10 @@ struct TCGContext {
 
     TCGRegSet reserved_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
+#ifdef CONFIG_USER_ONLY
+    /* The current TB embeds host pointers outside the qemu image */
+    bool tb_unanchored_ptrs;
+#endif
     intptr_t current_frame_offset;
     intptr_t frame_start;
     intptr_t frame_end;
@@ -700,6 +709,12 @@ struct TCGContext {
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
+#ifdef CONFIG_PLUGIN
+    /* Plugin instrumentation of the TB being translated, if any */
+    struct qemu_plugin_tb *plugin_tb;
+    struct qemu_plugin_insn *plugin_insn;
+#endif
+
     /* These structures are private to tcg-target.inc.c.  */
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_HEAD(ldst_labels, TCGLabelQemuLdst) ldst_labels;
@@ -718,6 +733,8 @@ struct TCGContext {
     /* Tells which temporary holds a given register.
        It does not take into account fixed registers */
     TCGTemp *reg_to_temp[TCG_TARGET_NB_REGS];
+    /* The op being allocated, to look ahead from when spilling */
+    TCGOp *alloc_op;
 
     uint16_t gen_insn_end_off[TCG_MAX_INSNS];
     target_ulong gen_insn_data[TCG_MAX_INSNS][TARGET_INSN_START_WORDS];
@@ -866,6 +883,11 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+bool tcg_region_evict_wanted(void);
+bool tcg_region_evict_begin(size_t *pidx);
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data);
+bool tcg_region_contains(size_t idx, const void *p);
+void tcg_region_evict_end(size_t idx);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -1038,6 +1060,9 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x10,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x20,
+    /* Instruction is a conditional branch: globals and local temps are
+       synced before it but stay valid on the fall-through path.  */
+    TCG_OPF_COND_BRANCH  = 0x40,
 };
 
 typedef struct TCGOpDef {
@@ -1088,12 +1113,22 @@ TCGv_vec tcg_const_ones_vec(TCGType);
 TCGv_vec tcg_const_zeros_vec_matching(TCGv_vec);
 TCGv_vec tcg_const_ones_vec_matching(TCGv_vec);
 
+#ifdef CONFIG_USER_ONLY
+intptr_t tcg_note_host_ptr(intptr_t ptr);
+#else
+# define tcg_note_host_ptr(ptr)  (ptr)
+#endif
+
 #if UINTPTR_MAX == UINT32_MAX
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i32((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
+# define tcg_const_ptr(x) \
+    ((TCGv_ptr)tcg_const_i32(tcg_note_host_ptr((intptr_t)(x))))
+# define tcg_const_local_ptr(x) \
+    ((TCGv_ptr)tcg_const_local_i32(tcg_note_host_ptr((intptr_t)(x))))
 #else
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i64((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
+# define tcg_const_ptr(x) \
+    ((TCGv_ptr)tcg_const_i64(tcg_note_host_ptr((intptr_t)(x))))
+# define tcg_const_local_ptr(x) \
+    ((TCGv_ptr)tcg_const_local_i64(tcg_note_host_ptr((intptr_t)(x))))
 #endif
 
 TCGLabel *gen_new_label(void);
@@ -1228,11 +1263,9 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
  *        TB index (0 or 1). That is, we left the TB via (the equivalent
  *        of) "goto_tb <index>". The main loop uses this to determine
  *        how to link the TB just executed to the next.
- *  2:    we are using instruction counting code generation, and we
- *        did not start executing this TB because the instruction counter
- *        would hit zero midway through it. In this case the pointer
- *        returned is the TB we were about to execute, and the caller must
- *        arrange to execute the remaining count of instructions.
+ *  2:    the execution counter of this TB expired, so it should be
+ *        retranslated as a superblock.  The pointer returned is the TB
+ *        we were about to execute; none of it has run yet.
  *  3:    we stopped because the CPU's exit_request flag was set
  *        (usually meaning that there is an interrupt that needs to be
  *        handled). The pointer returned is the TB we were about to execute
@@ -1255,6 +1288,7 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
 #define TB_EXIT_IDX0      0
 #define TB_EXIT_IDX1      1
 #define TB_EXIT_IDXMAX    1
+#define TB_EXIT_HOT       2
 #define TB_EXIT_REQUESTED 3
 
 #ifdef HAVE_TCG_QEMU_TB_EXEC
@@ -377,6 +377,17 @@ static void migrate_recover(QTestState *who, const char *uri)
     qobject_unref(rsp);
 }
 
+static void migrate_incoming(QTestState *who, const char *uri)
+{
+    QDict *rsp;
+
+    rsp = wait_command(who,
+                       "{ 'execute': 'migrate-incoming', "
+                       "  'arguments': { 'uri': %s } }",
+                       uri);
+    qobject_unref(rsp);
+}
+
 static void migrate_set_capability(QTestState *who, const char *capability,
                                    bool value)
 {
@@ -781,6 +792,110 @@ static void test_precopy_unix(void)
     g_free(uri);
 }
 
+static void test_precopy_multifd_xbzrle(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    int i;
+
+    if (test_migrate_start(&from, &to, "defer", false)) {
+        return;
+    }
+
+    /* The channels must be set up on both sides before listening */
+    migrate_set_capability(from, "x-multifd", true);
+    migrate_set_capability(to, "x-multifd", true);
+    migrate_set_capability(from, "xbzrle", true);
+    migrate_set_capability(to, "xbzrle", true);
+    migrate_set_parameter(from, "x-multifd-channels", 4);
+    migrate_set_parameter(to, "x-multifd-channels", 4);
+    /* Large enough to hold all of the guest's RAM */
+    migrate_set_parameter(from, "xbzrle-cache-size", 256 * 1024 * 1024);
+    migrate_incoming(to, uri);
+
+    /* 1 ms should make it not converge */
+    migrate_set_parameter(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    /*
+     * The guest keeps dirtying its memory, so after the first pass the
+     * pages go out XBZRLE-encoded against the cache; give it a few
+     * passes of that before letting it converge.
+     */
+    for (i = 0; i < 3; i++) {
+        wait_for_migration_pass(from);
+    }
+
+    /* 300 ms should converge */
+    migrate_set_parameter(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
+/*
+ * Save the source to a file, then start the destination from it, with
+ * @capability set on both sides.
+ */
+static void test_precopy_file_capability(const char *capability)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, "defer", false)) {
+        return;
+    }
+
+    migrate_set_capability(from, capability, true);
+    migrate_set_capability(to, capability, true);
+    /* The file is written at full speed and converges on its own */
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    migrate_incoming(to, uri);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_precopy_file_lazy_ram(void)
+{
+    test_precopy_file_capability("x-lazy-ram");
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    test_precopy_file_capability("x-mapped-ram");
+}
+
 int main(int argc, char **argv)
 {
     char template[] = "/tmp/migration-test-XXXXXX";
@@ -832,6 +947,12 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
+    qtest_add_func("/migration/precopy/multifd/xbzrle",
+                   test_precopy_multifd_xbzrle);
+    qtest_add_func("/migration/precopy/file/lazy-ram",
+                   test_precopy_file_lazy_ram);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
 
     ret = g_test_run();
 
@@ -0,0 +1,26 @@
+#!/bin/sh
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Run a linux-user QEMU on a host binary with the example plugin loaded,
+# and check that each of its callbacks fired.
+
+QEMU=$1
+PLUGIN=$2
+LOG=$3
+E=0
+
+rm -f "$LOG"
+if ! "$QEMU" -plugin file="$PLUGIN" -d plugin -D "$LOG" /bin/true; then
+    echo "FAIL: $QEMU exited with an error" 1>&2
+    exit 1
+fi
+
+for i in "translated tbs" "executed tbs" "executed insns"; do
+    if ! grep -q "^$i: [1-9]" "$LOG"; then
+        echo "FAIL: no $i reported in $LOG" 1>&2
+        E=1
+    fi
+done
+
+exit $E
@@ -0,0 +1,53 @@
+/*
+ * Minimal TCG plugin, used by "make check-plugin"
+ *
+ * Counts translated TBs, executed TBs (through a callback) and executed
+ * instructions (through an inline counter), and prints the totals at
+ * exit.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+static uint64_t tb_trans_count;
+static uint64_t tb_exec_count;
+static uint64_t insn_count;
+
+static void vcpu_tb_exec(unsigned int vcpu_index, void *userdata)
+{
+    tb_exec_count++;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, unsigned int vcpu_index,
+                          struct qemu_plugin_tb *tb)
+{
+    tb_trans_count++;
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
+                                             &insn_count,
+                                             qemu_plugin_tb_n_insns(tb));
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *userdata)
+{
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "translated tbs: %" PRIu64 "\n"
+             "executed tbs: %" PRIu64 "\n"
+             "executed insns: %" PRIu64 "\n",
+             tb_trans_count, tb_exec_count, insn_count);
+    qemu_plugin_outs(buf);
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           int argc, char **argv)
+{
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
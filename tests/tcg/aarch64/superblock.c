@@ -0,0 +1,86 @@
+/*
+ * Test hot loops made of several blocks
+ *
+ * Each loop runs far more often than a TB needs to become hot, so its
+ * blocks are retranslated as superblocks.  These follow forward
+ * branches through their fall-through and backward ones through their
+ * target, leaving the other way through a side exit.  The loops are run
+ * with and without superblocks (-singlestep) and must give the same,
+ * known, results.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define N 1000000
+
+/* TBNZ forward, B forward and CBNZ back to the loop header */
+static uint64_t loop_tbnz_cbnz(uint64_t n)
+{
+    uint64_t acc = 0;
+
+    asm("1:     tbnz    %[n], #0, 2f\n\t"
+        "       add     %[acc], %[acc], %[n]\n\t"
+        "       b       3f\n\t"
+        "2:     eor     %[acc], %[acc], %[n], lsl #3\n\t"
+        "3:     sub     %[n], %[n], #1\n\t"
+        "       cbnz    %[n], 1b\n\t"
+        : [acc] "+r"(acc), [n] "+r"(n));
+    return acc;
+}
+
+/* B.LO forward, B forward and B.NE back to the loop header */
+static uint64_t loop_bcond(uint64_t n)
+{
+    uint64_t acc = 0;
+
+    asm("1:     cmp     %[n], #1000\n\t"
+        "       b.lo    2f\n\t"
+        "       add     %[acc], %[acc], %[n], lsr #2\n\t"
+        "       b       3f\n\t"
+        "2:     add     %[acc], %[acc], #7\n\t"
+        "3:     subs    %[n], %[n], #1\n\t"
+        "       b.ne    1b\n\t"
+        : [acc] "+r"(acc), [n] "+r"(n) : : "cc");
+    return acc;
+}
+
+/* Nested loops with a data-dependent branch, as the compiler lays them out */
+static uint64_t collatz_steps(uint64_t max)
+{
+    uint64_t i, n, steps = 0;
+
+    for (i = 1; i <= max; i++) {
+        for (n = i; n != 1; steps++) {
+            if (n & 1) {
+                n = 3 * n + 1;
+            } else {
+                n >>= 1;
+            }
+        }
+    }
+    return steps;
+}
+
+static int check(const char *name, uint64_t got, uint64_t expected)
+{
+    if (got != expected) {
+        printf("%s: got 0x%" PRIx64 ", expected 0x%" PRIx64 "\n",
+               name, got, expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    int err = 0;
+
+    err |= check("tbnz/cbnz", loop_tbnz_cbnz(N), 0x39838ff720ULL);
+    err |= check("b.cond", loop_bcond(N), 0x1d1a8f066dULL);
+    err |= check("collatz", collatz_steps(20000), 1834634);
+    return err;
+}
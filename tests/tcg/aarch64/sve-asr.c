@@ -0,0 +1,89 @@
+/*
+ * Test SVE arithmetic shift right by immediate of 64-bit elements
+ *
+ * With the largest vector length the operation is expanded over host
+ * vectors as wide as the backend supports, e.g. vpsraq on AVX-512.
+ * The insns are spelled out so that no SVE-aware assembler is needed.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+/* The architectural maximum vector length, in bytes */
+#define MAX_VL 256
+
+static int64_t buf[MAX_VL / 8];
+
+static uint64_t sve_vl(void)
+{
+    register uint64_t vl asm("x0");
+
+    asm volatile(".inst 0x04bf5020"     /* rdvl x0, #1 */
+                 : "=r"(vl));
+    return vl;
+}
+
+static void asr5(int64_t *p)
+{
+    register int64_t *x0 asm("x0") = p;
+
+    asm volatile(".inst 0x85804000\n\t" /* ldr z0, [x0] */
+                 ".inst 0x04fb9000\n\t" /* asr z0.d, z0.d, #5 */
+                 ".inst 0xe5804000"     /* str z0, [x0] */
+                 : : "r"(x0) : "memory", "v0");
+}
+
+static void asr64(int64_t *p)
+{
+    register int64_t *x0 asm("x0") = p;
+
+    asm volatile(".inst 0x85804000\n\t" /* ldr z0, [x0] */
+                 ".inst 0x04a09000\n\t" /* asr z0.d, z0.d, #64 */
+                 ".inst 0xe5804000"     /* str z0, [x0] */
+                 : : "r"(x0) : "memory", "v0");
+}
+
+static void fill(int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        buf[i] = (int64_t)(0x9e3779b97f4a7c15ull * (i + 1));
+    }
+}
+
+int main(void)
+{
+    int n = sve_vl() / 8;
+    int i, err = 0;
+
+    fill(n);
+    asr5(buf);
+    for (i = 0; i < n; i++) {
+        int64_t in = (int64_t)(0x9e3779b97f4a7c15ull * (i + 1));
+
+        if (buf[i] != in >> 5) {
+            printf("asr #5, element %d: %016" PRIx64 " != %016" PRIx64 "\n",
+                   i, buf[i], in >> 5);
+            err = 1;
+        }
+    }
+
+    fill(n);
+    asr64(buf);
+    for (i = 0; i < n; i++) {
+        int64_t in = (int64_t)(0x9e3779b97f4a7c15ull * (i + 1));
+
+        if (buf[i] != (in < 0 ? -1 : 0)) {
+            printf("asr #64, element %d: %016" PRIx64 "\n", i, buf[i]);
+            err = 1;
+        }
+    }
+
+    printf("%d elements: %s\n", n, err ? "FAIL" : "PASS");
+    return err;
+}
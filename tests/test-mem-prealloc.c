@@ -0,0 +1,69 @@
+/*
+ * Test os_mem_prealloc() thread splitting
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bitops.h"
+
+#define MAX_NODES 4
+#define MAX_PAGES 9
+
+/*
+ * Preallocate @numpages pages spread over @nr_nodes nodes, with a
+ * PROT_NONE page right after them, and check that each page was touched.
+ * A thread going past the end of the area faults on the guard page.
+ * The nodes need not exist: threads that cannot be bound just run
+ * anywhere.
+ */
+static void test_prealloc_one(size_t numpages, int nr_nodes, bool interleave)
+{
+    size_t pagesize = qemu_fd_getpagesize(-1);
+    size_t host_pages = numpages * pagesize / getpagesize();
+    unsigned long nodes = MAKE_64BIT_MASK(0, nr_nodes);
+    unsigned char *vec;
+    char *area;
+    size_t i;
+
+    area = mmap(NULL, (numpages + 1) * pagesize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_assert(area != MAP_FAILED);
+    g_assert(mprotect(area + numpages * pagesize, pagesize, PROT_NONE) == 0);
+
+    os_mem_prealloc(-1, area, numpages * pagesize, &nodes, nr_nodes,
+                    interleave, &error_abort);
+
+    vec = g_new(unsigned char, host_pages);
+    g_assert(mincore(area, numpages * pagesize, vec) == 0);
+    for (i = 0; i < host_pages; i++) {
+        g_assert(vec[i] & 1);
+    }
+    g_free(vec);
+    munmap(area, (numpages + 1) * pagesize);
+}
+
+static void test_prealloc(gconstpointer opaque)
+{
+    bool interleave = GPOINTER_TO_INT(opaque);
+    size_t numpages;
+    int nr_nodes;
+
+    for (nr_nodes = 1; nr_nodes <= MAX_NODES; nr_nodes++) {
+        for (numpages = 1; numpages <= MAX_PAGES; numpages++) {
+            test_prealloc_one(numpages, nr_nodes, interleave);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/mem-prealloc/bind", GINT_TO_POINTER(false),
+                         test_prealloc);
+    g_test_add_data_func("/mem-prealloc/interleave", GINT_TO_POINTER(true),
+                         test_prealloc);
+    return g_test_run();
+}
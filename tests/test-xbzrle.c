@@ -174,6 +174,117 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_PAGES 256
+
+/*
+ * Fill @old and @new with a page that changed in @runs places, each run
+ * being up to @maxlen bytes long.
+ */
+static void fill_page_pair(uint8_t *old, uint8_t *new, int runs, int maxlen)
+{
+    int i, j;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old[i] = new[i] = g_test_rand_int_range(0, 4);
+    }
+    for (i = 0; i < runs; i++) {
+        int start = g_test_rand_int_range(0, PAGE_SIZE);
+        int len = g_test_rand_int_range(1, maxlen + 1);
+
+        for (j = start; j < start + len && j < PAGE_SIZE; j++) {
+            new[j] = g_test_rand_int_range(0, 4);
+        }
+    }
+}
+
+/* All the encoders must produce the same output */
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *new = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *expected = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    int *expected_len = g_new(int, ACCEL_PAGES);
+    int *size = g_new(int, ACCEL_PAGES);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *buffer = g_malloc(PAGE_SIZE);
+    bool first = true;
+    int i, dlen, rc;
+
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        fill_page_pair(old + i * PAGE_SIZE, new + i * PAGE_SIZE,
+                       g_test_rand_int_range(0, 200),
+                       i % 2 ? 1 : g_test_rand_int_range(1, 300));
+        /* Also exercise the overflow checks */
+        size[i] = i % 4 ? PAGE_SIZE : g_test_rand_int_range(1, PAGE_SIZE + 1);
+    }
+
+    do {
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            dlen = xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                        new + i * PAGE_SIZE, PAGE_SIZE,
+                                        compressed, size[i]);
+            if (first) {
+                expected_len[i] = dlen;
+                memcpy(expected + i * PAGE_SIZE, compressed, MAX(dlen, 0));
+            } else {
+                g_assert_cmpint(dlen, ==, expected_len[i]);
+                g_assert(memcmp(expected + i * PAGE_SIZE, compressed,
+                                MAX(dlen, 0)) == 0);
+            }
+
+            if (dlen > 0) {
+                memcpy(buffer, old + i * PAGE_SIZE, PAGE_SIZE);
+                rc = xbzrle_decode_buffer(compressed, dlen, buffer, PAGE_SIZE);
+                g_assert_cmpint(rc, >, 0);
+                g_assert(memcmp(buffer, new + i * PAGE_SIZE, PAGE_SIZE) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(expected);
+    g_free(expected_len);
+    g_free(size);
+    g_free(compressed);
+    g_free(buffer);
+}
+
+static void test_encode_perf(void)
+{
+    uint8_t *old = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *new = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    int i, accel = 0;
+
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        fill_page_pair(old + i * PAGE_SIZE, new + i * PAGE_SIZE,
+                       g_test_rand_int_range(0, 32), 64);
+    }
+
+    do {
+        double total = 0;
+
+        g_test_timer_start();
+        do {
+            for (i = 0; i < ACCEL_PAGES; i++) {
+                xbzrle_encode_buffer(old + i * PAGE_SIZE, new + i * PAGE_SIZE,
+                                     PAGE_SIZE, compressed, PAGE_SIZE);
+            }
+            total += ACCEL_PAGES * PAGE_SIZE;
+        } while (g_test_timer_elapsed() < 1.0);
+
+        total /= 1024 * 1024 * 1024;
+        g_print("encoder %d: %.2f GB/sec ", accel++,
+                total / g_test_timer_last());
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +297,10 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
+    if (g_test_perf()) {
+        g_test_add_func("/xbzrle/encode_perf", test_encode_perf);
+    }
 
     return g_test_run();
 }
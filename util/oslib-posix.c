@@ -38,9 +38,12 @@
 #include <libgen.h>
 #include <sys/signal.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
+#include "qemu/atomic.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -59,12 +62,19 @@
 #include "qemu/error-report.h"
 #endif
 
-#define MAX_MEM_PREALLOC_THREAD_COUNT 16
+#define MAX_MEM_PREALLOC_THREAD_COUNT 64
+
+/* Pages touched between two updates of the progress counter */
+#define MEM_PREALLOC_PROGRESS_PAGES 1024
 
 struct MemsetThread {
     char *addr;
     size_t numpages;
     size_t hpagesize;
+    /* Distance between two pages touched by this thread */
+    size_t stride;
+    /* Host NUMA node the thread runs on, or -1 */
+    int node;
     QemuThread pgthread;
     sigjmp_buf env;
 };
@@ -74,6 +84,10 @@ static MemsetThread *memset_thread;
 static int memset_num_threads;
 static bool memset_thread_failed;
 
+/* Bytes preallocated so far, and requested so far */
+static size_t mem_prealloc_done;
+static size_t mem_prealloc_total;
+
 int qemu_get_thread_id(void)
 {
 #if defined(__linux__)
@@ -380,6 +394,50 @@ static void sigbus_handler(int signal)
     }
 }
 
+#ifdef CONFIG_LINUX
+/* Restricts the calling thread to the CPUs of host NUMA node @node */
+static void memset_thread_bind(int node)
+{
+    char *path, *cpulist;
+    const char *p;
+    unsigned long first, last;
+    cpu_set_t set;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%d/cpulist", node);
+    if (!g_file_get_contents(path, &cpulist, NULL, NULL)) {
+        g_free(path);
+        return;
+    }
+    g_free(path);
+
+    /* The list looks like "0-7,16-23" */
+    CPU_ZERO(&set);
+    p = cpulist;
+    while (qemu_strtoul(p, &p, 10, &first) == 0) {
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) != 0) {
+            break;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, &set);
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    g_free(cpulist);
+
+    if (CPU_COUNT(&set)) {
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+}
+#else
+static void memset_thread_bind(int node)
+{
+}
+#endif
+
 static void *do_touch_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
@@ -390,12 +448,18 @@ static void *do_touch_pages(void *arg)
     sigaddset(&set, SIGBUS);
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
+    /* Fault pages in from the node that will own them */
+    if (memset_args->node >= 0) {
+        memset_thread_bind(memset_args->node);
+    }
+
     if (sigsetjmp(memset_args->env, 1)) {
         memset_thread_failed = true;
     } else {
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
         size_t hpagesize = memset_args->hpagesize;
+        size_t stride = memset_args->stride;
         size_t i;
         for (i = 0; i < numpages; i++) {
             /*
@@ -411,48 +475,92 @@ static void *do_touch_pages(void *arg)
              * wear on the storage backing the region...
              */
             *(volatile char *)addr = *addr;
-            addr += hpagesize;
+            addr += stride;
+            if ((i + 1) % MEM_PREALLOC_PROGRESS_PAGES == 0) {
+                atomic_add(&mem_prealloc_done,
+                           MEM_PREALLOC_PROGRESS_PAGES * hpagesize);
+            }
         }
+        atomic_add(&mem_prealloc_done,
+                   (numpages % MEM_PREALLOC_PROGRESS_PAGES) * hpagesize);
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+static inline int get_memset_num_threads(size_t numpages, int nr_nodes)
 {
     long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
     int ret = 1;
 
     if (host_procs > 0) {
-        ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus);
+        ret = MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT);
     }
     /* In case sysconf() fails, we fall back to single threaded */
+
+    /*
+     * Give each node the same number of threads, and each thread at least
+     * a page.  With fewer pages than nodes, only the first nodes get one.
+     */
+    ret = MAX(ret / nr_nodes, 1) * nr_nodes;
+    ret = MIN(ret, MAX(numpages, 1));
+    if (ret >= nr_nodes) {
+        ret -= ret % nr_nodes;
+    }
     return ret;
 }
 
+/*
+ * With @nodes, thread i runs on node nodes[i % nr_nodes].  For a bound
+ * area, pages are split in contiguous chunks and the kernel places each
+ * one on the node of the thread faulting it in.  For an interleaved area,
+ * page n belongs to node nodes[n % nr_nodes] and is touched by one of the
+ * threads running there.
+ */
 static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+                            const int *nodes, int nr_nodes, bool interleave)
 {
-    size_t numpages_per_thread;
-    size_t size_per_thread;
-    char *addr = area;
-    int i = 0;
+    int i;
 
     memset_thread_failed = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
+    if (!nodes) {
+        nr_nodes = 1;
+        interleave = false;
+    }
+    memset_num_threads = get_memset_num_threads(numpages, nr_nodes);
     memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = (numpages / memset_num_threads);
-    size_per_thread = (hpagesize * numpages_per_thread);
     for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = (i == (memset_num_threads - 1)) ?
-                                    numpages : numpages_per_thread;
+        size_t first, count;
+
+        if (interleave) {
+            /*
+             * Pages of this node, split between its threads.  Nodes
+             * left without a thread have no page either.
+             */
+            int node_idx = i % nr_nodes;
+            int node_threads = (memset_num_threads - node_idx +
+                                nr_nodes - 1) / nr_nodes;
+            int n = i / nr_nodes;
+            size_t node_pages = numpages > node_idx ?
+                DIV_ROUND_UP(numpages - node_idx, nr_nodes) : 0;
+
+            first = node_pages * n / node_threads;
+            count = node_pages * (n + 1) / node_threads - first;
+            memset_thread[i].addr = area +
+                (node_idx + first * nr_nodes) * hpagesize;
+            memset_thread[i].stride = nr_nodes * hpagesize;
+        } else {
+            first = numpages * i / memset_num_threads;
+            count = numpages * (i + 1) / memset_num_threads - first;
+            memset_thread[i].addr = area + first * hpagesize;
+            memset_thread[i].stride = hpagesize;
+        }
+        memset_thread[i].numpages = count;
         memset_thread[i].hpagesize = hpagesize;
+        memset_thread[i].node = nodes ? nodes[i % nr_nodes] : -1;
         qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
                            do_touch_pages, &memset_thread[i],
                            QEMU_THREAD_JOINABLE);
-        addr += size_per_thread;
-        numpages -= numpages_per_thread;
     }
     for (i = 0; i < memset_num_threads; i++) {
         qemu_thread_join(&memset_thread[i].pgthread);
@@ -463,13 +571,17 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     return memset_thread_failed;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+void os_mem_prealloc(int fd, char *area, size_t memory,
+                     const unsigned long *host_nodes, unsigned long maxnode,
+                     bool interleave, Error **errp)
 {
     int ret;
     struct sigaction act, oldact;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    int *nodes = NULL;
+    int nr_nodes = 0;
+    unsigned long node;
 
     memset(&act, 0, sizeof(act));
     act.sa_handler = &sigbus_handler;
@@ -482,11 +594,22 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
         return;
     }
 
+    if (host_nodes) {
+        nodes = g_new(int, maxnode);
+        for (node = find_first_bit(host_nodes, maxnode); node < maxnode;
+             node = find_next_bit(host_nodes, maxnode, node + 1)) {
+            nodes[nr_nodes++] = node;
+        }
+    }
+    atomic_add(&mem_prealloc_total, numpages * hpagesize);
+
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    if (touch_all_pages(area, hpagesize, numpages,
+                        nr_nodes ? nodes : NULL, nr_nodes, interleave)) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
+    g_free(nodes);
 
     ret = sigaction(SIGBUS, &oldact, NULL);
     if (ret) {
@@ -496,6 +619,12 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+void os_mem_prealloc_progress(size_t *done, size_t *total)
+{
+    *done = atomic_read(&mem_prealloc_done);
+    *total = atomic_read(&mem_prealloc_total);
+}
+
 
 char *qemu_get_pid_name(pid_t pid)
 {
@@ -37,6 +37,7 @@
 #include "trace.h"
 #include "qemu/sockets.h"
 #include "qemu/cutils.h"
+#include "qemu/atomic.h"
 
 /* this must come after including "trace.h" */
 #include <shlobj.h>
@@ -548,8 +549,11 @@ int getpagesize(void)
     return system_info.dwPageSize;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+static size_t mem_prealloc_total;
+
+void os_mem_prealloc(int fd, char *area, size_t memory,
+                     const unsigned long *host_nodes, unsigned long maxnode,
+                     bool interleave, Error **errp)
 {
     int i;
     size_t pagesize = getpagesize();
@@ -558,6 +562,13 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     for (i = 0; i < memory / pagesize; i++) {
         memset(area + pagesize * i, 0, 1);
     }
+    mem_prealloc_total += memory;
+}
+
+void os_mem_prealloc_progress(size_t *done, size_t *total)
+{
+    /* Preallocation is synchronous here */
+    *done = *total = atomic_read(&mem_prealloc_total);
 }
 
 
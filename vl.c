@@ -28,6 +28,7 @@
 #include "qemu-version.h"
 #include "qemu/cutils.h"
 #include "qemu/help_option.h"
+#include "qemu/plugin.h"
 #include "qemu/uuid.h"
 #include "sysemu/seccomp.h"
 
@@ -314,6 +315,11 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "jmp-cache-bits",
+            .type = QEMU_OPT_NUMBER,
+            .help = "log2 of the number of TB jump cache sets per vCPU",
+        },
         { /* end of list */ }
     },
 };
@@ -503,6 +509,12 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrperiod",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "rrseek",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -3886,6 +3898,11 @@ int main(int argc, char **argv, char **envp)
                 g_free(trace_file);
                 trace_file = trace_opt_parse(optarg);
                 break;
+#ifdef CONFIG_PLUGIN
+            case QEMU_OPTION_plugin:
+                qemu_plugin_opt_parse(optarg);
+                break;
+#endif
             case QEMU_OPTION_readconfig:
                 {
                     int ret = qemu_read_config_file(optarg);
@@ -4126,6 +4143,10 @@ int main(int argc, char **argv, char **envp)
         qemu_set_log(0);
     }
 
+    if (qemu_plugin_load_list()) {
+        exit(1);
+    }
+
     /* add configured firmware directories */
     dirs = g_strsplit(CONFIG_QEMU_FIRMWAREPATH, G_SEARCHPATH_SEPARATOR_S, 0);
     for (i = 0; dirs[i] != NULL; i++) {